@@ -0,0 +1,64 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+/*
+ * Cost of a client becoming active while n others have a request
+ * queued: the average add_request time of 2000 new clients adding a
+ * request apiece, the best of three passes. Only the default queue is
+ * used, so it builds against any tree. An optional argument gives the
+ * largest n to run.
+ */
+
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+#include "bench_common.h"
+
+
+namespace b = crimson::bench;
+namespace dmc = crimson::dmclock;
+
+
+int main(int argc, char* argv[]) {
+  const int max_clients = argc > 1 ? std::atoi(argv[1]) : 100000;
+  const int new_clients = 2000;
+  const int passes = 3;
+
+  dmc::ClientInfo info(0.0, 1.0, 0.0);
+
+  std::cout << "active\tadd" << std::endl;
+  for (int n : {10, 100, 1000, 10000, 100000}) {
+    if (n > max_clients) break;
+
+    double best = 0.0;
+    for (int p = 0; p < passes; ++p) {
+      dmc::PullPriorityQueue<int,b::Request>
+	q([&](int c) -> const dmc::ClientInfo* { return &info; }, false);
+      dmc::ReqParams rp(1, 1);
+      const double t = 1000.0;
+      for (int c = 0; c < n; ++c) {
+	q.add_request_time(b::Request{}, c, rp, t);
+      }
+
+      const auto start = b::Clock::now();
+      for (int c = n; c < n + new_clients; ++c) {
+	q.add_request_time(b::Request{}, c, rp, t);
+      }
+      const double ns = b::ns_per(start, new_clients);
+      best = 0 == p ? ns : std::min(best, ns);
+    }
+    std::cout << n << "\t" << int(best) << std::endl;
+  }
+}
@@ -0,0 +1,115 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+/*
+ * Average add_request and pull_request times of a PullPriorityQueue
+ * for each client map policy. With n weight-only clients, each pass
+ * adds one request per client, in a freshly shuffled order, and then
+ * pulls them all. Built with BENCH_DEFAULTS, it times only the
+ * queue's default configuration.
+ */
+
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+
+#include "bench_common.h"
+
+
+namespace b = crimson::bench;
+namespace dmc = crimson::dmclock;
+
+
+struct Times {
+  double add_ns;
+  double pull_ns;
+};
+
+
+template<typename Q>
+Times run(int n) {
+  const auto infos = b::weight_only_infos(n);
+  Q q([&](int c) -> const dmc::ClientInfo* { return &infos[c]; }, false);
+  dmc::ReqParams rp(1, 1);
+
+  std::vector<int> order(n);
+  for (int c = 0; c < n; ++c) {
+    order[c] = c;
+  }
+  std::mt19937 rng(7);
+
+  // one untimed pass so every client has a record
+  double t = 1000.0;
+  for (int c : order) {
+    q.add_request_time(b::Request{}, c, rp, t);
+  }
+  for (int c = 0; c < n; ++c) {
+    q.pull_request(t);
+  }
+
+  const int rounds = 3;
+  const long passes = std::max(300000 / n, 1);
+  Times result{0.0, 0.0};
+  for (int r = 0; r < rounds; ++r) {
+    std::shuffle(order.begin(), order.end(), rng);
+    for (long p = 0; p < passes; ++p) {
+      t += 1e-3;
+      auto start = b::Clock::now();
+      for (int c : order) {
+	q.add_request_time(b::Request{}, c, rp, t);
+      }
+      result.add_ns += b::ns_per(start, n);
+      start = b::Clock::now();
+      for (int c = 0; c < n; ++c) {
+	q.pull_request(t);
+      }
+      result.pull_ns += b::ns_per(start, n);
+    }
+  }
+  result.add_ns /= rounds * passes;
+  result.pull_ns /= rounds * passes;
+  return result;
+}
+
+
+template<typename Q>
+void column(int n) {
+  const Times times = run<Q>(n);
+  std::cout << "\t" << int(times.add_ns) << "\t" << int(times.pull_ns);
+}
+
+
+int main(int argc, char* argv[]) {
+#ifdef BENCH_DEFAULTS
+  std::cout << "clients\tadd\tpull" << std::endl;
+#else
+  std::cout << "clients\tHashClientMap\tOrderedClientMap\tDenseClientMap" <<
+    std::endl << "\tadd\tpull\tadd\tpull\tadd\tpull" << std::endl;
+#endif
+
+  for (int n : {100, 1000, 10000, 100000}) {
+    std::cout << n;
+#ifdef BENCH_DEFAULTS
+    column<dmc::PullPriorityQueue<int,b::Request>>(n);
+#else
+    column<dmc::PullPriorityQueue<int,b::Request,true,false,2,
+				  dmc::HashClientMap>>(n);
+    column<dmc::PullPriorityQueue<int,b::Request,true,false,2,
+				  dmc::OrderedClientMap>>(n);
+    column<dmc::PullPriorityQueue<int,b::Request,true,false,2,
+				  dmc::DenseClientMap>>(n);
+#endif
+    std::cout << std::endl;
+  }
+}
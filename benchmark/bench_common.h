@@ -0,0 +1,83 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+/*
+ * Shared by the queue microbenchmarks in this directory. They use
+ * only the queue interface that has existed since before the queue
+ * policies were added, so that with BENCH_DEFAULTS defined each one
+ * can also be built against an earlier tree (see build_at.sh).
+ */
+
+
+#pragma once
+
+
+#include <chrono>
+#include <vector>
+
+#include "dmclock_server.h"
+
+
+namespace crimson {
+  namespace bench {
+
+    namespace dmc = crimson::dmclock;
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Request {};
+
+    // average ns per op since start
+    inline double ns_per(Clock::time_point start, long ops) {
+      return std::chrono::duration<double,std::nano>(
+	Clock::now() - start).count() / ops;
+    }
+
+
+    // client c has reservation 0, weight 1 + c % 7 and no limit
+    inline std::vector<dmc::ClientInfo> weight_only_infos(int n) {
+      std::vector<dmc::ClientInfo> infos;
+      infos.reserve(n);
+      for (int c = 0; c < n; ++c) {
+	infos.emplace_back(0.0, 1.0 + c % 7, 0.0);
+      }
+      return infos;
+    }
+
+
+    // Steady state of a busy server: n clients have a request queued
+    // each, and each op pulls the next request and adds a new one for
+    // the client served. Returns ns per op.
+    template<typename Q>
+    double pull_and_readd(const std::vector<dmc::ClientInfo>& infos,
+			  long ops) {
+      const int n = int(infos.size());
+      Q q([&](int c) -> const dmc::ClientInfo* { return &infos[c]; },
+	  false);
+      dmc::ReqParams rp(1, 1);
+      double t = 1000.0;
+      for (int c = 0; c < n; ++c) {
+	q.add_request_time(Request{}, c, rp, t);
+      }
+
+      const auto start = Clock::now();
+      for (long i = 0; i < ops; ++i) {
+	t += 1e-6;
+	auto pr = q.pull_request(t);
+	q.add_request_time(Request{}, pr.get_retn().client, rp, t);
+      }
+      return ns_per(start, ops);
+    }
+
+  } // namespace bench
+} // namespace crimson
@@ -0,0 +1,54 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+/*
+ * ns per pull-and-re-add op (see pull_and_readd) of a PullPriorityQueue
+ * with DenseClientMap, with IndirectHeap and with KeyCachingHeap, for
+ * heap branching factors 2 to 4.
+ */
+
+
+#include <iostream>
+
+#include "bench_common.h"
+
+
+namespace b = crimson::bench;
+namespace dmc = crimson::dmclock;
+
+
+template<unsigned B, typename H>
+using Queue = dmc::PullPriorityQueue<int,b::Request,true,false,B,
+				     dmc::DenseClientMap,dmc::DoubleTags,
+				     dmc::RealtimeClock,H>;
+
+
+template<unsigned B>
+void row(const std::vector<dmc::ClientInfo>& infos) {
+  const long ops = 1000000;
+  std::cout << infos.size() << "\t" << B <<
+    "\t" << int(b::pull_and_readd<Queue<B,dmc::IndirectHeap>>(infos, ops)) <<
+    "\t" << int(b::pull_and_readd<Queue<B,dmc::KeyCachingHeap>>(infos, ops)) <<
+    std::endl;
+}
+
+
+int main(int argc, char* argv[]) {
+  std::cout << "clients\tK\tIndirectHeap\tKeyCachingHeap" << std::endl;
+  for (int n : {10000, 100000, 1000000}) {
+    const auto infos = b::weight_only_infos(n);
+    row<2>(infos);
+    row<3>(infos);
+    row<4>(infos);
+  }
+}
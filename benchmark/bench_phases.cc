@@ -0,0 +1,47 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+/*
+ * ns per pull-and-re-add op (see pull_and_readd) of a PullPriorityQueue
+ * with DenseClientMap and weight-only clients, with AllPhases and with
+ * WeightOnly.
+ */
+
+
+#include <iostream>
+
+#include "bench_common.h"
+
+
+namespace b = crimson::bench;
+namespace dmc = crimson::dmclock;
+
+
+template<typename P>
+using Queue = dmc::PullPriorityQueue<int,b::Request,true,false,2,
+				     dmc::DenseClientMap,dmc::DoubleTags,
+				     dmc::RealtimeClock,dmc::IndirectHeap,P>;
+
+
+int main(int argc, char* argv[]) {
+  const long ops = 1000000;
+
+  std::cout << "clients\tAllPhases\tWeightOnly" << std::endl;
+  for (int n : {1000, 10000, 100000}) {
+    const auto infos = b::weight_only_infos(n);
+    std::cout << n <<
+      "\t" << int(b::pull_and_readd<Queue<dmc::AllPhases>>(infos, ops)) <<
+      "\t" << int(b::pull_and_readd<Queue<dmc::WeightOnly>>(infos, ops)) <<
+      std::endl;
+  }
+}
@@ -0,0 +1,135 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+/*
+ * Producers add requests to a PushPriorityQueue whose handler hands
+ * each request to an I/O thread and then spins for 1 us, standing in
+ * for the work of issuing it. Reports the average add_request time
+ * and the average time spent in the handler. Only the default queue
+ * is used, so it builds against any tree with the push queue. An
+ * optional argument gives the number of producers.
+ */
+
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "bench_common.h"
+
+
+namespace b = crimson::bench;
+namespace dmc = crimson::dmclock;
+
+
+struct IoThread {
+  std::mutex              mtx;
+  std::condition_variable cv;
+  std::deque<int>         queued;
+  bool                    finishing = false;
+
+  void run() {
+    std::unique_lock<std::mutex> l(mtx);
+    while (!finishing) {
+      cv.wait_for(l, std::chrono::milliseconds(1));
+      queued.clear();
+    }
+  }
+};
+
+
+struct Handler {
+  IoThread&          io;
+  std::atomic<long>& handled;
+  std::atomic<long>& handler_ns;
+
+  // the request reference type differs with the queue's allocation
+  // policy
+  template<typename RequestRef>
+  void operator()(const int& client,
+		  RequestRef request,
+		  dmc::PhaseType phase,
+		  uint64_t cost) {
+    const auto start = b::Clock::now();
+    {
+      std::lock_guard<std::mutex> l(io.mtx);
+      io.queued.push_back(client);
+    }
+    io.cv.notify_one();
+    const auto until = b::Clock::now() + std::chrono::microseconds(1);
+    while (b::Clock::now() < until) {
+      // spin
+    }
+    ++handled;
+    handler_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+      b::Clock::now() - start).count();
+  }
+};
+
+
+int main(int argc, char* argv[]) {
+  const int producers = argc > 1 ? std::atoi(argv[1]) : 1;
+  const long per_producer = 800000 / producers;
+
+  IoThread io;
+  std::atomic<long> handled(0);
+  std::atomic<long> handler_ns(0);
+  dmc::ClientInfo info(0.0, 1.0, 0.0);
+
+  dmc::PushPriorityQueue<int,b::Request>
+    q([&](int c) -> const dmc::ClientInfo* { return &info; },
+      [] () -> bool { return true; },
+      Handler{io, handled, handler_ns},
+      false);
+
+  std::thread io_thd(&IoThread::run, &io);
+
+  std::vector<std::thread> threads;
+  std::vector<double> add_ns(producers);
+  const auto start = b::Clock::now();
+  for (int p = 0; p < producers; ++p) {
+    threads.emplace_back([&, p] {
+	dmc::ReqParams rp(1, 1);
+	const auto producer_start = b::Clock::now();
+	for (long i = 0; i < per_producer; ++i) {
+	  q.add_request(b::Request{}, p * 100 + i % 100, rp);
+	}
+	add_ns[p] = b::ns_per(producer_start, per_producer);
+      });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  const double secs =
+    std::chrono::duration<double>(b::Clock::now() - start).count();
+
+  {
+    std::lock_guard<std::mutex> l(io.mtx);
+    io.finishing = true;
+  }
+  io_thd.join();
+
+  double avg_add_ns = 0.0;
+  for (double ns : add_ns) {
+    avg_add_ns += ns / producers;
+  }
+  std::cout << "producers " << producers <<
+    "\thandled " << handled <<
+    "\tM/s " << handled / secs / 1e6 <<
+    "\tadd_request ns " << int(avg_add_ns) <<
+    "\thandler ns " << int(double(handler_ns) / handled) << std::endl;
+}
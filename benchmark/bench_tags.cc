@@ -0,0 +1,50 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+/*
+ * ns per pull-and-re-add op (see pull_and_readd) of a PullPriorityQueue
+ * with DoubleTags and with FixedPointTags. Every client has a small
+ * reservation as well as a weight, so both reservation and
+ * proportion tags are computed on each add.
+ */
+
+
+#include <iostream>
+
+#include "bench_common.h"
+
+
+namespace b = crimson::bench;
+namespace dmc = crimson::dmclock;
+
+
+template<typename T>
+using Queue = dmc::PullPriorityQueue<int,b::Request,true,false,2,
+				     dmc::DenseClientMap,T>;
+
+
+int main(int argc, char* argv[]) {
+  const long ops = 1000000;
+
+  std::cout << "clients\tDoubleTags\tFixedPointTags" << std::endl;
+  for (int n : {1000, 10000, 100000}) {
+    std::vector<dmc::ClientInfo> infos;
+    for (int c = 0; c < n; ++c) {
+      infos.emplace_back(1.0, 1.0 + c % 7, 0.0);
+    }
+    std::cout << n <<
+      "\t" << int(b::pull_and_readd<Queue<dmc::DoubleTags>>(infos, ops)) <<
+      "\t" << int(b::pull_and_readd<Queue<dmc::FixedPointTags>>(infos, ops)) <<
+      std::endl;
+  }
+}
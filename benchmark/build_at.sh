@@ -0,0 +1,29 @@
+#!/bin/bash
+
+# Builds one of the benchmarks in this directory against the queue
+# code of another commit, for before-and-after comparisons; e.g.,
+#
+#   ./build_at.sh fab5935~ bench_client_map.cc base -DBENCH_DEFAULTS
+#
+# Compiler flags match a CMAKE_BUILD_TYPE=Release build.
+
+if [ $# -lt 3 ]; then
+  echo "usage: $0 commit benchmark.cc output [compiler flags]"
+  exit 1
+fi
+
+commit=$1
+source=$2
+output=$3
+shift 3
+
+here=$(cd $(dirname $0) && pwd)
+tree=$(mktemp -d)
+trap "rm -rf ${tree}" EXIT
+
+git -C ${here}/.. archive ${commit} src support/src | tar -x -C ${tree} || exit 1
+
+${CXX:-g++} -std=c++11 -O3 -DNDEBUG -pthread "$@" \
+  -I${tree}/src -I${tree}/support/src \
+  ${here}/${source} ${tree}/src/*.cc ${tree}/support/src/*.cc \
+  -o ${output}
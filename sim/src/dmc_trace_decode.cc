@@ -0,0 +1,100 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+// Prints a trace written by PriorityQueueBase::dump_trace, one event
+// per line with times relative to the first event, or with
+// --summary, the adds and dispatches by phase of each client.
+
+
+#include <string.h>
+#include <errno.h>
+
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <vector>
+
+#include "dmclock_trace.h"
+
+
+namespace dmc = crimson::dmclock;
+
+
+static void summarize(const std::vector<dmc::TraceEvent>& events) {
+  struct Counts {
+    uint64_t by_type[4] = { 0, 0, 0, 0 };
+    double   wait = 0.0;
+  };
+  std::map<uint64_t,Counts> clients;
+  for (const auto& e : events) {
+    Counts& c = clients[e.client];
+    ++c.by_type[uint8_t(e.type) & 3];
+    if (dmc::TraceType::add != e.type) {
+      c.wait += e.now - e.arrival;
+    }
+  }
+
+  std::cout << std::setw(20) << "client" <<
+    std::setw(10) << "add" <<
+    std::setw(10) << "resv" <<
+    std::setw(10) << "prop" <<
+    std::setw(10) << "break" <<
+    std::setw(14) << "mean_wait_ms" << std::endl;
+  for (const auto& i : clients) {
+    const Counts& c = i.second;
+    const uint64_t dispatched = c.by_type[1] + c.by_type[2] + c.by_type[3];
+    std::cout << std::setw(20) << i.first;
+    for (int t = 0; t < 4; ++t) {
+      std::cout << std::setw(10) << c.by_type[t];
+    }
+    std::cout << std::setw(14) << std::fixed << std::setprecision(3) <<
+      (dispatched ? 1000.0 * c.wait / dispatched : 0.0) << std::endl;
+  }
+}
+
+
+int main(int argc, char* argv[]) {
+  bool summary = false;
+  std::vector<std::string> paths;
+  for (int i = 1; i < argc; ++i) {
+    if (0 == strcmp("--summary", argv[i])) {
+      summary = true;
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty()) {
+    std::cerr << "usage: " << argv[0] << " [--summary] trace-file..." <<
+      std::endl;
+    return 2;
+  }
+
+  std::vector<dmc::TraceEvent> events;
+  for (const auto& p : paths) {
+    if (!dmc::read_trace(p, events)) {
+      std::cerr << p << ": " << strerror(errno) << std::endl;
+      return 1;
+    }
+  }
+
+  if (summary) {
+    summarize(events);
+  } else if (!events.empty()) {
+    const dmc::Time base = events.front().now;
+    for (const auto& e : events) {
+      dmc::format_trace_event(std::cout, e, base);
+      std::cout << std::endl;
+    }
+  }
+  return 0;
+}
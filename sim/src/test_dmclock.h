@@ -35,7 +35,46 @@ namespace crimson {
       uint64_t proportion_count = 0;
     };
 
-    using DmcQueue = dmc::PushPriorityQueue<ClientId,sim::TestRequest>;
+#ifndef K_WAY_HEAP
+#define K_WAY_HEAP 2
+#endif
+
+    // one of HashClientMap, OrderedClientMap, or DenseClientMap
+#ifndef CLIENT_MAP
+#define CLIENT_MAP HashClientMap
+#endif
+
+    // one of DoubleTags or FixedPointTags
+#ifndef TAG_POLICY
+#define TAG_POLICY DoubleTags
+#endif
+
+    // one of IndirectHeap or KeyCachingHeap
+#ifndef HEAP_POLICY
+#define HEAP_POLICY IndirectHeap
+#endif
+
+    // one of AllPhases, NoReservation, NoLimit, or WeightOnly
+#ifndef PHASE_POLICY
+#define PHASE_POLICY AllPhases
+#endif
+
+    // one of PooledAllocation or HeapAllocation
+#ifndef ALLOC_POLICY
+#define ALLOC_POLICY PooledAllocation
+#endif
+
+    using DmcQueue = dmc::PushPriorityQueue<ClientId,
+					    sim::TestRequest,
+					    true,
+					    false,
+					    K_WAY_HEAP,
+					    dmc::CLIENT_MAP,
+					    dmc::TAG_POLICY,
+					    dmc::RealtimeClock,
+					    dmc::HEAP_POLICY,
+					    dmc::PHASE_POLICY,
+					    dmc::ALLOC_POLICY>;
     using DmcServiceTracker = dmc::ServiceTracker<ServerId,dmc::OrigTracker>;
 
     using DmcServer = sim::SimulatedServer<DmcQueue,
@@ -190,11 +190,15 @@ int main(int argc, char* argv[]) {
   test::CreateQueueF create_queue_f =
     [&](test::DmcQueue::CanHandleRequestFunc can_f,
 	test::DmcQueue::HandleRequestFunc handle_f) -> test::DmcQueue* {
-    return new test::DmcQueue(client_info_f,
-			      can_f,
-			      handle_f,
-			      server_soft_limit,
-			      anticipation_timeout);
+    auto queue = new test::DmcQueue(client_info_f,
+				    can_f,
+				    handle_f,
+				    server_soft_limit,
+				    anticipation_timeout);
+#ifdef PROFILE
+    queue->enable_profiling();
+#endif
+    return queue;
   };
 
 
@@ -316,25 +320,25 @@ void test::server_data(std::ostream& out,
       << std::endl;
 
 #ifdef PROFILE
-  crimson::ProfileCombiner<std::chrono::nanoseconds> art_combiner;
-  crimson::ProfileCombiner<std::chrono::nanoseconds> rct_combiner;
+  using Histogram = crimson::ProfileHistogram<std::chrono::nanoseconds>;
+  Histogram::Snapshot art_combiner;
+  Histogram::Snapshot rct_combiner;
   for (uint i = 0; i < sim->get_server_count(); ++i) {
     const auto& q = sim->get_server(i).get_priority_queue();
-    const auto& art = q.add_request_timer;
-    art_combiner.combine(art);
-    const auto& rct = q.request_complete_timer;
-    rct_combiner.combine(rct);
+    art_combiner.combine(*q.add_request_timer);
+    rct_combiner.combine(*q.request_complete_timer);
   }
-  out << "Server add_request_timer: count:" << art_combiner.get_count() <<
-    ", mean:" << art_combiner.get_mean() <<
-    ", std_dev:" << art_combiner.get_std_dev() <<
-    ", low:" << art_combiner.get_low() <<
-    ", high:" << art_combiner.get_high() << std::endl;
-  out << "Server request_complete_timer: count:" << rct_combiner.get_count() <<
-    ", mean:" << rct_combiner.get_mean() <<
-    ", std_dev:" << rct_combiner.get_std_dev() <<
-    ", low:" << rct_combiner.get_low() <<
-    ", high:" << rct_combiner.get_high() << std::endl;
+  auto report = [&out] (const char* name, const Histogram::Snapshot& h) {
+    out << "Server " << name << ": count:" << h.get_count() <<
+      ", mean:" << h.get_mean() <<
+      ", low:" << h.get_low() <<
+      ", p50:" << h.get_percentile(0.5) <<
+      ", p99:" << h.get_percentile(0.99) <<
+      ", p999:" << h.get_percentile(0.999) <<
+      ", high:" << h.get_high() << std::endl;
+  };
+  report("add_request_timer", art_combiner);
+  report("request_complete_timer", rct_combiner);
   out << "Server combined mean: " <<
     (art_combiner.get_mean() + rct_combiner.get_mean()) <<
     std::endl;
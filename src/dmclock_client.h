@@ -22,7 +22,7 @@
 #include <mutex>
 #include <condition_variable>
 
-#include "run_every.h"
+#include "timer_wheel.h"
 #include "dmclock_util.h"
 #include "dmclock_recs.h"
 
@@ -181,9 +181,10 @@ namespace crimson {
       std::deque<MarkPoint>     clean_mark_points;
       Duration                  clean_age;     // age at which server tracker cleaned
 
-      // NB: All threads declared at end, so they're destructed firs!
-
-      std::unique_ptr<RunEvery> cleaning_job;
+      // cleaning runs on the process-wide timer wheel rather than a
+      // thread of our own
+      TimerWheel&               timer_wheel;
+      TimerWheel::TimerId       cleaning_job;
 
 
     public:
@@ -195,12 +196,12 @@ namespace crimson {
 		     std::chrono::duration<Rep,Per> _clean_age) :
 	delta_counter(1),
 	rho_counter(1),
-	clean_age(std::chrono::duration_cast<Duration>(_clean_age))
+	clean_age(std::chrono::duration_cast<Duration>(_clean_age)),
+	timer_wheel(TimerWheel::shared())
       {
 	cleaning_job =
-	  std::unique_ptr<RunEvery>(
-	    new RunEvery(_clean_every,
-			 std::bind(&ServiceTracker::do_clean, this)));
+	  timer_wheel.add_every(_clean_every,
+				std::bind(&ServiceTracker::do_clean, this));
       }
 
 
@@ -215,6 +216,12 @@ namespace crimson {
       }
 
 
+      ~ServiceTracker() {
+	// waits for a cleaning pass in progress
+	timer_wheel.remove(cleaning_job);
+      }
+
+
       /*
        * Incorporates the response data received into the counters.
        */
@@ -253,9 +260,9 @@ namespace crimson {
     private:
 
       /*
-       * This is being called regularly by RunEvery. Every time it's
-       * called it notes the time and delta counter (mark point) in a
-       * deque. It also looks at the deque to find the most recent
+       * This is being called regularly by the timer wheel. Every
+       * time it's called it notes the time and delta counter (mark
+       * point) in a deque. It also looks at the deque to find the most recent
        * mark point that is older than clean_age. It then walks the
        * map and delete all server entries that were last used before
        * that mark point.
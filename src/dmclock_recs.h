@@ -44,9 +44,15 @@ namespace crimson {
       // count of reservation replies since last request
       uint32_t rho;
 
-      ReqParams(uint32_t _delta, uint32_t _rho) :
+      // bytes the request moves, charged against the byte
+      // reservation and limit of ClientInfo; the server fills this
+      // in, as the client's ServiceTracker knows nothing of it
+      uint32_t bytes;
+
+      ReqParams(uint32_t _delta, uint32_t _rho, uint32_t _bytes = 0) :
 	delta(_delta),
-	rho(_rho)
+	rho(_rho),
+	bytes(_bytes)
       {
 	assert(rho <= delta);
       }
@@ -59,14 +65,19 @@ namespace crimson {
 
       ReqParams(const ReqParams& other) :
 	delta(other.delta),
-	rho(other.rho)
+	rho(other.rho),
+	bytes(other.bytes)
       {
 	// empty
       }
 
       friend std::ostream& operator<<(std::ostream& out, const ReqParams& rp) {
 	out << "ReqParams{ delta:" << rp.delta <<
-	  ", rho:" << rp.rho << " }";
+	  ", rho:" << rp.rho;
+	if (rp.bytes) {
+	  out << ", bytes:" << rp.bytes;
+	}
+	out << " }";
 	return out;
       }
     }; // class ReqParams
@@ -15,21 +15,27 @@
 
 #pragma once
 
-/* COMPILATION OPTIONS
- *
- * The prop_heap does not seem to be necessary. The only thing it
- * would help with is quickly finding the mininum proportion/prioity
- * when an idle client became active. To have the code maintain the
- * proportional heap, define USE_PROP_HEAP (i.e., compiler argument
- * -DUSE_PROP_HEAP).
- */
-
 #include <assert.h>
 
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#endif
+
+#include <errno.h>
+
 #include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
 #include <memory>
 #include <map>
 #include <deque>
+#include <vector>
+#include <functional>
+#include <algorithm>
 #include <queue>
 #include <atomic>
 #include <mutex>
@@ -38,17 +44,24 @@
 #include <iostream>
 #include <sstream>
 #include <limits>
+#include <iterator>
 
 #include <boost/variant.hpp>
 
 #include "indirect_intrusive_heap.h"
-#include "run_every.h"
+#include "keyed_intrusive_heap.h"
+#include "free_list_pool.h"
+#include "small_ring.h"
+#include "mpsc_ring.h"
+#include "open_hash_map.h"
+#include "dense_map.h"
+#include "timer_wheel.h"
+#include "dispatch_pool.h"
+#include "log_histogram.h"
 #include "dmclock_util.h"
 #include "dmclock_recs.h"
-
-#ifdef PROFILE
+#include "dmclock_trace.h"
 #include "profile.h"
-#endif
 
 
 namespace crimson {
@@ -76,18 +89,52 @@ namespace crimson {
       double weight_inv;
       double limit_inv;
 
+      // the same inverses in whole nanoseconds, for fixed-point tags
+      int64_t reservation_inv_ns;
+      int64_t weight_inv_ns;
+      int64_t limit_inv_ns;
+
+      // optional minimum and maximum in bytes per second, charged
+      // with the bytes of each request (see ReqParams); zero means
+      // no constraint. A request advances a tag by whichever of its
+      // op and byte charges is larger, so the tighter one governs.
+      double reservation_bytes;
+      double limit_bytes;
+
+      // seconds per byte
+      double reservation_bytes_inv;
+      double limit_bytes_inv;
+
       // order parameters -- min, "normal", max
-      ClientInfo(double _reservation, double _weight, double _limit) :
+      ClientInfo(double _reservation, double _weight, double _limit,
+		 double _reservation_bytes = 0.0,
+		 double _limit_bytes = 0.0) :
 	reservation(_reservation),
 	weight(_weight),
 	limit(_limit),
 	reservation_inv(0.0 == reservation ? 0.0 : 1.0 / reservation),
 	weight_inv(     0.0 == weight      ? 0.0 : 1.0 / weight),
-	limit_inv(      0.0 == limit       ? 0.0 : 1.0 / limit)
+	limit_inv(      0.0 == limit       ? 0.0 : 1.0 / limit),
+	reservation_inv_ns(inv_ns(reservation)),
+	weight_inv_ns(     inv_ns(weight)),
+	limit_inv_ns(      inv_ns(limit)),
+	reservation_bytes(_reservation_bytes),
+	limit_bytes(_limit_bytes),
+	reservation_bytes_inv(0.0 == reservation_bytes ?
+			      0.0 : 1.0 / reservation_bytes),
+	limit_bytes_inv(0.0 == limit_bytes ? 0.0 : 1.0 / limit_bytes)
       {
 	// empty
       }
 
+      // zero only when value is; very large values round up to one
+      // nanosecond rather than down to zero, which would mean no
+      // constraint
+      static int64_t inv_ns(double value) {
+	return 0.0 == value ?
+	  0 : std::max(int64_t(1), int64_t(std::llround(1.0e9 / value)));
+      }
+
 
       friend std::ostream& operator<<(std::ostream& out,
 				      const ClientInfo& client) {
@@ -97,29 +144,142 @@ namespace crimson {
 	  " l:" << std::fixed << client.limit <<
 	  " 1/r:" << std::fixed << client.reservation_inv <<
 	  " 1/w:" << std::fixed << client.weight_inv <<
-	  " 1/l:" << std::fixed << client.limit_inv <<
-	  " }";
+	  " 1/l:" << std::fixed << client.limit_inv;
+	if (0.0 != client.reservation_bytes || 0.0 != client.limit_bytes) {
+	  out <<
+	    " r_bytes:" << std::fixed << client.reservation_bytes <<
+	    " l_bytes:" << std::fixed << client.limit_bytes;
+	}
+	out << " }";
 	return out;
       }
     }; // class ClientInfo
 
 
-    struct RequestTag {
-      double   reservation;
-      double   proportion;
-      double   limit;
+    // Tag policies determine how RequestTag represents tags. Each
+    // provides value_type along with its extremes, conversions to and
+    // from Time, the per-cost tag increments for a ClientInfo, the
+    // increment for a request's bytes given seconds per byte, and
+    // offset, which adds a delta to a tag but leaves the extremes
+    // pinned.
+
+    // A request is charged for at least this many bytes against a
+    // byte rate, so that a zero-byte request from a client whose only
+    // reservation is in bytes still advances its reservation tag
+    // rather than pinning it (and, with no weight, pinning both).
+    constexpr uint32_t min_charged_bytes = 1;
+
+    // Tags are seconds held in doubles. The default.
+    struct DoubleTags {
+      using value_type = double;
+
+      static constexpr value_type max() { return max_tag; }
+      static constexpr value_type min() { return min_tag; }
+
+      static value_type from_time(const Time time) { return time; }
+      static Time to_time(const value_type tag) { return tag; }
+
+      static value_type reservation_inc(const ClientInfo& info) {
+	return info.reservation_inv;
+      }
+      static value_type weight_inc(const ClientInfo& info) {
+	return info.weight_inv;
+      }
+      static value_type limit_inc(const ClientInfo& info) {
+	return info.limit_inv;
+      }
+
+      static value_type bytes_inc(const double inv, const uint32_t bytes) {
+	return inv * std::max(bytes, min_charged_bytes);
+      }
+
+      // the extremes are infinities, so they stay pinned on their own
+      static value_type offset(const value_type tag, const value_type delta) {
+	return tag + delta;
+      }
+    };
+
+    // Tags are nanoseconds held in 64-bit integers, so tag arithmetic
+    // is exact and reproducible and heap comparisons are integer
+    // comparisons. Uses the ClientInfo inverses precomputed in
+    // nanoseconds.
+    struct FixedPointTags {
+      using value_type = int64_t;
+
+      static constexpr value_type max() {
+	return std::numeric_limits<value_type>::max();
+      }
+      static constexpr value_type min() {
+	return std::numeric_limits<value_type>::min();
+      }
+
+      static value_type from_time(const Time time) {
+	return value_type(std::llround(time * 1.0e9));
+      }
+      static Time to_time(const value_type tag) {
+	if (max() == tag) {
+	  return TimeMax;
+	} else if (min() == tag) {
+	  return -TimeMax;
+	} else {
+	  return tag / 1.0e9;
+	}
+      }
+
+      static value_type reservation_inc(const ClientInfo& info) {
+	return info.reservation_inv_ns;
+      }
+      static value_type weight_inc(const ClientInfo& info) {
+	return info.weight_inv_ns;
+      }
+      static value_type limit_inc(const ClientInfo& info) {
+	return info.limit_inv_ns;
+      }
+
+      // per-byte times are often well under a nanosecond, so this is
+      // computed per request rather than precomputed in ClientInfo;
+      // it rounds up to one nanosecond for the same reason as
+      // ClientInfo::inv_ns
+      static value_type bytes_inc(const double inv, const uint32_t bytes) {
+	return 0.0 == inv ?
+	  0 : std::max(value_type(1),
+		       value_type(std::llround(inv *
+					       std::max(bytes, min_charged_bytes) *
+					       1.0e9)));
+      }
+
+      static value_type offset(const value_type tag, const value_type delta) {
+	return (max() == tag || min() == tag) ? tag : tag + delta;
+      }
+    };
+
+
+    // T is the tag policy (see DoubleTags)
+    template<typename T>
+    struct BasicRequestTag {
+      using Value = typename T::value_type;
+
+      static constexpr Value max_tag = T::max();
+      static constexpr Value min_tag = T::min();
+
+      Value    reservation;
+      Value    proportion;
+      Value    limit;
       Cost     cost;
+      uint32_t bytes; // charged against the byte reservation and limit
       bool     ready; // true when within limit
       Time     arrival;
 
-      RequestTag(const RequestTag& prev_tag,
-		 const ClientInfo& client,
-		 const uint32_t delta,
-		 const uint32_t rho,
-		 const Time time,
-		 const Cost _cost = 1u,
-		 const double anticipation_timeout = 0.0) :
+      BasicRequestTag(const BasicRequestTag& prev_tag,
+		      const ClientInfo& client,
+		      const uint32_t delta,
+		      const uint32_t rho,
+		      const Time time,
+		      const Cost _cost = 1u,
+		      const double anticipation_timeout = 0.0,
+		      const uint32_t _bytes = 0) :
 	cost(_cost),
+	bytes(_bytes),
 	ready(false),
 	arrival(time)
       {
@@ -127,46 +287,52 @@ namespace crimson {
 	Time max_time = time;
 	if (time - anticipation_timeout < prev_tag.arrival)
 	  max_time -= anticipation_timeout;
-	
-	reservation = tag_calc(max_time,
+	const Value tag_time = T::from_time(max_time);
+
+	reservation = tag_calc(tag_time,
 			       prev_tag.reservation,
-			       client.reservation_inv,
+			       T::reservation_inc(client),
 			       rho,
 			       true,
-			       cost);
-	proportion = tag_calc(max_time,
+			       cost,
+			       T::bytes_inc(client.reservation_bytes_inv, bytes));
+	proportion = tag_calc(tag_time,
 			      prev_tag.proportion,
-			      client.weight_inv,
+			      T::weight_inc(client),
 			      delta,
 			      true,
-			      cost);
-	limit = tag_calc(max_time,
+			      cost,
+			      0);
+	limit = tag_calc(tag_time,
 			 prev_tag.limit,
-			 client.limit_inv,
+			 T::limit_inc(client),
 			 delta,
 			 false,
-			 cost);
+			 cost,
+			 T::bytes_inc(client.limit_bytes_inv, bytes));
 
 	assert(reservation < max_tag || proportion < max_tag);
       }
 
-      RequestTag(const RequestTag& prev_tag,
-		 const ClientInfo& client,
-		 const ReqParams req_params,
-		 const Time time,
-		 const Cost cost = 1u,
-		 const double anticipation_timeout = 0.0) :
-	RequestTag(prev_tag, client, req_params.delta, req_params.rho, time,
-		   cost, anticipation_timeout)
+      BasicRequestTag(const BasicRequestTag& prev_tag,
+		      const ClientInfo& client,
+		      const ReqParams req_params,
+		      const Time time,
+		      const Cost cost = 1u,
+		      const double anticipation_timeout = 0.0) :
+	BasicRequestTag(prev_tag, client, req_params.delta, req_params.rho,
+			time, cost, anticipation_timeout, req_params.bytes)
       { /* empty */ }
 
-      RequestTag(const double _res, const double _prop, const double _lim,
-		 const Time _arrival,
-		 const Cost _cost = 1u) :
+      BasicRequestTag(const Value _res, const Value _prop, const Value _lim,
+		      const Time _arrival,
+		      const Cost _cost = 1u,
+		      const uint32_t _bytes = 0) :
 	reservation(_res),
 	proportion(_prop),
 	limit(_lim),
 	cost(_cost),
+	bytes(_bytes),
 	ready(false),
 	arrival(_arrival)
       {
@@ -174,16 +340,19 @@ namespace crimson {
 	assert(reservation < max_tag || proportion < max_tag);
       }
 
-      RequestTag(const RequestTag& other) :
+      BasicRequestTag(const BasicRequestTag& other) :
 	reservation(other.reservation),
 	proportion(other.proportion),
 	limit(other.limit),
 	cost(other.cost),
+	bytes(other.bytes),
 	ready(other.ready),
 	arrival(other.arrival)
       { /* empty */ }
 
-      static std::string format_tag_change(double before, double after) {
+      BasicRequestTag& operator=(const BasicRequestTag& other) = default;
+
+      static std::string format_tag_change(Value before, Value after) {
 	if (before == after) {
 	  return std::string("same");
 	} else {
@@ -193,35 +362,41 @@ namespace crimson {
 	}
       }
 
-      static std::string format_tag(double value) {
+      static std::string format_tag(Value value) {
 	if (max_tag == value) {
 	  return std::string("max");
 	} else if (min_tag == value) {
 	  return std::string("min");
 	} else {
-	  return format_time(value, tag_modulo);
+	  return format_time(T::to_time(value), tag_modulo);
 	}
       }
 
     private:
 
-      static double tag_calc(const Time time,
-			     const double prev,
-			     const double increment,
-			     const uint32_t dist_req_val,
-			     const bool extreme_is_high,
-			     const Cost cost) {
-	if (0.0 == increment) {
+      // bytes_increment is the request's charge against a byte rate,
+      // or zero if there is none; the larger of it and the op charge
+      // advances the tag
+      static Value tag_calc(const Value time,
+			    const Value prev,
+			    const Value increment,
+			    const uint32_t dist_req_val,
+			    const bool extreme_is_high,
+			    const Cost cost,
+			    const Value bytes_increment) {
+	if (0 == increment && 0 == bytes_increment) {
 	  return extreme_is_high ? max_tag : min_tag;
 	} else {
-	  // insure 64-bit arithmetic before conversion to double
-	  double tag_increment = increment * (uint64_t(dist_req_val) + cost);
+	  // insure 64-bit arithmetic before conversion to Value
+	  Value tag_increment =
+	    increment * Value(uint64_t(dist_req_val) + cost);
+	  tag_increment = std::max(tag_increment, bytes_increment);
 	  return std::max(time, prev + tag_increment);
 	}
       }
 
       friend std::ostream& operator<<(std::ostream& out,
-				      const RequestTag& tag) {
+				      const BasicRequestTag& tag) {
 	out <<
 	  "{ RequestTag:: ready:" << (tag.ready ? "true" : "false") <<
 	  " r:" << format_tag(tag.reservation) <<
@@ -233,7 +408,264 @@ namespace crimson {
 	  " }";
 	return out;
       }
-    }; // class RequestTag
+    }; // class BasicRequestTag
+
+    template<typename T>
+    constexpr typename BasicRequestTag<T>::Value BasicRequestTag<T>::max_tag;
+
+    template<typename T>
+    constexpr typename BasicRequestTag<T>::Value BasicRequestTag<T>::min_tag;
+
+    using RequestTag = BasicRequestTag<DoubleTags>;
+
+    // Client map policies determine the container PriorityQueueBase
+    // uses to find a client's record from its id. Each provides a
+    // template alias map_type<C,V> that must support find, end,
+    // begin, erase(iterator), operator[], at, and size, and must not
+    // invalidate iterators on erase.
+
+    // Open-addressing hash map; requires std::hash<C>. The default.
+    struct HashClientMap {
+      template<typename C, typename V>
+      using map_type = c::OpenHashMap<C,V>;
+    };
+
+    // Ordered tree; requires operator< on C. Iterates in id order.
+    struct OrderedClientMap {
+      template<typename C, typename V>
+      using map_type = std::map<C,V>;
+    };
+
+    // Vector indexed by client id; only suitable when client ids are
+    // small integers that are allocated densely.
+    struct DenseClientMap {
+      template<typename C, typename V>
+      using map_type = c::DenseMap<C,V>;
+    };
+
+
+    // Heap policies determine the heap type PriorityQueueBase orders
+    // its clients with. Each provides a template alias
+    // heap_type<I,T,heap_info,C,K> taking the parameters of
+    // IndIntruHeap.
+
+    // Compares clients by way of their records. The default.
+    struct IndirectHeap {
+      template<typename I, typename T, IndIntruHeapData T::*heap_info,
+	       typename C, uint K>
+      using heap_type = c::IndIntruHeap<I,T,heap_info,C,K>;
+    };
+
+    // Keeps each client's sort key in the heap array itself, so
+    // sifting doesn't follow a pointer per comparison; suits queues
+    // with many clients.
+    struct KeyCachingHeap {
+      template<typename I, typename T, IndIntruHeapData T::*heap_info,
+	       typename C, uint K>
+      using heap_type = c::KeyedIndIntruHeap<I,T,heap_info,C,K>;
+    };
+
+
+    // Phase policies say which of the constraint-based phases a
+    // queue supports. A queue built without reservations never
+    // schedules in the reservation phase, and one built without
+    // limits treats every request as within limit; either way the
+    // corresponding heaps are never maintained, and the reservations
+    // or limits in the ClientInfo are ignored.
+    template<bool UseReservation, bool UseLimit>
+    struct Phases {
+      static constexpr bool reservation = UseReservation;
+      static constexpr bool limit = UseLimit;
+    };
+
+    using AllPhases = Phases<true,true>; // the default
+    using NoReservation = Phases<false,true>;
+    using NoLimit = Phases<true,false>;
+    using WeightOnly = Phases<false,false>;
+
+
+    // Allocation policies determine where PriorityQueueBase gets the
+    // memory for its client records and their request queues. Each
+    // provides arena_type, of which the queue owns one, and a
+    // template alias allocator<U> constructed from that arena.
+
+    // Draws from a FreeListPool, so client churn reuses memory rather
+    // than going to malloc while data_mtx is held. Freed records go
+    // back on the pool's free lists, not to the system; its slabs are
+    // only released when the queue is destroyed, so the queue's
+    // footprint stays at the high-water mark of its client
+    // population. The default.
+    struct PooledAllocation {
+      using arena_type = c::FreeListPool;
+
+      template<typename U>
+      using allocator = c::PoolAllocator<U>;
+    };
+
+    // Uses operator new and delete, so memory goes back as soon as a
+    // client is erased; suits queues whose client population peaks
+    // once and then shrinks for good.
+    struct HeapAllocation {
+      struct arena_type {};
+
+      template<typename U>
+      class allocator {
+      public:
+	using value_type = U;
+
+	explicit allocator(arena_type&) {}
+
+	template<typename V>
+	allocator(const allocator<V>&) {}
+
+	U* allocate(size_t n) {
+	  return static_cast<U*>(::operator new(n * sizeof(U)));
+	}
+
+	void deallocate(U* p, size_t n) {
+	  ::operator delete(p);
+	}
+
+	template<typename V>
+	bool operator==(const allocator<V>&) const { return true; }
+
+	template<typename V>
+	bool operator!=(const allocator<V>&) const { return false; }
+      };
+    };
+
+
+    // By default each queued request is allocated on the heap and
+    // held by a std::unique_ptr<R>. For small request types that are
+    // cheap to move, specialize RequestInPlace<R> as std::true_type;
+    // the queues then store requests by value and their RequestRef
+    // becomes InPlaceRequest<R>, saving an allocation per request.
+    template<typename R>
+    struct RequestInPlace : public std::false_type {};
+
+
+    // Holds a request by value while presenting the parts of the
+    // std::unique_ptr interface that users of RequestRef rely on
+    // (dereferencing, get, and testing for emptiness), so code
+    // written against RequestRef works in either mode. R must be
+    // default constructible and move constructible.
+    template<typename R>
+    class InPlaceRequest {
+      R    value;
+      bool engaged;
+
+    public:
+
+      InPlaceRequest() :
+	engaged(false)
+      {
+	// empty
+      }
+
+      explicit InPlaceRequest(R&& _value) :
+	value(std::move(_value)),
+	engaged(true)
+      {
+	// empty
+      }
+
+      InPlaceRequest(InPlaceRequest&& other) :
+	value(std::move(other.value)),
+	engaged(other.engaged)
+      {
+	other.engaged = false;
+      }
+
+      InPlaceRequest& operator=(InPlaceRequest&& other) {
+	value = std::move(other.value);
+	engaged = other.engaged;
+	other.engaged = false;
+	return *this;
+      }
+
+      R& operator*() const { return const_cast<R&>(value); }
+      R* operator->() const { return const_cast<R*>(&value); }
+      R* get() const { return engaged ? const_cast<R*>(&value) : nullptr; }
+      explicit operator bool() const { return engaged; }
+    }; // class InPlaceRequest
+
+
+    // Client state files are a header followed by the states, in the
+    // byte order of the machine that wrote them, so S (and the client
+    // ids within it) must be trivially copyable; see
+    // PriorityQueueBase::save_client_states. Both return false, with
+    // errno set, if the file cannot be written or does not hold
+    // states of type S.
+
+    struct ClientStateHeader {
+      char     magic[8];
+      uint32_t version;
+      uint32_t state_size;
+      uint64_t count;
+      Time     taken_at;
+
+      static constexpr const char* expected_magic = "DMCSTATE";
+    };
+
+
+    template<typename S>
+    bool write_client_states(const std::string& path,
+			     const std::vector<S>& states,
+			     const Time taken_at) {
+      static_assert(std::is_trivially_copyable<S>::value,
+		    "client states must be trivially copyable");
+      std::unique_ptr<FILE,int(*)(FILE*)> f(fopen(path.c_str(), "wb"),
+					    fclose);
+      if (!f) {
+	return false;
+      }
+      ClientStateHeader header;
+      memcpy(header.magic, ClientStateHeader::expected_magic,
+	     sizeof(header.magic));
+      header.version = 1;
+      header.state_size = sizeof(S);
+      header.count = states.size();
+      header.taken_at = taken_at;
+      if (1 != fwrite(&header, sizeof(header), 1, f.get()) ||
+	  states.size() != fwrite(states.data(), sizeof(S),
+				  states.size(), f.get())) {
+	return false;
+      }
+      return 0 == fclose(f.release());
+    }
+
+
+    template<typename S>
+    bool read_client_states(const std::string& path,
+			    std::vector<S>& states,
+			    Time& taken_at) {
+      static_assert(std::is_trivially_copyable<S>::value,
+		    "client states must be trivially copyable");
+      std::unique_ptr<FILE,int(*)(FILE*)> f(fopen(path.c_str(), "rb"),
+					    fclose);
+      if (!f) {
+	return false;
+      }
+      ClientStateHeader header;
+      if (1 != fread(&header, sizeof(header), 1, f.get()) ||
+	  0 != memcmp(header.magic, ClientStateHeader::expected_magic,
+		      sizeof(header.magic)) ||
+	  1 != header.version ||
+	  sizeof(S) != header.state_size) {
+	errno = EINVAL;
+	return false;
+      }
+      std::vector<S> read(header.count);
+      if (header.count != fread(read.data(), sizeof(S),
+				header.count, f.get())) {
+	errno = EINVAL;
+	return false;
+      }
+      states.swap(read);
+      taken_at = header.taken_at;
+      return true;
+    }
+
 
     // C is client identifier type, R is request type,
     // IsDelayed controls whether tag calculation is delayed until the request
@@ -241,23 +673,69 @@ namespace crimson {
     //   originally published dmclock algorithm, allowing it to use the most
     //   recent values of rho and delta.
     // U1 determines whether to use client information function dynamically,
-    // B is heap branching factor
-    template<typename C, typename R, bool IsDelayed, bool U1, uint B>
+    // B is heap branching factor,
+    // M is the client map policy (see HashClientMap),
+    // T is the tag policy (see DoubleTags),
+    // K is the clock source (see RealtimeClock in dmclock_util.h),
+    // H is the heap policy (see IndirectHeap),
+    // P is the phase policy (see Phases),
+    // A is the allocation policy (see PooledAllocation)
+    template<typename C, typename R, bool IsDelayed, bool U1, uint B, typename M,
+	     typename T, typename K, typename H, typename P, typename A>
     class PriorityQueueBase {
       // we don't want to include gtest.h just for FRIEND_TEST
       friend class dmclock_server_client_idle_erase_Test;
+      friend class dmclock_server_pull_client_state_restore_cleaning_Test;
+      friend class dmclock_server_pull_idle_list_order_Test;
 
       // types used for tag dispatch to select between implementations
       using TagCalc = std::integral_constant<bool, IsDelayed>;
       using DelayedTagCalc = std::true_type;
       using ImmediateTagCalc = std::false_type;
+      using InPlaceStorage = std::true_type;
+      using HeapStorage = std::false_type;
 
     public:
 
-      using RequestRef = std::unique_ptr<R>;
+      using TagValue = typename T::value_type;
+      using RequestTag = BasicRequestTag<T>;
+
+      static constexpr TagValue max_tag = T::max();
+      static constexpr TagValue min_tag = T::min();
+
+      using RequestRef =
+	typename std::conditional<RequestInPlace<R>::value,
+				  InPlaceRequest<R>,
+				  std::unique_ptr<R>>::type;
+
+      // Requests may be added with a key (e.g., an op id or the id of
+      // a group of ops) so they can later be removed by key without
+      // visiting every queued request; see remove_by_key.
+      using RequestKey = uint64_t;
+      static constexpr RequestKey no_request_key = 0;
+
+      // the time from the queue's clock source, used whenever the
+      // caller doesn't supply one
+      static Time current_time() {
+	return K::now();
+      }
+
+      // wraps a request for queueing, allocating it unless requests
+      // are stored in place
+      static RequestRef make_request_ref(R&& request) {
+	return make_request_ref(RequestInPlace<R>{}, std::move(request));
+      }
 
     protected:
 
+      static RequestRef make_request_ref(InPlaceStorage, R&& request) {
+	return RequestRef(std::move(request));
+      }
+
+      static RequestRef make_request_ref(HeapStorage, R&& request) {
+	return RequestRef(new R(std::move(request)));
+      }
+
       using TimePoint = decltype(std::chrono::steady_clock::now());
       using Duration = std::chrono::milliseconds;
       using MarkPoint = std::pair<TimePoint,Counter>;
@@ -265,7 +743,7 @@ namespace crimson {
       enum class ReadyOption {ignore, lowers, raises};
 
       // forward decl for friend decls
-      template<double RequestTag::*, ReadyOption, bool>
+      template<TagValue RequestTag::*, ReadyOption, bool>
       struct ClientCompare;
 
       class ClientReq {
@@ -274,15 +752,18 @@ namespace crimson {
 	RequestTag tag;
 	C          client_id;
 	RequestRef request;
+	RequestKey key;
 
       public:
 
 	ClientReq(const RequestTag& _tag,
 		  const C&          _client_id,
-		  RequestRef&&      _request) :
+		  RequestRef&&      _request,
+		  const RequestKey  _key = no_request_key) :
 	  tag(_tag),
 	  client_id(_client_id),
-	  request(std::move(_request))
+	  request(std::move(_request)),
+	  key(_key)
 	{
 	  // empty
 	}
@@ -296,27 +777,60 @@ namespace crimson {
 
     public:
 
+      // Statistics for one client, kept once enable_client_metrics
+      // is called. Waits are in microseconds of the queue's clock,
+      // from a request's arrival time to when it was pulled or
+      // dispatched. The counts are since the client's record was
+      // created; they go when the record is erased.
+      struct ClientMetrics {
+	// requests, and their total cost and bytes, queued when the
+	// snapshot was taken, not counting any still in the submission
+	// ring; kept up to date as requests come and go
+	size_t              queued = 0;
+	uint64_t            queued_cost = 0;
+	uint64_t            queued_bytes = 0;
+
+	// requests dispatched in each phase; limit breaks are also
+	// counted as priority
+	uint64_t            reservation_count = 0;
+	uint64_t            priority_count = 0;
+	uint64_t            limit_break_count = 0;
+
+	c::LogHistogram<32> wait_us;
+      };
+
       // NOTE: ClientRec is in the "public" section for compatibility
       // with g++ 4.8.4, which complains if it's not. By g++ 6.3.1
       // ClientRec could be "protected" with no issue. [See comments
       // associated with function submit_top_request.]
       class ClientRec {
-	friend PriorityQueueBase<C,R,IsDelayed,U1,B>;
+	friend PriorityQueueBase<C,R,IsDelayed,U1,B,M,T,K,H,P,A>;
+
+	// most clients have only a request or two queued, so keep that
+	// many inside the record itself
+	static constexpr size_t inline_requests = 2;
 
 	C                     client;
 	RequestTag            prev_tag;
-	std::deque<ClientReq> requests;
+	c::SmallRing<ClientReq,
+		     inline_requests,
+		     typename A::template allocator<ClientReq>> requests;
 
 	// amount added from the proportion tag as a result of
 	// an idle client becoming unidle
-	double                prop_delta = 0.0;
+	TagValue              prop_delta = 0;
 
 	c::IndIntruHeapData   reserv_heap_data {};
 	c::IndIntruHeapData   lim_heap_data {};
 	c::IndIntruHeapData   ready_heap_data {};
-#if USE_PROP_HEAP
 	c::IndIntruHeapData   prop_heap_data {};
-#endif
+
+	// links in the queue's list of active or idle clients
+	ClientRec*            list_prev = nullptr;
+	ClientRec*            list_next = nullptr;
+
+	// null unless enable_client_metrics was called
+	std::unique_ptr<ClientMetrics> metrics;
 
       public:
 
@@ -328,9 +842,11 @@ namespace crimson {
 
 	ClientRec(C _client,
 		  const ClientInfo* _info,
-		  Counter current_tick) :
+		  Counter current_tick,
+		  typename A::arena_type& arena) :
 	  client(_client),
-	  prev_tag(0.0, 0.0, 0.0, TimeZero),
+	  prev_tag(0, 0, 0, TimeZero),
+	  requests(typename A::template allocator<ClientReq>(arena)),
 	  info(_info),
 	  idle(true),
 	  last_tick(current_tick),
@@ -344,7 +860,8 @@ namespace crimson {
 	  return prev_tag;
 	}
 
-	static inline void assign_unpinned_tag(double& lhs, const double rhs) {
+	static inline void assign_unpinned_tag(TagValue& lhs,
+					       const TagValue rhs) {
 	  if (rhs != max_tag && rhs != min_tag) {
 	    lhs = rhs;
 	  }
@@ -361,8 +878,10 @@ namespace crimson {
 
 	inline void add_request(const RequestTag& tag,
 				const C&          client_id,
-				RequestRef&&      request) {
-	  requests.emplace_back(ClientReq(tag, client_id, std::move(request)));
+				RequestRef&&      request,
+				const RequestKey  key) {
+	  requests.emplace_back(tag, client_id, std::move(request), key);
+	  count_queued(requests.back());
 	}
 
 	inline const ClientReq& next_request() const {
@@ -374,9 +893,36 @@ namespace crimson {
 	}
 
 	inline void pop_request() {
+	  uncount_queued(requests.front());
 	  requests.pop_front();
 	}
 
+	void clear_requests() {
+	  requests.clear();
+	  if (metrics) {
+	    metrics->queued = 0;
+	    metrics->queued_cost = 0;
+	    metrics->queued_bytes = 0;
+	  }
+	}
+
+	// adds the request to the metrics' queued totals, if kept
+	inline void count_queued(const ClientReq& r) {
+	  if (metrics) {
+	    ++metrics->queued;
+	    metrics->queued_cost += r.tag.cost;
+	    metrics->queued_bytes += r.tag.bytes;
+	  }
+	}
+
+	inline void uncount_queued(const ClientReq& r) {
+	  if (metrics) {
+	    --metrics->queued;
+	    metrics->queued_cost -= r.tag.cost;
+	    metrics->queued_bytes -= r.tag.bytes;
+	  }
+	}
+
 	inline bool has_request() const {
 	  return !requests.empty();
 	}
@@ -385,15 +931,20 @@ namespace crimson {
 	  return requests.size();
 	}
 
-	// NB: because a deque is the underlying structure, this
-	// operation might be expensive
-	bool remove_by_req_filter_fw(std::function<bool(RequestRef&&)> filter_accum) {
+	// F is called on each request, and the request is removed if
+	// F returns true.
+	//
+	// NB: erasing from the middle of the ring shifts the requests
+	// on the shorter side, so this operation might be expensive
+	template<typename F>
+	bool remove_by_req_filter_fw(F&& filter) {
 	  bool any_removed = false;
 	  for (auto i = requests.begin();
 	       i != requests.end();
 	       /* no inc */) {
-	    if (filter_accum(std::move(i->request))) {
+	    if (filter(*i)) {
 	      any_removed = true;
+	      uncount_queued(*i);
 	      i = requests.erase(i);
 	    } else {
 	      ++i;
@@ -402,15 +953,17 @@ namespace crimson {
 	  return any_removed;
 	}
 
-	// NB: because a deque is the underlying structure, this
-	// operation might be expensive
-	bool remove_by_req_filter_bw(std::function<bool(RequestRef&&)> filter_accum) {
+	// NB: erasing from the middle of the ring shifts the requests
+	// on the shorter side, so this operation might be expensive
+	template<typename F>
+	bool remove_by_req_filter_bw(F&& filter) {
 	  bool any_removed = false;
 	  for (auto i = requests.rbegin();
 	       i != requests.rend();
 	       /* no inc */) {
-	    if (filter_accum(std::move(i->request))) {
+	    if (filter(*i)) {
 	      any_removed = true;
+	      uncount_queued(*i);
 	      i = decltype(i){ requests.erase(std::next(i).base()) };
 	    } else {
 	      ++i;
@@ -419,14 +972,33 @@ namespace crimson {
 	  return any_removed;
 	}
 
-	inline bool
-	remove_by_req_filter(std::function<bool(RequestRef&&)> filter_accum,
-			     bool visit_backwards) {
+	template<typename F>
+	inline bool remove_by_req_filter(F&& filter, bool visit_backwards) {
 	  if (visit_backwards) {
-	    return remove_by_req_filter_bw(filter_accum);
+	    return remove_by_req_filter_bw(filter);
 	  } else {
-	    return remove_by_req_filter_fw(filter_accum);
+	    return remove_by_req_filter_fw(filter);
+	  }
+	}
+
+	// removes up to count requests with the given key, stopping
+	// once that many have been found; returns the number removed
+	template<typename F>
+	size_t remove_by_key(const RequestKey key, size_t count, F&& accum) {
+	  size_t removed = 0;
+	  for (auto i = requests.begin();
+	       removed < count && i != requests.end();
+	       /* no inc */) {
+	    if (key == i->key) {
+	      accum(std::move(i->request));
+	      ++removed;
+	      uncount_queued(*i);
+	      i = requests.erase(i);
+	    } else {
+	      ++i;
+	    }
 	  }
+	  return removed;
 	}
 
 	friend std::ostream&
@@ -488,46 +1060,365 @@ namespace crimson {
       };
 
 
+      // when several queues are merged (e.g., sharded queues) we need
+      // to know not only which heap the next request would come from,
+      // but how it ranks against the next requests of the other
+      // queues; rank is compared first (lower is better) and key
+      // breaks ties within a rank
+      struct PeekReq {
+	NextReqType type;
+	uint        rank;
+	TagValue    key;
+	Time        when_ready;
+
+	PeekReq() :
+	  type(NextReqType::none),
+	  rank(0),
+	  key(max_tag),
+	  when_ready(TimeMax)
+	{ }
+
+	// true if this request should be handed out before other
+	bool precedes(const PeekReq& other) const {
+	  if (NextReqType::returning == type) {
+	    if (NextReqType::returning != other.type) {
+	      return true;
+	    } else if (rank != other.rank) {
+	      return rank < other.rank;
+	    } else {
+	      return key < other.key;
+	    }
+	  } else if (NextReqType::returning == other.type) {
+	    return false;
+	  } else if (NextReqType::future == type) {
+	    return NextReqType::none == other.type ||
+	      when_ready < other.when_ready;
+	  } else {
+	    return false;
+	  }
+	}
+      };
+
+
       // a function that can be called to look up client information
       using ClientInfoFunc = std::function<const ClientInfo*(const C&)>;
 
 
+      // one element of a batch of requests added in a single call
+      struct AddReq {
+	C          client_id;
+	RequestRef request;
+	ReqParams  req_params;
+	Cost       cost;
+	RequestKey key;
+
+	AddReq(const C& _client_id,
+	       RequestRef&& _request,
+	       const ReqParams& _req_params,
+	       const Cost _cost = 1u,
+	       const RequestKey _key = no_request_key) :
+	  client_id(_client_id),
+	  request(std::move(_request)),
+	  req_params(_req_params),
+	  cost(_cost),
+	  key(_key)
+	{
+	  // empty
+	}
+      };
+
+
+      // a request waiting in the submission ring
+      struct StagedReq {
+	C          client_id;
+	RequestRef request;
+	ReqParams  req_params;
+	Time       time;
+	Cost       cost;
+	RequestKey key;
+
+	StagedReq(const C& _client_id,
+		  RequestRef&& _request,
+		  const ReqParams& _req_params,
+		  const Time _time,
+		  const Cost _cost,
+		  const RequestKey _key) :
+	  client_id(_client_id),
+	  request(std::move(_request)),
+	  req_params(_req_params),
+	  time(_time),
+	  cost(_cost),
+	  key(_key)
+	{
+	  // empty
+	}
+      };
+
+
       bool empty() const {
 	DataGuard g(data_mtx);
-	return (resv_heap.empty() || ! resv_heap.top().has_request());
+	return (ready_heap.empty() || ! ready_heap.top().has_request()) &&
+	  (!submission_ring || submission_ring->empty());
       }
 
 
       size_t client_count() const {
 	DataGuard g(data_mtx);
-	return resv_heap.size();
+	return ready_heap.size();
       }
 
 
       size_t request_count() const {
 	DataGuard g(data_mtx);
 	size_t total = 0;
-	for (auto i = resv_heap.cbegin(); i != resv_heap.cend(); ++i) {
+	for (auto i = ready_heap.cbegin(); i != ready_heap.cend(); ++i) {
 	  total += i->request_count();
 	}
+	if (submission_ring) {
+	  total += submission_ring->size();
+	}
 	return total;
       }
 
 
+      // Counts of requests dispatched in each phase across all
+      // clients; limit breaks are also counted as priority.
+      struct SchedCounts {
+	size_t reservation = 0;
+	size_t priority = 0;
+	size_t limit_break = 0;
+      };
+
+
+      SchedCounts sched_counts() const {
+	DataGuard g(data_mtx);
+	SchedCounts result;
+	result.reservation = reserv_sched_count;
+	result.priority = prop_sched_count;
+	result.limit_break = limit_break_sched_count;
+	return result;
+      }
+
+
+      // Starts keeping per-client statistics (see ClientMetrics),
+      // which costs a read of the clock and a few increments for
+      // each request dispatched.
+      void enable_client_metrics() {
+	DataGuard g(data_mtx);
+	client_metrics_on = true;
+	for (auto& i : client_map) {
+	  ClientRec& client = *i.second;
+	  if (!client.metrics) {
+	    client.metrics.reset(new ClientMetrics);
+	    for (const auto& r : client.requests) {
+	      client.count_queued(r);
+	    }
+	  }
+	}
+      }
+
+
+      // Copies the client's statistics into out; returns false if
+      // metrics are not enabled or the queue has no record of the
+      // client.
+      bool get_client_metrics(const C& client_id, ClientMetrics& out) const {
+	DataGuard g(data_mtx);
+	auto client_it = client_map.find(client_id);
+	if (client_map.end() == client_it || !client_it->second->metrics) {
+	  return false;
+	}
+	copy_metrics(*client_it->second, out);
+	return true;
+      }
+
+
+      // Snapshot of every client's statistics, copied under data_mtx
+      // so the caller can take its time with them; empty if metrics
+      // are not enabled.
+      std::vector<std::pair<C,ClientMetrics>> get_all_client_metrics() const {
+	std::vector<std::pair<C,ClientMetrics>> result;
+	DataGuard g(data_mtx);
+	if (!client_metrics_on) {
+	  return result;
+	}
+	result.reserve(ready_heap.size());
+	for (auto i = ready_heap.cbegin(); i != ready_heap.cend(); ++i) {
+	  result.emplace_back(i->client, ClientMetrics());
+	  copy_metrics(*i, result.back().second);
+	}
+	return result;
+      }
+
+
+      // What restore_client_states needs to put a client back where
+      // it stood in the competition for service, without its
+      // requests. Tags are in seconds whatever the tag policy, with
+      // pinned tags as TimeMax and -TimeMax.
+      struct ClientState {
+	C    client;
+	Time reservation; // of the client's previous request
+	Time proportion;
+	Time limit;
+	Time arrival;
+	Time prop_delta;
+	bool idle;
+      };
+
+
+      // Appends the state of every client the queue has a record
+      // for, and returns the time it was taken by the queue's clock,
+      // which restore_client_states needs to rebase the tags.
+      Time get_client_states(std::vector<ClientState>& out) const {
+	DataGuard g(data_mtx);
+	out.reserve(out.size() + ready_heap.size());
+	for (auto i = ready_heap.cbegin(); i != ready_heap.cend(); ++i) {
+	  const ClientRec& client = *i;
+	  // value-initialized in place, so its padding is zeroed and
+	  // what save_client_states writes depends only on the fields
+	  out.emplace_back();
+	  ClientState& state = out.back();
+	  state.client = client.client;
+	  state.reservation = save_tag(client.prev_tag.reservation);
+	  state.proportion = save_tag(client.prev_tag.proportion);
+	  state.limit = save_tag(client.prev_tag.limit);
+	  state.arrival = client.prev_tag.arrival;
+	  state.prop_delta = T::to_time(client.prop_delta);
+	  state.idle = client.idle;
+	}
+	return current_time();
+      }
+
+
+      // Recreates the records of clients from states taken at
+      // taken_at, as if the time since then had not passed: every
+      // tag is moved forward by the difference between the queue's
+      // clock now and taken_at, so clients keep their standing
+      // relative to each other and to the clock even if the clock
+      // was reset in between. Clients the queue already has a record
+      // for are left as they are, so this is best done before adding
+      // requests. Restored clients that were active are cleaned like
+      // any other once they go unused for idle_age and erase_age;
+      // ones that were idle are taken to be older than any other
+      // client, so they are erased by the first cleaning pass that
+      // erases anything.
+      void restore_client_states(const std::vector<ClientState>& states,
+				 const Time taken_at) {
+	DataGuard g(data_mtx);
+	const Time shift = current_time() - taken_at;
+	for (const auto& state : states) {
+	  if (client_map.end() != client_map.find(state.client)) {
+	    continue;
+	  }
+	  ClientRec& client = get_client_rec(state.client);
+	  client.prev_tag.reservation = restore_tag(state.reservation, shift);
+	  client.prev_tag.proportion = restore_tag(state.proportion, shift);
+	  client.prev_tag.limit = restore_tag(state.limit, shift);
+	  client.prev_tag.arrival = state.arrival + shift;
+	  client.prop_delta = T::from_time(state.prop_delta);
+	  // the cleaning lists are kept in last_tick order
+	  idle_clients.remove(client);
+	  if (state.idle) {
+	    client.last_tick = 0;
+	    idle_clients.push_front(client);
+	  } else {
+	    client.idle = false;
+	    client.last_tick = tick;
+	    active_clients.push_back(client);
+	  }
+	  adjust_heaps(client);
+	}
+      }
+
+
+      // Writes get_client_states to a file for load_client_states,
+      // e.g., when shutting down to restart. Requires trivially
+      // copyable client ids.
+      bool save_client_states(const std::string& path) const {
+	static_assert(std::is_trivially_copyable<C>::value,
+		      "saving client states requires trivially copyable ids");
+	std::vector<ClientState> states;
+	const Time taken_at = get_client_states(states);
+	return write_client_states(path, states, taken_at);
+      }
+
+
+      // Restores the client states in a file written by
+      // save_client_states; see restore_client_states.
+      bool load_client_states(const std::string& path) {
+	static_assert(std::is_trivially_copyable<C>::value,
+		      "loading client states requires trivially copyable ids");
+	std::vector<ClientState> states;
+	Time taken_at;
+	if (!read_client_states(path, states, taken_at)) {
+	  return false;
+	}
+	restore_client_states(states, taken_at);
+	return true;
+      }
+
+
+      // Starts recording each add and dispatch in a ring of the
+      // given capacity (rounded up to a power of two), replacing any
+      // earlier trace. Each event takes 64 bytes.
+      void enable_trace(size_t capacity) {
+	DataGuard g(data_mtx);
+	trace_ring.reset(new TraceRing(capacity));
+      }
+
+
+      // Appends the events in the trace ring, oldest first. Requests
+      // still in the submission ring have not been traced yet.
+      void get_trace(std::vector<TraceEvent>& out) const {
+	DataGuard g(data_mtx);
+	if (trace_ring) {
+	  trace_ring->copy(out);
+	}
+      }
+
+
+      // Writes the trace ring to a file for dmc_trace_decode; the
+      // events are copied under data_mtx and written after it is
+      // released. Returns false, with errno set, on failure.
+      bool dump_trace(const std::string& path) const {
+	std::vector<TraceEvent> events;
+	get_trace(events);
+	return write_trace(path, events);
+      }
+
+
+      // Once enabled, add_request stages requests in a lock-free ring
+      // rather than taking data_mtx, and whichever thread next holds
+      // data_mtx to pull or schedule moves them into the heaps. This
+      // keeps producers from waiting on pulls. When the ring is full,
+      // add_request falls back to taking the lock. A request whose
+      // producer is still filling its slot is not waited for; it and
+      // those staged after it are moved in by a later drain, which
+      // that producer prompts once its push completes. Must be called
+      // before the queue is shared between threads.
+      void enable_submission_ring(size_t capacity) {
+	assert(capacity > 0);
+	submission_ring.reset(new c::MpscRing<StagedReq>(capacity));
+      }
+
+
       bool remove_by_req_filter(std::function<bool(RequestRef&&)> filter_accum,
 				bool visit_backwards = false) {
 	bool any_removed = false;
 	DataGuard g(data_mtx);
-	for (auto i : client_map) {
-	  bool modified =
-	    i.second->remove_by_req_filter(filter_accum, visit_backwards);
-	  if (modified) {
-	    resv_heap.adjust(*i.second);
-	    limit_heap.adjust(*i.second);
-	    ready_heap.adjust(*i.second);
-#if USE_PROP_HEAP
-	    prop_heap.adjust(*i.second);
-#endif
+	drain_submission_ring();
+	for (auto& i : client_map) {
+	  ClientRec& client = *i.second;
+	  auto filter = [&] (ClientReq& r) -> bool {
+	    if (!filter_accum(std::move(r.request))) {
+	      return false;
+	    }
+	    if (no_request_key != r.key) {
+	      unindex_request(client, r.key);
+	    }
+	    return true;
+	  };
+	  if (client.remove_by_req_filter(filter, visit_backwards)) {
+	    adjust_heaps(client);
 	    any_removed = true;
 	  }
 	}
@@ -545,6 +1436,7 @@ namespace crimson {
 			    bool reverse = false,
 			    std::function<void (RequestRef&&)> accum = request_sink) {
 	DataGuard g(data_mtx);
+	drain_submission_ring();
 
 	auto i = client_map.find(client);
 
@@ -564,14 +1456,42 @@ namespace crimson {
 	  }
 	}
 
-	i->second->requests.clear();
+	unindex_requests(*i->second);
+	i->second->clear_requests();
 
-	resv_heap.adjust(*i->second);
-	limit_heap.adjust(*i->second);
-	ready_heap.adjust(*i->second);
-#if USE_PROP_HEAP
-	prop_heap.adjust(*i->second);
-#endif
+	adjust_heaps(*i->second);
+      }
+
+
+      // Removes every queued request that was added with the given
+      // key, passing each to accum, and returns how many were
+      // removed. Only the clients holding such requests are visited,
+      // and each stops being scanned once all of its requests with
+      // the key have been found.
+      size_t remove_by_key(const RequestKey key,
+			   std::function<void (RequestRef&&)> accum = request_sink) {
+	assert(no_request_key != key);
+	DataGuard g(data_mtx);
+	drain_submission_ring();
+
+	auto k = request_index.find(key);
+	if (request_index.end() == k) return 0;
+
+	KeyedClients keyed = std::move(k->second);
+	request_index.erase(k);
+
+	size_t removed = 0;
+	keyed.for_each([&] (ClientRec* client, size_t count) {
+	    const bool had_front = client->next_request().key == key;
+	    removed += client->remove_by_key(key, count, accum);
+	    if (had_front) {
+	      // the removed front request's tag becomes the basis
+	      // for the new front's tag
+	      update_next_tag(TagCalc{}, *client, client->get_req_tag());
+	    }
+	    adjust_heaps(*client);
+	  });
+	return removed;
       }
 
 
@@ -592,7 +1512,7 @@ namespace crimson {
 
       void update_client_infos() {
 	DataGuard g(data_mtx);
-	for (auto i : client_map) {
+	for (auto& i : client_map) {
 	  i.second->info = client_info_f(i.second->client);
 	}
       }
@@ -607,13 +1527,17 @@ namespace crimson {
 	  out << "  { client:" << c.first << ", record:" << *c.second <<
 	    " }";
 	}
-	if (!q.resv_heap.empty()) {
-	  const auto& resv = q.resv_heap.top();
-	  out << " { reservation_top:" << resv << " }";
+	if (!q.ready_heap.empty()) {
+	  if (P::reservation) {
+	    const auto& resv = q.resv_heap.top();
+	    out << " { reservation_top:" << resv << " }";
+	  }
 	  const auto& ready = q.ready_heap.top();
 	  out << " { ready_top:" << ready << " }";
-	  const auto& limit = q.limit_heap.top();
-	  out << " { limit_top:" << limit << " }";
+	  if (P::limit) {
+	    const auto& limit = q.limit_heap.top();
+	    out << " { limit_top:" << limit << " }";
+	  }
 	} else {
 	  out << " HEAPS-EMPTY";
 	}
@@ -630,25 +1554,42 @@ namespace crimson {
 			  bool show_prop = true) const {
 	auto filter = [](const ClientRec& e)->bool { return true; };
 	DataGuard g(data_mtx);
-	if (show_res) {
+	if (show_res && P::reservation) {
 	  resv_heap.display_sorted(out << "RESER:", filter);
 	}
-	if (show_lim) {
+	if (show_lim && P::limit) {
 	  limit_heap.display_sorted(out << "LIMIT:", filter);
 	}
 	if (show_ready) {
 	  ready_heap.display_sorted(out << "READY:", filter);
 	}
-#if USE_PROP_HEAP
 	if (show_prop) {
 	  prop_heap.display_sorted(out << "PROPO:", filter);
 	}
-#endif
       } // display_queues
 
 
     protected:
 
+      // The sort key a KeyCachingHeap keeps for a client: rank
+      // first, then tag value.
+      struct HeapKey {
+	uint32_t rank;
+	TagValue value;
+
+	HeapKey(uint32_t _rank, TagValue _value) :
+	  rank(_rank),
+	  value(_value)
+	{
+	  // empty
+	}
+
+	bool operator<(const HeapKey& other) const {
+	  return rank < other.rank ||
+	    (rank == other.rank && value < other.value);
+	}
+      };
+
       // The ClientCompare functor is essentially doing a precedes?
       // operator, returning true if and only if the first parameter
       // must precede the second parameter. If the second must precede
@@ -669,10 +1610,32 @@ namespace crimson {
       //
       // use_prop_delta determines whether the proportional delta is
       // added in for comparison
-      template<double RequestTag::*tag_field,
+      template<TagValue RequestTag::*tag_field,
 	       ReadyOption ready_opt,
 	       bool use_prop_delta>
       struct ClientCompare {
+	using key_type = HeapKey;
+
+	// keys order clients the same way operator() orders records
+	static HeapKey key(const ClientRec& n) {
+	  if (!n.has_request()) {
+	    return HeapKey(2, 0);
+	  }
+	  const auto& t = n.next_request().tag;
+	  const uint32_t rank =
+	    ReadyOption::raises == ready_opt ? !t.ready :
+	    ReadyOption::lowers == ready_opt ? t.ready :
+	    0;
+	  return HeapKey(rank,
+			 use_prop_delta ?
+			 T::offset(t.*tag_field, n.prop_delta) :
+			 t.*tag_field);
+	}
+
+	bool operator()(const HeapKey& k1, const HeapKey& k2) const {
+	  return k1 < k2;
+	}
+
 	bool operator()(const ClientRec& n1, const ClientRec& n2) const {
 	  if (n1.has_request()) {
 	    if (n2.has_request()) {
@@ -681,8 +1644,8 @@ namespace crimson {
 	      if (ReadyOption::ignore == ready_opt || t1.ready == t2.ready) {
 		// if we don't care about ready or the ready values are the same
 		if (use_prop_delta) {
-		  return (t1.*tag_field + n1.prop_delta) <
-		    (t2.*tag_field + n2.prop_delta);
+		  return T::offset(t1.*tag_field, n1.prop_delta) <
+		    T::offset(t2.*tag_field, n2.prop_delta);
 		} else {
 		  return t1.*tag_field < t2.*tag_field;
 		}
@@ -706,45 +1669,256 @@ namespace crimson {
 	}
       };
 
-      ClientInfoFunc        client_info_f;
-      static constexpr bool is_dynamic_cli_info_f = U1;
+      // Orders clients for the prop_heap, which exists so the lowest
+      // proportion tag among active clients can be found when an idle
+      // client becomes active. Idle clients sort after all active
+      // ones, and an active client without a request is ordered by
+      // the proportion tag of its previous request.
+      struct ActivePropCompare {
+	static TagValue prop_tag(const ClientRec& n) {
+	  if (n.has_request()) {
+	    return T::offset(n.next_request().tag.proportion, n.prop_delta);
+	  } else {
+	    return T::offset(n.get_req_tag().proportion, n.prop_delta);
+	  }
+	}
 
-      mutable std::mutex data_mtx;
-      using DataGuard = std::lock_guard<decltype(data_mtx)>;
+	using key_type = HeapKey;
+
+	static HeapKey key(const ClientRec& n) {
+	  return n.idle ? HeapKey(1, 0) : HeapKey(0, prop_tag(n));
+	}
+
+	bool operator()(const HeapKey& k1, const HeapKey& k2) const {
+	  return k1 < k2;
+	}
+
+	bool operator()(const ClientRec& n1, const ClientRec& n2) const {
+	  if (n1.idle || n2.idle) {
+	    // active before idle; keep stable w false if both idle
+	    return !n1.idle;
+	  }
+	  return prop_tag(n1) < prop_tag(n2);
+	}
+      };
+
+      ClientInfoFunc        client_info_f;
+      static constexpr bool is_dynamic_cli_info_f = U1;
+
+      mutable std::mutex data_mtx;
+      using DataGuard = std::lock_guard<decltype(data_mtx)>;
+
+      // the derived queues' optional call timers; see their
+      // enable_profiling
+      using ProfileTimer = c::ProfileHistogram<std::chrono::nanoseconds>;
+      using ProfileRef = std::unique_ptr<ProfileTimer>;
+
+      static ProfileTimer::clock::time_point
+      profile_start(const ProfileRef& timer) {
+	return timer ? timer->start() : ProfileTimer::clock::time_point();
+      }
+
+      static void profile_stop(const ProfileRef& timer,
+			       ProfileTimer::clock::time_point start) {
+	if (timer) {
+	  timer->stop(start);
+	}
+      }
+
+      // ClientRecs and their request queues are allocated from here
+      // (see PooledAllocation); declared ahead of everything that
+      // holds a ClientRecRef so it is destroyed after them
+      typename A::arena_type client_pool;
+
+      // The clients holding requests with a given key, and how many
+      // each holds. Keys are usually held by a single client (e.g., an
+      // op id), so the first is kept inline.
+      class KeyedClients {
+	using Entry = std::pair<ClientRec*,size_t>;
+
+	Entry              first { nullptr, 0 };
+	std::vector<Entry> others;
+
+      public:
+
+	void add(ClientRec* client) {
+	  if (first.first == client || nullptr == first.first) {
+	    first.first = client;
+	    ++first.second;
+	    return;
+	  }
+	  for (auto& e : others) {
+	    if (e.first == client) {
+	      ++e.second;
+	      return;
+	    }
+	  }
+	  others.emplace_back(client, 1);
+	}
+
+	// removes count of the client's requests; returns true if no
+	// requests remain for any client
+	bool remove(ClientRec* client, size_t count) {
+	  Entry* e = &first;
+	  if (first.first != client) {
+	    e = &*std::find_if(others.begin(), others.end(),
+			       [client] (const Entry& o) -> bool {
+				 return o.first == client;
+			       });
+	  }
+	  assert(e->first == client && e->second >= count);
+	  e->second -= count;
+	  if (0 == e->second) {
+	    if (e == &first) {
+	      if (others.empty()) {
+		return true;
+	      }
+	      first = others.back();
+	    } else {
+	      *e = others.back();
+	    }
+	    others.pop_back();
+	  }
+	  return false;
+	}
+
+	template<typename F>
+	void for_each(F&& f) const {
+	  if (nullptr != first.first) {
+	    f(first.first, first.second);
+	  }
+	  for (const auto& e : others) {
+	    f(e.first, e.second);
+	  }
+	}
+      }; // class KeyedClients
+
+      // A list of client records linked through the records
+      // themselves, so moving a client within or between lists
+      // allocates nothing.
+      class ClientList {
+	ClientRec* head = nullptr;
+	ClientRec* tail = nullptr;
+
+      public:
+
+	bool empty() const { return nullptr == head; }
+
+	ClientRec& front() { return *head; }
+
+	void push_front(ClientRec& client) {
+	  client.list_prev = nullptr;
+	  client.list_next = head;
+	  if (head) {
+	    head->list_prev = &client;
+	  } else {
+	    tail = &client;
+	  }
+	  head = &client;
+	}
+
+	void push_back(ClientRec& client) {
+	  client.list_prev = tail;
+	  client.list_next = nullptr;
+	  if (tail) {
+	    tail->list_next = &client;
+	  } else {
+	    head = &client;
+	  }
+	  tail = &client;
+	}
+
+	void remove(ClientRec& client) {
+	  if (client.list_prev) {
+	    client.list_prev->list_next = client.list_next;
+	  } else {
+	    head = client.list_next;
+	  }
+	  if (client.list_next) {
+	    client.list_next->list_prev = client.list_prev;
+	  } else {
+	    tail = client.list_prev;
+	  }
+	  client.list_prev = nullptr;
+	  client.list_next = nullptr;
+	}
+
+	// inserts the client after the last one whose last_tick is no
+	// later than its own, so a list in last_tick order stays so; it
+	// searches back from the tail, which holds the most recently
+	// used clients
+	void insert_by_tick(ClientRec& client) {
+	  ClientRec* prev = tail;
+	  while (prev && prev->last_tick > client.last_tick) {
+	    prev = prev->list_prev;
+	  }
+	  if (!prev) {
+	    push_front(client);
+	  } else if (prev == tail) {
+	    push_back(client);
+	  } else {
+	    client.list_prev = prev;
+	    client.list_next = prev->list_next;
+	    prev->list_next->list_prev = &client;
+	    prev->list_next = &client;
+	  }
+	}
+
+	void move_to_back(ClientRec& client) {
+	  if (&client != tail) {
+	    remove(client);
+	    push_back(client);
+	  }
+	}
+      }; // class ClientList
 
       // stable mapping between client ids and client queues
-      std::map<C,ClientRecRef> client_map;
-
-      c::IndIntruHeap<ClientRecRef,
-		      ClientRec,
-		      &ClientRec::reserv_heap_data,
-		      ClientCompare<&RequestTag::reservation,
-				    ReadyOption::ignore,
-				    false>,
-		      B> resv_heap;
-#if USE_PROP_HEAP
-      c::IndIntruHeap<ClientRecRef,
-		      ClientRec,
-		      &ClientRec::prop_heap_data,
-		      ClientCompare<&RequestTag::proportion,
-				    ReadyOption::ignore,
-				    true>,
-		      B> prop_heap;
-#endif
-      c::IndIntruHeap<ClientRecRef,
-		      ClientRec,
-		      &ClientRec::lim_heap_data,
-		      ClientCompare<&RequestTag::limit,
-				    ReadyOption::lowers,
-				    false>,
-		      B> limit_heap;
-      c::IndIntruHeap<ClientRecRef,
-		      ClientRec,
-		      &ClientRec::ready_heap_data,
-		      ClientCompare<&RequestTag::proportion,
-				    ReadyOption::raises,
-				    true>,
-		      B> ready_heap;
+      typename M::template map_type<C,ClientRecRef> client_map;
+
+      // every client is on one of these lists, according to its idle
+      // flag; each is kept in order of last_tick, so cleaning only
+      // visits the clients due to be idled or erased
+      ClientList active_clients;
+      ClientList idle_clients;
+
+      typename H::template heap_type<ClientRecRef,
+				     ClientRec,
+				     &ClientRec::reserv_heap_data,
+				     ClientCompare<&RequestTag::reservation,
+						   ReadyOption::ignore,
+						   false>,
+				     B> resv_heap;
+      typename H::template heap_type<ClientRecRef,
+				     ClientRec,
+				     &ClientRec::prop_heap_data,
+				     ActivePropCompare,
+				     B> prop_heap;
+      typename H::template heap_type<ClientRecRef,
+				     ClientRec,
+				     &ClientRec::lim_heap_data,
+				     ClientCompare<&RequestTag::limit,
+						   ReadyOption::lowers,
+						   false>,
+				     B> limit_heap;
+      typename H::template heap_type<ClientRecRef,
+				     ClientRec,
+				     &ClientRec::ready_heap_data,
+				     ClientCompare<&RequestTag::proportion,
+						   ReadyOption::raises,
+						   true>,
+				     B> ready_heap;
+
+      // maps the keys of queued requests to the clients holding them
+      c::OpenHashMap<RequestKey,KeyedClients> request_index;
+
+      // null unless enable_submission_ring was called
+      std::unique_ptr<c::MpscRing<StagedReq>> submission_ring;
+
+      // set by enable_client_metrics
+      bool             client_metrics_on = false;
+
+      // null unless enable_trace was called
+      std::unique_ptr<TraceRing> trace_ring;
 
       // if all reservations are met and all other requestes are under
       // limit, this will allow the request next in terms of
@@ -767,9 +1941,19 @@ namespace crimson {
       Duration                  check_time;
       std::deque<MarkPoint>     clean_mark_points;
 
-      // NB: All threads declared at end, so they're destructed first!
+      // most clients erased or idled while holding data_mtx
+      static constexpr size_t   clean_batch_size = 1024;
 
-      std::unique_ptr<RunEvery> cleaning_job;
+      // where a cleaning pass that had more than one batch to do got
+      // to; zero when no pass is under way
+      Counter                   clean_erase_point = 0;
+      Counter                   clean_idle_point = 0;
+
+      // cleaning runs on the process-wide timer wheel rather than a
+      // thread of our own; each callback cleans at most one batch, so
+      // that a large pass does not hold up the wheel's other timers
+      c::TimerWheel&            timer_wheel;
+      c::TimerWheel::TimerId    cleaning_job;
 
 
       // COMMON constructor that others feed into; we can accept three
@@ -787,19 +1971,24 @@ namespace crimson {
 	finishing(false),
 	idle_age(std::chrono::duration_cast<Duration>(_idle_age)),
 	erase_age(std::chrono::duration_cast<Duration>(_erase_age)),
-	check_time(std::chrono::duration_cast<Duration>(_check_time))
+	check_time(std::chrono::duration_cast<Duration>(_check_time)),
+	timer_wheel(c::TimerWheel::shared())
       {
 	assert(_erase_age >= _idle_age);
 	assert(_check_time < _idle_age);
+	// a clock that calibrates on first use (e.g., TscClock) does so
+	// here rather than in the first add or pull, under data_mtx
+	(void) K::now();
 	cleaning_job =
-	  std::unique_ptr<RunEvery>(
-	    new RunEvery(check_time,
-			 std::bind(&PriorityQueueBase::do_clean, this)));
+	  timer_wheel.add_every(check_time,
+				std::bind(&PriorityQueueBase::do_clean, this));
       }
 
 
       ~PriorityQueueBase() {
 	finishing = true;
+	// waits for a cleaning pass in progress
+	timer_wheel.remove(cleaning_job);
       }
 
 
@@ -810,10 +1999,43 @@ namespace crimson {
 	return client.info;
       }
 
+      static Time save_tag(const TagValue tag) {
+	if (max_tag == tag) {
+	  return TimeMax;
+	} else if (min_tag == tag) {
+	  return -TimeMax;
+	} else {
+	  return T::to_time(tag);
+	}
+      }
+
+      static TagValue restore_tag(const Time time, const Time shift) {
+	if (TimeMax == time) {
+	  return max_tag;
+	} else if (-TimeMax == time) {
+	  return min_tag;
+	} else {
+	  return T::from_time(time + shift);
+	}
+      }
+
+      // data_mtx must be held by caller; the list the client is on
+      ClientList& list_of(const ClientRec& client) {
+	return client.idle ? idle_clients : active_clients;
+      }
+
+      // data_mtx must be held by caller; notes the tag as the
+      // client's previous one, which also makes it the most recently
+      // used client
+      void update_req_tag(ClientRec& client, const RequestTag& tag) {
+	client.update_req_tag(tag, tick);
+	list_of(client).move_to_back(client);
+      }
+
       // data_mtx must be held by caller
       RequestTag initial_tag(DelayedTagCalc delayed, ClientRec& client,
 			     const ReqParams& params, Time time, Cost cost) {
-	RequestTag tag(0, 0, 0, time, cost);
+	RequestTag tag(0, 0, 0, time, cost, params.bytes);
 
 	// only calculate a tag if the request is going straight to the front
 	if (!client.has_request()) {
@@ -823,7 +2045,7 @@ namespace crimson {
 			   params, time, cost, anticipation_timeout);
 
 	  // copy tag to previous tag for client
-	  client.update_req_tag(tag, tick);
+	  update_req_tag(client, tag);
 	}
 	return tag;
       }
@@ -838,7 +2060,7 @@ namespace crimson {
 		       params, time, cost, anticipation_timeout);
 
 	// copy tag to previous tag for client
-	client.update_req_tag(tag, tick);
+	update_req_tag(client, tag);
 	return tag;
       }
 
@@ -847,108 +2069,330 @@ namespace crimson {
 			  const C& client_id,
 			  const ReqParams& req_params,
 			  const Time time,
-			  const Cost cost = 1u) {
+			  const Cost cost = 1u,
+			  const RequestKey key = no_request_key) {
 	++tick;
 
-	// this pointer will help us create a reference to a shared
-	// pointer, no matter which of two codepaths we take
-	ClientRec* temp_client;
+	ClientRec& client = get_client_rec(client_id);
+	if (client.idle) {
+	  activate_client(client, time);
+	}
+
+	enqueue_request(client, std::move(request), req_params, time, cost, key);
+	adjust_heaps(client);
+      } // add_request
+
+
+      // Tries to stage the request in the submission ring without
+      // taking data_mtx; returns false, leaving request intact, if
+      // there is no ring or it is full.
+      bool stage_request(RequestRef& request,
+			 const C& client_id,
+			 const ReqParams& req_params,
+			 const Time time,
+			 const Cost cost,
+			 const RequestKey key) {
+	if (!submission_ring) {
+	  return false;
+	}
+	StagedReq staged(client_id, std::move(request),
+			 req_params, time, cost, key);
+	if (submission_ring->try_push(staged)) {
+	  return true;
+	}
+	request = std::move(staged.request);
+	return false;
+      }
+
+
+      // data_mtx must be held by caller; adds the staged requests to
+      // the heaps and returns how many there were
+      size_t drain_submission_ring() {
+	if (!submission_ring) {
+	  return 0;
+	}
+	return submission_ring->consume([this] (StagedReq&& r) {
+	    do_add_request(std::move(r.request),
+			   r.client_id,
+			   r.req_params,
+			   r.time,
+			   r.cost,
+			   r.key);
+	  });
+      }
+
+
+      // data_mtx must be held by caller through l. Drains the ring
+      // through every request staged before the call, releasing l
+      // while waiting on a producer still filling its slot, so that
+      // a request the caller then adds directly can't overtake one
+      // its thread staged earlier.
+      template<typename L>
+      void drain_submission_ring_through(L& l) {
+	if (!submission_ring) {
+	  return;
+	}
+	const size_t end = submission_ring->push_position();
+	drain_submission_ring();
+	while (!submission_ring->consumed_to(end)) {
+	  l.unlock();
+	  std::this_thread::yield();
+	  l.lock();
+	  drain_submission_ring();
+	}
+      }
+
+
+      // data_mtx must be held by caller; I must be an iterator whose
+      // value type is AddReq, and the requests will be moved out of
+      // the range. Requests are grouped by client, keeping their
+      // order within each client, so that the heaps are adjusted
+      // once per client rather than once per request. Clients are
+      // taken in the order of their first request in the range, so
+      // idle ones are activated as a series of add_request calls
+      // would activate them.
+      template<typename I>
+      void do_add_requests(I first, I last, const Time time) {
+	struct BatchRec {
+	  size_t     order; // position of the client's first request
+	  ClientRec* client;
+	  I          add;
+	};
+	std::vector<BatchRec> recs;
+	recs.reserve(std::distance(first, last));
+	for (I i = first; i != last; ++i) {
+	  ++tick;
+	  recs.push_back(BatchRec{ recs.size(),
+		&get_client_rec(i->client_id), i });
+	}
+
+	// group by client; being stable, each group then starts with
+	// the client's first request, whose position the whole group
+	// takes before it is sorted into first-request order
+	std::stable_sort(recs.begin(), recs.end(),
+			 [] (const BatchRec& a, const BatchRec& b) -> bool {
+			   return a.client < b.client;
+			 });
+	for (size_t i = 1; i < recs.size(); ++i) {
+	  if (recs[i].client == recs[i - 1].client) {
+	    recs[i].order = recs[i - 1].order;
+	  }
+	}
+	std::stable_sort(recs.begin(), recs.end(),
+			 [] (const BatchRec& a, const BatchRec& b) -> bool {
+			   return a.order < b.order;
+			 });
+
+	for (auto r = recs.begin(); r != recs.end(); /* empty */) {
+	  ClientRec& client = *r->client;
+	  if (client.idle) {
+	    activate_client(client, time);
+	  }
+	  for (; r != recs.end() && r->client == &client; ++r) {
+	    AddReq& add = *r->add;
+	    enqueue_request(client,
+			    std::move(add.request),
+			    add.req_params,
+			    time,
+			    add.cost,
+			    add.key);
+	  }
+	  adjust_heaps(client);
+	}
+      } // do_add_requests
 
+
+      // data_mtx must be held by caller; finds the record for the
+      // client, creating it if necessary
+      ClientRec& get_client_rec(const C& client_id) {
 	auto client_it = client_map.find(client_id);
 	if (client_map.end() != client_it) {
-	  temp_client = &(*client_it->second); // address of obj of shared_ptr
-	} else {
-	  const ClientInfo* info = client_info_f(client_id);
-	  ClientRecRef client_rec =
-	    std::make_shared<ClientRec>(client_id, info, tick);
+	  return *client_it->second;
+	}
+
+	const ClientInfo* info = client_info_f(client_id);
+	ClientRecRef client_rec =
+	  std::allocate_shared<ClientRec>(
+	    typename A::template allocator<ClientRec>(client_pool),
+	    client_id, info, tick, client_pool);
+	if (P::reservation) {
 	  resv_heap.push(client_rec);
-#if USE_PROP_HEAP
-	  prop_heap.push(client_rec);
-#endif
+	}
+	prop_heap.push(client_rec);
+	if (P::limit) {
 	  limit_heap.push(client_rec);
-	  ready_heap.push(client_rec);
-	  client_map[client_id] = client_rec;
-	  temp_client = &(*client_rec); // address of obj of shared_ptr
 	}
+	ready_heap.push(client_rec);
+	idle_clients.push_back(*client_rec);
+	if (client_metrics_on) {
+	  client_rec->metrics.reset(new ClientMetrics);
+	}
+	client_map[client_id] = client_rec;
+	return *client_rec;
+      }
 
-	// for convenience, we'll create a reference to the shared pointer
-	ClientRec& client = *temp_client;
 
-	if (client.idle) {
-	  // We need to do an adjustment so that idle clients compete
-	  // fairly on proportional tags since those tags may have
-	  // drifted from real-time. Either use the lowest existing
-	  // proportion tag -- O(1) -- or the client with the lowest
-	  // previous proportion tag -- O(n) where n = # clients.
-	  //
-	  // So we don't have to maintain a propotional queue that
-	  // keeps the minimum on proportional tag alone (we're
-	  // instead using a ready queue), we'll have to check each
-	  // client.
-	  //
-	  // The alternative would be to maintain a proportional queue
-	  // (define USE_PROP_TAG) and do an O(1) operation here.
-
-	  // Was unable to confirm whether equality testing on
-	  // std::numeric_limits<double>::max() is guaranteed, so
-	  // we'll use a compile-time calculated trigger that is one
-	  // third the max, which should be much larger than any
-	  // expected organic value.
-	  constexpr double lowest_prop_tag_trigger =
-	    std::numeric_limits<double>::max() / 3.0;
-
-	  double lowest_prop_tag = std::numeric_limits<double>::max();
-	  for (auto const &c : client_map) {
-	    // don't use ourselves (or anything else that might be
-	    // listed as idle) since we're now in the map
-	    if (!c.second->idle) {
-	      double p;
-	      // use either lowest proportion tag or previous proportion tag
-	      if (c.second->has_request()) {
-		p = c.second->next_request().tag.proportion +
-		  c.second->prop_delta;
-	      } else {
-	        p = c.second->get_req_tag().proportion + c.second->prop_delta;
-	      }
+      // data_mtx must be held by caller; client must have metrics
+      static void copy_metrics(const ClientRec& client, ClientMetrics& out) {
+	assert(client.metrics->queued == client.requests.size());
+	out = *client.metrics;
+      }
 
-	      if (p < lowest_prop_tag) {
-		lowest_prop_tag = p;
-	      }
-	    }
+
+      // data_mtx must be held by caller; notes a request with the
+      // given tag being dispatched from client at time now
+      void note_dispatch(ClientRec& client,
+			 const RequestTag& tag,
+			 const PhaseType phase,
+			 const Time now) {
+	const bool limit_break =
+	  PhaseType::priority == phase && !within_limit(tag);
+	if (limit_break) {
+	  ++limit_break_sched_count;
+	}
+	if (trace_ring) {
+	  const TraceType type =
+	    PhaseType::reservation == phase ? TraceType::reservation :
+	    limit_break ? TraceType::limit_break :
+	    TraceType::priority;
+	  // the request is about to be popped
+	  trace(type, client, tag, client.requests.size() - 1, now, tag.cost);
+	}
+	if (!client.metrics) {
+	  return;
+	}
+	ClientMetrics& m = *client.metrics;
+	if (PhaseType::reservation == phase) {
+	  ++m.reservation_count;
+	} else {
+	  ++m.priority_count;
+	  if (limit_break) {
+	    ++m.limit_break_count;
 	  }
+	}
+	const Time wait = now - tag.arrival;
+	m.wait_us.add(wait > 0 ? uint64_t(wait * 1000000 + 0.5) : 0);
+      }
 
-	  // if this conditional does not fire, it
+
+      // data_mtx must be held by caller
+      void activate_client(ClientRec& client, const Time time) {
+	// We need to do an adjustment so that idle clients compete
+	// fairly on proportional tags since those tags may have
+	// drifted from real-time. Use the lowest proportion tag
+	// among the active clients, which the prop_heap keeps on top
+	// -- O(1) -- followed by an O(log n) adjustment of the heap
+	// now that this client is active.
+
+	// Was unable to confirm whether equality testing on
+	// std::numeric_limits<double>::max() is guaranteed, so
+	// we'll use a compile-time calculated trigger that is one
+	// third the max, which should be much larger than any
+	// expected organic value.
+	constexpr TagValue lowest_prop_tag_trigger =
+	  std::numeric_limits<TagValue>::max() / 3;
+
+	// the client is still idle here, so it cannot be the top
+	// unless no client is active
+	const ClientRec& lowest = prop_heap.top();
+	if (!lowest.idle) {
+	  TagValue lowest_prop_tag = ActivePropCompare::prop_tag(lowest);
 	  if (lowest_prop_tag < lowest_prop_tag_trigger) {
-	    client.prop_delta = lowest_prop_tag - time;
+	    client.prop_delta = lowest_prop_tag - T::from_time(time);
 	  }
-	  client.idle = false;
-	} // if this client was idle
-
+	}
+	idle_clients.remove(client);
+	client.idle = false;
+	// activity, even if the client has queued requests whose tags
+	// aren't yet calculated
+	client.last_tick = tick;
+	active_clients.push_back(client);
+	prop_heap.promote(client);
+      } // activate_client
+
+
+      // data_mtx must be held by caller; the caller is responsible
+      // for adjusting the heaps afterwards
+      void enqueue_request(ClientRec& client,
+			   RequestRef&& request,
+			   const ReqParams& req_params,
+			   const Time time,
+			   const Cost cost,
+			   const RequestKey key) {
 	RequestTag tag = initial_tag(TagCalc{}, client, req_params, time, cost);
 
-	client.add_request(tag, client.client, std::move(request));
-	if (1 == client.requests.size()) {
-	  // NB: can the following 4 calls to adjust be changed
-	  // promote? Can adding a request ever demote a client in the
-	  // heaps?
-	  resv_heap.adjust(client);
-	  limit_heap.adjust(client);
-	  ready_heap.adjust(client);
-#if USE_PROP_HEAP
-	  prop_heap.adjust(client);
-#endif
+	client.add_request(tag, client.client, std::move(request), key);
+	if (no_request_key != key) {
+	  request_index[key].add(&client);
 	}
 
 	client.cur_rho = req_params.rho;
 	client.cur_delta = req_params.delta;
 
-	resv_heap.adjust(client);
-	limit_heap.adjust(client);
+	if (trace_ring) {
+	  // the client is ordered by its first request's tag
+	  trace(TraceType::add, client, client.next_request().tag,
+		client.requests.size(), time, cost);
+	}
+      }
+
+
+      // data_mtx must be held by caller; trace_ring must exist
+      void trace(TraceType type,
+		 const ClientRec& client,
+		 const RequestTag& tag,
+		 size_t depth,
+		 Time now,
+		 Cost cost) {
+	TraceEvent& e = trace_ring->next();
+	e.type = type;
+	e.flags = tag.ready ? TraceEvent::flag_ready : 0;
+	e.unused = 0;
+	e.client_depth = uint32_t(depth);
+	e.cost = cost;
+	e.client_count = uint32_t(client_map.size());
+	e.client = TraceClientId<C>::get(client.client);
+	e.now = now;
+	e.arrival = tag.arrival;
+	e.reservation = T::to_time(tag.reservation);
+	e.proportion = T::to_time(tag.proportion);
+	e.limit = T::to_time(tag.limit);
+      }
+
+
+      // data_mtx must be held by caller; called when a request with
+      // a key leaves the client's queue other than via remove_by_key
+      void unindex_request(ClientRec& client, const RequestKey key) {
+	auto k = request_index.find(key);
+	assert(request_index.end() != k);
+	if (k->second.remove(&client, 1)) {
+	  request_index.erase(k);
+	}
+      }
+
+
+      // data_mtx must be held by caller; unindexes all of the
+      // client's queued requests
+      void unindex_requests(ClientRec& client) {
+	for (const auto& r : client.requests) {
+	  if (no_request_key != r.key) {
+	    unindex_request(client, r.key);
+	  }
+	}
+      }
+
+
+      // data_mtx must be held by caller
+      void adjust_heaps(ClientRec& client) {
+	if (P::reservation) {
+	  resv_heap.adjust(client);
+	}
+	if (P::limit) {
+	  limit_heap.adjust(client);
+	}
 	ready_heap.adjust(client);
-#if USE_PROP_HEAP
 	prop_heap.adjust(client);
-#endif
-      } // add_request
+      }
 
       // data_mtx must be held by caller
       void update_next_tag(DelayedTagCalc delayed, ClientRec& top,
@@ -962,9 +2406,10 @@ namespace crimson {
 				      top.cur_delta, top.cur_rho,
 				      next_first.tag.arrival,
 				      next_first.tag.cost,
-				      anticipation_timeout);
+				      anticipation_timeout,
+				      next_first.tag.bytes);
 	  // copy tag to previous tag for client
-	  top.update_req_tag(next_first.tag, tick);
+	  update_req_tag(top, next_first.tag);
 	}
       }
 
@@ -975,8 +2420,10 @@ namespace crimson {
 
       // data_mtx should be held when called; top of heap should have
       // a ready request
-      template<typename C1, IndIntruHeapData ClientRec::*C2, typename C3>
-      void pop_process_request(IndIntruHeap<C1, ClientRec, C2, C3, B>& heap,
+      template<typename HeapT>
+      void pop_process_request(HeapT& heap,
+			       const PhaseType phase,
+			       const Time now,
 			       std::function<void(const C& client,
 						  const Cost cost,
 						  RequestRef& request)> process) {
@@ -987,16 +2434,36 @@ namespace crimson {
 	RequestRef request = std::move(top.next_request().request);
 	RequestTag tag = top.next_request().tag;
 
+	if (no_request_key != top.next_request().key) {
+	  unindex_request(top, top.next_request().key);
+	}
+
+	note_dispatch(top, tag, phase, now);
+
 	// pop request and adjust heaps
 	top.pop_request();
 
 	update_next_tag(TagCalc{}, top, tag);
 
-	resv_heap.demote(top);
-	limit_heap.adjust(top);
-#if USE_PROP_HEAP
-	prop_heap.demote(top);
-#endif
+	// a request dispatched by weight still counts toward the
+	// client's reservation, so move its reservation tags back by
+	// what the request was charged
+	const bool reduce = P::reservation && PhaseType::priority == phase;
+	if (reduce) {
+	  reduce_reservation_tags(top, tag);
+	}
+
+	if (P::reservation) {
+	  if (reduce) {
+	    resv_heap.adjust(top);
+	  } else {
+	    resv_heap.demote(top);
+	  }
+	}
+	if (P::limit) {
+	  limit_heap.adjust(top);
+	}
+	prop_heap.adjust(top);
 	ready_heap.demote(top);
 
 	// process
@@ -1005,51 +2472,60 @@ namespace crimson {
 
 
       // data_mtx must be held by caller
-      void reduce_reservation_tags(DelayedTagCalc delayed, ClientRec& client) {
+      void reduce_reservation_tags(DelayedTagCalc delayed, ClientRec& client,
+				   const TagValue credit) {
 	if (!client.requests.empty()) {
 	  // only maintain a tag for the first request
 	  auto& r = client.requests.front();
-	  r.tag.reservation -= client.info->reservation_inv;
+	  r.tag.reservation = T::offset(r.tag.reservation, -credit);
 	}
       }
 
-      // data_mtx should be held when called
-      void reduce_reservation_tags(ImmediateTagCalc imm, ClientRec& client) {
+      // data_mtx should be held when called; as in the tag
+      // constructor, tags pinned at max_tag (e.g., from before the
+      // client had a reservation) stay pinned
+      void reduce_reservation_tags(ImmediateTagCalc imm, ClientRec& client,
+				   const TagValue credit) {
 	for (auto& r : client.requests) {
-	  r.tag.reservation -= client.info->reservation_inv;
+	  r.tag.reservation = T::offset(r.tag.reservation, -credit);
 	}
       }
 
-      // data_mtx should be held when called
-      void reduce_reservation_tags(const C& client_id) {
-	auto client_it = client_map.find(client_id);
-
-	// means the client was cleaned from map; should never happen
-	// as long as cleaning times are long enough
-	assert(client_map.end() != client_it);
-	ClientRec& client = *client_it->second;
-	reduce_reservation_tags(TagCalc{}, client);
+      // data_mtx should be held when called; as in the tag
+      // constructor, tags pinned at max_tag (e.g., from before the
+      // client had a reservation) stay pinned; served is the tag of
+      // the request the client just had dispatched by weight
+      void reduce_reservation_tags(ClientRec& client,
+				   const RequestTag& served) {
+	const TagValue credit =
+	  std::max(T::reservation_inc(*client.info),
+		   T::bytes_inc(client.info->reservation_bytes_inv,
+				served.bytes));
+	reduce_reservation_tags(TagCalc{}, client, credit);
 
 	// don't forget to update previous tag
-	client.prev_tag.reservation -= client.info->reservation_inv;
-	resv_heap.promote(client);
+	client.prev_tag.reservation -= credit;
       }
 
 
       // data_mtx should be held when called
       NextReq do_next_request(Time now) {
-	// if reservation queue is empty, all are empty (i.e., no
-	// active clients)
-	if(resv_heap.empty()) {
+	// if ready queue is empty, all are empty (i.e., no active
+	// clients)
+	if(ready_heap.empty()) {
 	  return NextReq::none();
 	}
 
+	const TagValue now_tag = T::from_time(now);
+
 	// try constraint (reservation) based scheduling
 
-	auto& reserv = resv_heap.top();
-	if (reserv.has_request() &&
-	    reserv.next_request().tag.reservation <= now) {
-	  return NextReq(HeapId::reservation);
+	if (P::reservation) {
+	  auto& reserv = resv_heap.top();
+	  if (reserv.has_request() &&
+	      reserv.next_request().tag.reservation <= now_tag) {
+	    return NextReq(HeapId::reservation);
+	  }
 	}
 
 	// no existing reservations before now, so try weight-based
@@ -1057,20 +2533,22 @@ namespace crimson {
 
 	// all items that are within limit are eligible based on
 	// priority
-	auto limits = &limit_heap.top();
-	while (limits->has_request() &&
-	       !limits->next_request().tag.ready &&
-	       limits->next_request().tag.limit <= now) {
-	  limits->next_request().tag.ready = true;
-	  ready_heap.promote(*limits);
-	  limit_heap.demote(*limits);
-
-	  limits = &limit_heap.top();
+	if (P::limit) {
+	  auto limits = &limit_heap.top();
+	  while (limits->has_request() &&
+		 !limits->next_request().tag.ready &&
+		 limits->next_request().tag.limit <= now_tag) {
+	    limits->next_request().tag.ready = true;
+	    ready_heap.promote(*limits);
+	    limit_heap.demote(*limits);
+
+	    limits = &limit_heap.top();
+	  }
 	}
 
 	auto& readys = ready_heap.top();
 	if (readys.has_request() &&
-	    readys.next_request().tag.ready &&
+	    within_limit(readys.next_request().tag) &&
 	    readys.next_request().tag.proportion < max_tag) {
 	  return NextReq(HeapId::ready);
 	}
@@ -1083,8 +2561,9 @@ namespace crimson {
 	  if (readys.has_request() &&
 	      readys.next_request().tag.proportion < max_tag) {
 	    return NextReq(HeapId::ready);
-	  } else if (reserv.has_request() &&
-		     reserv.next_request().tag.reservation < max_tag) {
+	  } else if (P::reservation &&
+		     resv_heap.top().has_request() &&
+		     resv_heap.top().next_request().tag.reservation < max_tag) {
 	    return NextReq(HeapId::reservation);
 	  }
 	}
@@ -1093,15 +2572,16 @@ namespace crimson {
 	// reservation item or next limited item comes up
 
 	Time next_call = TimeMax;
-	if (resv_heap.top().has_request()) {
+	if (P::reservation && resv_heap.top().has_request()) {
 	  next_call =
 	    min_not_0_time(next_call,
-			   resv_heap.top().next_request().tag.reservation);
+			   T::to_time(
+			     resv_heap.top().next_request().tag.reservation));
 	}
-	if (limit_heap.top().has_request()) {
+	if (P::limit && limit_heap.top().has_request()) {
 	  const auto& next = limit_heap.top().next_request();
 	  assert(!next.tag.ready || max_tag == next.tag.proportion);
-	  next_call = min_not_0_time(next_call, next.tag.limit);
+	  next_call = min_not_0_time(next_call, T::to_time(next.tag.limit));
 	}
 	if (next_call < TimeMax) {
 	  return NextReq(next_call);
@@ -1111,6 +2591,58 @@ namespace crimson {
       } // do_next_request
 
 
+      // data_mtx should be held when called; ranks the request that
+      // do_next_request would return -- reservation requests that are
+      // due first, then requests within limit, then limit breaks by
+      // weight, then limit breaks by reservation. The two kinds of
+      // limit break rank separately, as do_next_request prefers them,
+      // since their keys (proportion and reservation tags) are not
+      // comparable.
+      PeekReq do_peek_request(Time now) {
+	PeekReq result;
+	NextReq next = do_next_request(now);
+	result.type = next.type;
+	switch(next.type) {
+	case NextReqType::none:
+	  break;
+	case NextReqType::future:
+	  result.when_ready = next.when_ready;
+	  break;
+	case NextReqType::returning:
+	  if (HeapId::reservation == next.heap_id) {
+	    const auto& tag = resv_heap.top().next_request().tag;
+	    result.key = tag.reservation;
+	    result.rank = tag.reservation <= T::from_time(now) ? 0 : 3;
+	  } else {
+	    const ClientRec& top = ready_heap.top();
+	    const auto& tag = top.next_request().tag;
+	    result.key = T::offset(tag.proportion, top.prop_delta);
+	    result.rank = within_limit(tag) ? 1 : 2;
+	  }
+	  break;
+	default:
+	  assert(false);
+	}
+	return result;
+      } // do_peek_request
+
+
+      // whether the request may be scheduled by weight without
+      // breaking its client's limit
+      static bool within_limit(const RequestTag& tag) {
+	return !P::limit || tag.ready;
+      }
+
+
+      // data_mtx should be held when called; top of the identified
+      // heap should have a request
+      Cost top_request_cost(HeapId heap_id) const {
+	const ClientRec& top = HeapId::reservation == heap_id ?
+	  resv_heap.top() : ready_heap.top();
+	return top.next_request().tag.cost;
+      }
+
+
       // if possible is not zero and less than current then return it;
       // otherwise return current; the idea is we're trying to find
       // the minimal time but ignoring zero
@@ -1121,78 +2653,143 @@ namespace crimson {
 
 
       /*
-       * This is being called regularly by RunEvery. Every time it's
-       * called it notes the time and delta counter (mark point) in a
-       * deque. It also looks at the deque to find the most recent
+       * This is being called regularly by the timer wheel. Every
+       * time it's called it notes the time and delta counter (mark
+       * point) in a deque. It also looks at the deque to find the most recent
        * mark point that is older than clean_age. It then walks the
        * map and delete all server entries that were last used before
        * that mark point.
+       *
+       * It cleans one batch per call; if more remain, it re-arms its
+       * timer for the wheel's next tick and resumes from where it
+       * stopped, rather than noting a new mark point.
        */
       void do_clean() {
-	TimePoint now = std::chrono::steady_clock::now();
+	if (finishing) {
+	  return;
+	}
+
 	DataGuard g(data_mtx);
-	clean_mark_points.emplace_back(MarkPoint(now, tick));
+	if (0 == clean_erase_point && 0 == clean_idle_point) {
+	  TimePoint now = std::chrono::steady_clock::now();
+	  clean_mark_points.emplace_back(MarkPoint(now, tick));
+
+	  // first find the point before which client records are
+	  // super-old and get erased
+
+	  auto point = clean_mark_points.front();
+	  while (point.first <= now - erase_age) {
+	    clean_erase_point = point.second;
+	    clean_mark_points.pop_front();
+	    point = clean_mark_points.front();
+	  }
 
-	// first erase the super-old client records
+	  for (auto i : clean_mark_points) {
+	    if (i.first <= now - idle_age) {
+	      clean_idle_point = i.second;
+	    } else {
+	      break;
+	    }
+	  }
 
-	Counter erase_point = 0;
-	auto point = clean_mark_points.front();
-	while (point.first <= now - erase_age) {
-	  erase_point = point.second;
-	  clean_mark_points.pop_front();
-	  point = clean_mark_points.front();
+	  if (0 == clean_erase_point && 0 == clean_idle_point) {
+	    return;
+	  }
 	}
 
-	Counter idle_point = 0;
-	for (auto i : clean_mark_points) {
-	  if (i.first <= now - idle_age) {
-	    idle_point = i.second;
-	  } else {
-	    break;
+	if (clean_batch(clean_erase_point, clean_idle_point)) {
+	  // the periodic arming resumes once a pass is done
+	  timer_wheel.arm(cleaning_job, c::TimerWheel::Clock::now());
+	} else {
+	  clean_erase_point = 0;
+	  clean_idle_point = 0;
+	}
+      } // do_clean
+
+
+      // data_mtx must be held by caller; erases and idles up to
+      // clean_batch_size clients, oldest first, and returns true if
+      // there are more to do
+      bool clean_batch(const Counter erase_point, const Counter idle_point) {
+	size_t budget = clean_batch_size;
+
+	if (erase_point) {
+	  for (ClientList* list : { &idle_clients, &active_clients }) {
+	    while (!list->empty() && list->front().last_tick <= erase_point) {
+	      if (0 == budget--) {
+		return true;
+	      }
+	      erase_client(list->front());
+	    }
 	  }
 	}
 
-	if (erase_point > 0 || idle_point > 0) {
-	  for (auto i = client_map.begin(); i != client_map.end(); /* empty */) {
-	    auto i2 = i++;
-	    if (erase_point && i2->second->last_tick <= erase_point) {
-	      delete_from_heaps(i2->second);
-	      client_map.erase(i2);
-	    } else if (idle_point && i2->second->last_tick <= idle_point) {
-	      i2->second->idle = true;
+	if (idle_point) {
+	  while (!active_clients.empty() &&
+		 active_clients.front().last_tick <= idle_point) {
+	    if (0 == budget--) {
+	      return true;
 	    }
-	  } // for
-	} // if
-      } // do_clean
+	    ClientRec& client = active_clients.front();
+	    active_clients.remove(client);
+	    client.idle = true;
+	    // idle clients whose tags were updated since they were idled
+	    // (by a request of theirs being dispatched) are newer
+	    idle_clients.insert_by_tick(client);
+	    prop_heap.demote(client);
+	  }
+	}
+
+	return false;
+      } // clean_batch
 
 
       // data_mtx must be held by caller
-      template<IndIntruHeapData ClientRec::*C1,typename C2>
-      void delete_from_heap(ClientRecRef& client,
-			    c::IndIntruHeap<ClientRecRef,ClientRec,C1,C2,B>& heap) {
-	auto i = heap.rfind(client);
-	heap.remove(i);
+      void erase_client(ClientRec& client) {
+	const C client_id = client.client;
+	unindex_requests(client);
+	list_of(client).remove(client);
+	delete_from_heaps(client);
+	// the map holds the last reference
+	client_map.erase(client_id);
       }
 
 
       // data_mtx must be held by caller
-      void delete_from_heaps(ClientRecRef& client) {
-	delete_from_heap(client, resv_heap);
-#if USE_PROP_HEAP
-	delete_from_heap(client, prop_heap);
-#endif
-	delete_from_heap(client, limit_heap);
-	delete_from_heap(client, ready_heap);
+      void delete_from_heaps(ClientRec& client) {
+	if (P::reservation) {
+	  resv_heap.remove(client);
+	}
+	prop_heap.remove(client);
+	if (P::limit) {
+	  limit_heap.remove(client);
+	}
+	ready_heap.remove(client);
       }
     }; // class PriorityQueueBase
 
+    template<typename C, typename R, bool IsDelayed, bool U1, uint B, typename M,
+	     typename T, typename K, typename H, typename P, typename A>
+    constexpr typename PriorityQueueBase<C,R,IsDelayed,U1,B,M,T,K,H,P,A>::TagValue
+    PriorityQueueBase<C,R,IsDelayed,U1,B,M,T,K,H,P,A>::max_tag;
+
+    template<typename C, typename R, bool IsDelayed, bool U1, uint B, typename M,
+	     typename T, typename K, typename H, typename P, typename A>
+    constexpr typename PriorityQueueBase<C,R,IsDelayed,U1,B,M,T,K,H,P,A>::TagValue
+    PriorityQueueBase<C,R,IsDelayed,U1,B,M,T,K,H,P,A>::min_tag;
 
-    template<typename C, typename R, bool IsDelayed=true, bool U1=false, uint B=2>
-    class PullPriorityQueue : public PriorityQueueBase<C,R,IsDelayed,U1,B> {
-      using super = PriorityQueueBase<C,R,IsDelayed,U1,B>;
+
+    template<typename C, typename R, bool IsDelayed=true, bool U1=false, uint B=2,
+	     typename M=HashClientMap, typename T=DoubleTags,
+	     typename K=RealtimeClock, typename H=IndirectHeap,
+	     typename P=AllPhases, typename A=PooledAllocation>
+    class PullPriorityQueue : public PriorityQueueBase<C,R,IsDelayed,U1,B,M,T,K,H,P,A> {
+      using super = PriorityQueueBase<C,R,IsDelayed,U1,B,M,T,K,H,P,A>;
 
     public:
 
+      using RequestKey = typename super::RequestKey;
+
       // When a request is pulled, this is the return type.
       struct PullReq {
 	struct Retn {
@@ -1217,11 +2814,40 @@ namespace crimson {
       };
 
 
-#ifdef PROFILE
-      ProfileTimer<std::chrono::nanoseconds> pull_request_timer;
-      ProfileTimer<std::chrono::nanoseconds> add_request_timer;
+      // null until enable_profiling is called
+      typename super::ProfileRef pull_request_timer;
+      typename super::ProfileRef add_request_timer;
+
+
+      // Starts timing each add and pull in percentile histograms
+      // (see ProfileHistogram), at the cost of two clock reads and a
+      // few relaxed atomic adds per call. Until then each call only
+      // tests for a null timer. Must be called before the queue is
+      // shared between threads.
+      void enable_profiling() {
+	pull_request_timer.reset(new typename super::ProfileTimer);
+	add_request_timer.reset(new typename super::ProfileTimer);
+      }
+
+    protected:
+
+      // threads blocked in pull_request_wait wait on pull_cv with
+      // data_mtx; waiters is also read without data_mtx by
+      // add_request, to learn whether anyone needs waking
+      std::condition_variable pull_cv;
+      std::atomic<size_t>     waiters;
+
+#ifdef __linux__
+      // -1 unless enable_ready_fds was called; ready_armed is set
+      // once a pull finds nothing eligible, and the next add clears
+      // it and writes ready_efd
+      int                     ready_efd;
+      int                     ready_tfd;
+      std::atomic<bool>       ready_armed;
 #endif
 
+    public:
+
       template<typename Rep, typename Per>
       PullPriorityQueue(typename super::ClientInfoFunc _client_info_f,
 			std::chrono::duration<Rep,Per> _idle_age,
@@ -1231,35 +2857,90 @@ namespace crimson {
 			double _anticipation_timeout = 0.0) :
 	super(_client_info_f,
 	      _idle_age, _erase_age, _check_time,
-	      _allow_limit_break, _anticipation_timeout)
+	      _allow_limit_break, _anticipation_timeout),
+	waiters(0)
+#ifdef __linux__
+	,
+	ready_efd(-1),
+	ready_tfd(-1),
+	ready_armed(false)
+#endif
       {
 	// empty
       }
 
 
-      // pull convenience constructor
-      PullPriorityQueue(typename super::ClientInfoFunc _client_info_f,
-			bool _allow_limit_break = false,
-			double _anticipation_timeout = 0.0) :
-	PullPriorityQueue(_client_info_f,
-			  std::chrono::minutes(10),
-			  std::chrono::minutes(15),
-			  std::chrono::minutes(6),
-			  _allow_limit_break,
-			  _anticipation_timeout)
-      {
-	// empty
-      }
+      ~PullPriorityQueue() {
+#ifdef __linux__
+	if (ready_efd >= 0) {
+	  ::close(ready_efd);
+	  ::close(ready_tfd);
+	}
+#endif
+      }
+
+
+#ifdef __linux__
+      // For servers built around an event loop. Creates an eventfd,
+      // which becomes readable when requests are added, and a
+      // timerfd, which becomes readable when a limit or reservation
+      // lets a queued request through (measured by the queue's
+      // clock, so it is only useful with a real-time clock). Once
+      // either is readable, call pull_request (or pull_requests)
+      // until it returns none or future; the queue clears both
+      // itself, so they need not be read. Returns false, with errno
+      // set, if the descriptors cannot be created.
+      bool enable_ready_fds() {
+	typename super::DataGuard g(this->data_mtx);
+	assert(ready_efd < 0);
+	ready_efd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ready_efd < 0) {
+	  return false;
+	}
+	ready_tfd = ::timerfd_create(CLOCK_MONOTONIC,
+				     TFD_NONBLOCK | TFD_CLOEXEC);
+	if (ready_tfd < 0) {
+	  ::close(ready_efd);
+	  ready_efd = -1;
+	  return false;
+	}
+	// start readable, so the first pull picks up anything queued
+	// already
+	const uint64_t one = 1;
+	ssize_t r = ::write(ready_efd, &one, sizeof(one));
+	(void) r;
+	return true;
+      }
+
+
+      int ready_fd() const { return ready_efd; }
+      int timer_fd() const { return ready_tfd; }
+#endif
+
+
+      // pull convenience constructor
+      PullPriorityQueue(typename super::ClientInfoFunc _client_info_f,
+			bool _allow_limit_break = false,
+			double _anticipation_timeout = 0.0) :
+	PullPriorityQueue(_client_info_f,
+			  std::chrono::minutes(10),
+			  std::chrono::minutes(15),
+			  std::chrono::minutes(6),
+			  _allow_limit_break,
+			  _anticipation_timeout)
+      {
+	// empty
+      }
 
 
       inline void add_request(R&& request,
 			      const C& client_id,
 			      const ReqParams& req_params,
 			      const Cost cost = 1u) {
-	add_request(typename super::RequestRef(new R(std::move(request))),
+	add_request(super::make_request_ref(std::move(request)),
 		    client_id,
 		    req_params,
-		    get_time(),
+		    super::current_time(),
 		    cost);
       }
 
@@ -1268,10 +2949,10 @@ namespace crimson {
 			      const C& client_id,
 			      const Cost cost = 1u) {
 	static const ReqParams null_req_params;
-	add_request(typename super::RequestRef(new R(std::move(request))),
+	add_request(super::make_request_ref(std::move(request)),
 		    client_id,
 		    null_req_params,
-		    get_time(),
+		    super::current_time(),
 		    cost);
       }
 
@@ -1280,12 +2961,14 @@ namespace crimson {
 				   const C& client_id,
 				   const ReqParams& req_params,
 				   const Time time,
-				   const Cost cost = 1u) {
-	add_request(typename super::RequestRef(new R(std::move(request))),
+				   const Cost cost = 1u,
+				   const RequestKey key = super::no_request_key) {
+	add_request(super::make_request_ref(std::move(request)),
 		    client_id,
 		    req_params,
 		    time,
-		    cost);
+		    cost,
+		    key);
       }
 
 
@@ -1293,7 +2976,8 @@ namespace crimson {
 			      const C& client_id,
 			      const ReqParams& req_params,
 			      const Cost cost = 1u) {
-	add_request(request, req_params, client_id, get_time(), cost);
+	add_request(std::move(request), client_id, req_params,
+		    super::current_time(), cost);
       }
 
 
@@ -1301,7 +2985,8 @@ namespace crimson {
 			      const C& client_id,
 			      const Cost cost = 1u) {
 	static const ReqParams null_req_params;
-	add_request(request, null_req_params, client_id, get_time(), cost);
+	add_request(std::move(request), client_id, null_req_params,
+		    super::current_time(), cost);
       }
 
 
@@ -1310,116 +2995,746 @@ namespace crimson {
 		       const C& client_id,
 		       const ReqParams& req_params,
 		       const Time time,
-		       const Cost cost = 1u) {
-	typename super::DataGuard g(this->data_mtx);
-#ifdef PROFILE
-	add_request_timer.start();
-#endif
+		       const Cost cost = 1u,
+		       const RequestKey key = super::no_request_key) {
+	if (super::stage_request(request, client_id, req_params,
+				 time, cost, key)) {
+	  // pairs with the fences in pull_request_wait and
+	  // arm_ready_fds, so that either the puller finds the staged
+	  // request or we find the waiter or the armed ready_efd
+	  std::atomic_thread_fence(std::memory_order_seq_cst);
+	  if (waiters > 0) {
+	    // taking the lock ensures a waiter that missed the request
+	    // is already waiting
+	    { typename super::DataGuard g(this->data_mtx); }
+	    pull_cv.notify_one();
+	  }
+	  signal_ready_fd();
+	  return;
+	}
+	std::unique_lock<std::mutex> l(this->data_mtx);
+	const auto profile_start = super::profile_start(add_request_timer);
+	// anything staged goes first to keep each client's order
+	super::drain_submission_ring_through(l);
 	super::do_add_request(std::move(request),
 			      client_id,
 			      req_params,
 			      time,
-			      cost);
+			      cost,
+			      key);
 	// no call to schedule_request for pull version
-#ifdef PROFILE
-	add_request_timer.stop();
-#endif
+	super::profile_stop(add_request_timer, profile_start);
+	if (waiters > 0) {
+	  pull_cv.notify_one();
+	}
+	signal_ready_fd();
+      }
+
+
+      // adds a batch of requests under one acquisition of the lock;
+      // see do_add_requests
+      template<typename I>
+      inline void add_requests(I first, I last) {
+	add_requests(first, last, super::current_time());
+      }
+
+
+      template<typename I>
+      void add_requests(I first, I last, const Time time) {
+	std::unique_lock<std::mutex> l(this->data_mtx);
+	const auto profile_start = super::profile_start(add_request_timer);
+	super::drain_submission_ring_through(l);
+	super::do_add_requests(first, last, time);
+	super::profile_stop(add_request_timer, profile_start);
+	if (waiters > 0) {
+	  pull_cv.notify_all();
+	}
+	signal_ready_fd();
       }
 
 
       inline PullReq pull_request() {
-	return pull_request(get_time());
+	return pull_request(super::current_time());
       }
 
 
       PullReq pull_request(const Time now) {
-	PullReq result;
 	typename super::DataGuard g(this->data_mtx);
-#ifdef PROFILE
-	pull_request_timer.start();
-#endif
+	const auto profile_start = super::profile_start(pull_request_timer);
+	super::drain_submission_ring();
+	PullReq result = do_pull_request(now);
+	if (!result.is_retn()) {
+	  if (arm_ready_fds()) {
+	    // something was staged while we were looking
+	    result = do_pull_request(now);
+	  }
+	  set_ready_timer(result.type,
+			  result.is_future() ? result.getTime() : TimeZero);
+	}
+	super::profile_stop(pull_request_timer, profile_start);
+	return result;
+      } // pull_request
+
+
+      // Pulls a request, waiting up to timeout for one to become
+      // eligible, whether through the passage of time or through
+      // requests being added. If none does, returns what pull_request
+      // returns once timeout has passed.
+      template<typename Rep, typename Per>
+      PullReq pull_request_wait(std::chrono::duration<Rep,Per> timeout) {
+	using Clock = std::chrono::steady_clock;
+	const Clock::time_point deadline = Clock::now() +
+	  std::chrono::duration_cast<Clock::duration>(timeout);
+
+	std::unique_lock<std::mutex> l(this->data_mtx);
+	++waiters;
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	while (true) {
+	  super::drain_submission_ring();
+	  PullReq result = do_pull_request(super::current_time());
+	  const Clock::time_point clock_now = Clock::now();
+	  if (result.is_retn() || clock_now >= deadline) {
+	    --waiters;
+	    if (result.is_retn() && waiters > 0) {
+	      // there may be more for the others
+	      pull_cv.notify_one();
+	    }
+	    return result;
+	  }
+
+	  Clock::time_point wake = deadline;
+	  if (result.is_future()) {
+	    // the queue's clock may not be steady, so convert the delay
+	    const auto delay = std::chrono::duration_cast<Clock::duration>(
+	      std::chrono::duration<double>(result.getTime() -
+					    super::current_time()));
+	    wake = std::min(wake, clock_now + delay);
+	  }
+	  pull_cv.wait_until(l, wake);
+	}
+      } // pull_request_wait
+
+
+      // When requests are pulled in a batch, this is the return
+      // type. The requests themselves are appended to a caller-owned
+      // vector; this describes why pulling stopped. If type is
+      // returning, the batch filled up (by count or cost) and more
+      // requests may be available.
+      struct PullBatch {
+	size_t                      count = 0;
+	typename super::NextReqType type = super::NextReqType::none;
+	Time                        when_ready = TimeZero;
+
+	bool is_none() const { return type == super::NextReqType::none; }
+	bool is_full() const { return type == super::NextReqType::returning; }
+	bool is_future() const { return type == super::NextReqType::future; }
+	Time getTime() const { return when_ready; }
+      };
+
+
+      inline PullBatch pull_requests(size_t max_count,
+				     std::vector<typename PullReq::Retn>& out) {
+	return pull_requests(super::current_time(), max_count, out);
+      }
+
 
+      // pulls up to max_count requests while holding the lock once
+      PullBatch pull_requests(const Time now,
+			      size_t max_count,
+			      std::vector<typename PullReq::Retn>& out) {
+	return do_pull_requests(now,
+				max_count,
+				std::numeric_limits<uint64_t>::max(),
+				out);
+      }
+
+
+      inline PullBatch pull_requests_cost(uint64_t max_cost,
+					  std::vector<typename PullReq::Retn>& out) {
+	return pull_requests_cost(super::current_time(), max_cost, out);
+      }
+
+
+      // pulls requests while holding the lock once, until the next
+      // request would take the total cost of the batch beyond
+      // max_cost; the first request is always pulled if available,
+      // so a single request costing more than max_cost cannot block
+      // the queue
+      PullBatch pull_requests_cost(const Time now,
+				   uint64_t max_cost,
+				   std::vector<typename PullReq::Retn>& out) {
+	return do_pull_requests(now,
+				std::numeric_limits<size_t>::max(),
+				max_cost,
+				out);
+      }
+
+
+      // describes what pull_request(now) would return without
+      // removing anything, so the results of several queues can be
+      // compared
+      typename super::PeekReq peek_request(const Time now) {
+	typename super::DataGuard g(this->data_mtx);
+	super::drain_submission_ring();
+	return super::do_peek_request(now);
+      }
+
+
+    protected:
+
+
+      // data_mtx should be held when called
+      PullReq do_pull_request(const Time now) {
+	PullReq result;
 	typename super::NextReq next = super::do_next_request(now);
 	result.type = next.type;
 	switch(next.type) {
 	case super::NextReqType::none:
-	  return result;
+	  break;
 	case super::NextReqType::future:
 	  result.data = next.when_ready;
-	  return result;
+	  break;
 	case super::NextReqType::returning:
-	  // to avoid nesting, break out and let code below handle this case
+	  {
+	    typename PullReq::Retn retn;
+	    pop_request(next.heap_id, now, retn);
+	    result.data = std::move(retn);
+	  }
 	  break;
 	default:
 	  assert(false);
 	}
+	return result;
+      } // do_pull_request
 
-	// we'll only get here if we're returning an entry
 
-	auto process_f =
-	  [&] (PullReq& pull_result, PhaseType phase) ->
+      // data_mtx should be held when called; top of the identified
+      // heap should have a request that can be returned
+      void pop_request(typename super::HeapId heap_id,
+		       const Time now,
+		       typename PullReq::Retn& retn) {
+	auto process_f = [&retn](PhaseType phase) ->
 	  std::function<void(const C&,
 			     uint64_t,
 			     typename super::RequestRef&)> {
-	  return [&pull_result, phase](const C& client,
-				       const Cost request_cost,
-				       typename super::RequestRef& request) {
-	    pull_result.data = typename PullReq::Retn{ client,
-						       std::move(request),
-						       phase,
-						       request_cost };
+	  return [&retn, phase](const C& client,
+				const Cost request_cost,
+				typename super::RequestRef& request) {
+	    retn.client = client;
+	    retn.request = std::move(request);
+	    retn.phase = phase;
+	    retn.cost = request_cost;
 	  };
 	};
 
-	switch(next.heap_id) {
+	switch(heap_id) {
 	case super::HeapId::reservation:
 	  super::pop_process_request(this->resv_heap,
-				     process_f(result,
-					       PhaseType::reservation));
+				     PhaseType::reservation,
+				     now,
+				     process_f(PhaseType::reservation));
 	  ++this->reserv_sched_count;
 	  break;
 	case super::HeapId::ready:
 	  super::pop_process_request(this->ready_heap,
-				     process_f(result, PhaseType::priority));
-	  { // need to use retn temporarily
-	    auto& retn = boost::get<typename PullReq::Retn>(result.data);
-	    super::reduce_reservation_tags(retn.client);
-	  }
+				     PhaseType::priority,
+				     now,
+				     process_f(PhaseType::priority));
 	  ++this->prop_sched_count;
 	  break;
 	default:
 	  assert(false);
 	}
+      } // pop_request
 
-#ifdef PROFILE
-	pull_request_timer.stop();
-#endif
+
+      PullBatch do_pull_requests(const Time now,
+				 size_t max_count,
+				 uint64_t max_cost,
+				 std::vector<typename PullReq::Retn>& out) {
+	PullBatch result;
+	uint64_t total_cost = 0;
+	typename super::DataGuard g(this->data_mtx);
+	const auto profile_start = super::profile_start(pull_request_timer);
+	super::drain_submission_ring();
+
+	do {
+	  while (result.count < max_count) {
+	    typename super::NextReq next = super::do_next_request(now);
+	    result.type = next.type;
+	    if (super::NextReqType::future == next.type) {
+	      result.when_ready = next.when_ready;
+	      break;
+	    } else if (super::NextReqType::none == next.type) {
+	      break;
+	    }
+
+	    if (result.count > 0 &&
+		total_cost + super::top_request_cost(next.heap_id) > max_cost) {
+	      break;
+	    }
+
+	    out.emplace_back();
+	    pop_request(next.heap_id, now, out.back());
+	    total_cost += out.back().cost;
+	    ++result.count;
+	  }
+	  // if we stopped for want of requests, keep going with any
+	  // staged while we were looking
+	} while (!result.is_full() && arm_ready_fds());
+	if (!result.is_full()) {
+	  set_ready_timer(result.type, result.when_ready);
+	}
+
+	super::profile_stop(pull_request_timer, profile_start);
 	return result;
-      } // pull_request
+      } // do_pull_requests
+
+
+      // Wakes an event loop waiting on ready_efd if the last pull
+      // found nothing eligible. A pull that finds nothing sets
+      // ready_armed before checking the submission ring one last
+      // time, so each staged or added request is either found by
+      // that check or followed by a write here.
+      inline void signal_ready_fd() {
+#ifdef __linux__
+	if (ready_armed.load() && ready_armed.exchange(false)) {
+	  const uint64_t one = 1;
+	  ssize_t r = ::write(ready_efd, &one, sizeof(one));
+	  (void) r;
+	}
+#endif
+      }
 
 
-    protected:
+      // data_mtx must be held by caller; called when a pull found
+      // nothing eligible, to clear ready_efd so the event loop waits
+      // again. Returns true if requests were staged meanwhile and the
+      // pull should look again.
+      bool arm_ready_fds() {
+#ifdef __linux__
+	if (ready_efd < 0) {
+	  return false;
+	}
+	ready_armed = true;
+	// pairs with the fence after staging in add_request
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	uint64_t count;
+	ssize_t r = ::read(ready_efd, &count, sizeof(count));
+	(void) r;
+	return super::drain_submission_ring() > 0;
+#else
+	return false;
+#endif
+      }
+
+
+      // data_mtx must be held by caller; arms the timerfd for when
+      // the next request becomes eligible, or disarms it if nothing
+      // is queued. Either way any earlier expiry is cleared.
+      void set_ready_timer(typename super::NextReqType type, Time when) {
+#ifdef __linux__
+	if (ready_tfd < 0 || super::NextReqType::returning == type) {
+	  return;
+	}
+	struct itimerspec spec = {};
+	if (super::NextReqType::future == type) {
+	  const double delay = when - super::current_time();
+	  if (delay > 0.0) {
+	    const double secs = std::floor(delay);
+	    spec.it_value.tv_sec = time_t(secs);
+	    spec.it_value.tv_nsec = long((delay - secs) * 1e9);
+	  }
+	  if (0 == spec.it_value.tv_sec && 0 == spec.it_value.tv_nsec) {
+	    // already due; a zero it_value would disarm instead
+	    spec.it_value.tv_nsec = 1;
+	  }
+	}
+	::timerfd_settime(ready_tfd, 0, &spec, nullptr);
+#endif
+      }
 
 
       // data_mtx should be held when called; unfortunately this
       // function has to be repeated in both push & pull
       // specializations
       typename super::NextReq next_request() {
-	return next_request(get_time());
+	return next_request(super::current_time());
       }
     }; // class PullPriorityQueue
 
 
+    // SHARDED PULL version
+    //
+    // Clients are partitioned by a hash of their id across a number
+    // of independent PullPriorityQueues, each with its own lock, so
+    // adding requests for clients in different shards does not
+    // contend. Pulling inspects the next request of every shard and
+    // takes the one that ranks best (reservations due, then requests
+    // within limit, then limit breaks; ties broken by tag), which
+    // preserves reservation, weight, and limit semantics across
+    // shards. Since each shard is only locked while it is being
+    // inspected, a concurrent add may change the winning shard before
+    // it is pulled from; the request returned is then the best one of
+    // that shard.
+    //
+    // NB: the proportion tag of an idle client becoming active is
+    // adjusted relative to the other clients of its shard only.
+    template<typename C, typename R, bool IsDelayed=true, bool U1=false, uint B=2,
+	     typename M=HashClientMap, typename T=DoubleTags,
+	     typename K=RealtimeClock, typename H=IndirectHeap,
+	     typename P=AllPhases, typename A=PooledAllocation>
+    class ShardedPullPriorityQueue {
+      using Queue = PullPriorityQueue<C,R,IsDelayed,U1,B,M,T,K,H,P,A>;
+      using QueueRef = std::unique_ptr<Queue>;
+
+      std::vector<QueueRef> shards;
+
+    public:
+
+      using RequestRef = typename Queue::RequestRef;
+      using RequestKey = typename Queue::RequestKey;
+      using PullReq = typename Queue::PullReq;
+      using NextReqType = typename Queue::NextReqType;
+      using ClientInfoFunc = typename Queue::ClientInfoFunc;
+
+      template<typename Rep, typename Per>
+      ShardedPullPriorityQueue(ClientInfoFunc _client_info_f,
+			       size_t _shard_count,
+			       std::chrono::duration<Rep,Per> _idle_age,
+			       std::chrono::duration<Rep,Per> _erase_age,
+			       std::chrono::duration<Rep,Per> _check_time,
+			       bool _allow_limit_break = false,
+			       double _anticipation_timeout = 0.0)
+      {
+	assert(_shard_count > 0);
+	for (size_t i = 0; i < _shard_count; ++i) {
+	  shards.emplace_back(new Queue(_client_info_f,
+					_idle_age, _erase_age, _check_time,
+					_allow_limit_break,
+					_anticipation_timeout));
+	}
+      }
+
+
+      // sharded pull convenience constructor
+      ShardedPullPriorityQueue(ClientInfoFunc _client_info_f,
+			       size_t _shard_count,
+			       bool _allow_limit_break = false,
+			       double _anticipation_timeout = 0.0) :
+	ShardedPullPriorityQueue(_client_info_f,
+				 _shard_count,
+				 std::chrono::minutes(10),
+				 std::chrono::minutes(15),
+				 std::chrono::minutes(6),
+				 _allow_limit_break,
+				 _anticipation_timeout)
+      {
+	// empty
+      }
+
+
+      size_t get_shard_count() const {
+	return shards.size();
+      }
+
+
+      uint get_heap_branching_factor() const {
+	return B;
+      }
+
+
+      bool empty() const {
+	for (const auto& s : shards) {
+	  if (!s->empty()) return false;
+	}
+	return true;
+      }
+
+
+      size_t client_count() const {
+	size_t total = 0;
+	for (const auto& s : shards) {
+	  total += s->client_count();
+	}
+	return total;
+      }
+
+
+      size_t request_count() const {
+	size_t total = 0;
+	for (const auto& s : shards) {
+	  total += s->request_count();
+	}
+	return total;
+      }
+
+
+      bool remove_by_req_filter(std::function<bool(RequestRef&&)> filter_accum,
+				bool visit_backwards = false) {
+	bool any_removed = false;
+	for (auto& s : shards) {
+	  if (s->remove_by_req_filter(filter_accum, visit_backwards)) {
+	    any_removed = true;
+	  }
+	}
+	return any_removed;
+      }
+
+
+      void remove_by_client(const C& client,
+			    bool reverse = false,
+			    std::function<void (RequestRef&&)> accum =
+			    Queue::request_sink) {
+	shard_of(client).remove_by_client(client, reverse, accum);
+      }
+
+
+      // a key may be used by clients in any shard, so each is visited
+      size_t remove_by_key(const RequestKey key,
+			   std::function<void (RequestRef&&)> accum =
+			   Queue::request_sink) {
+	size_t removed = 0;
+	for (auto& s : shards) {
+	  removed += s->remove_by_key(key, accum);
+	}
+	return removed;
+      }
+
+
+      void update_client_info(const C& client_id) {
+	shard_of(client_id).update_client_info(client_id);
+      }
+
+
+      void update_client_infos() {
+	for (auto& s : shards) {
+	  s->update_client_infos();
+	}
+      }
+
+
+      // each shard gets its own ring of the given capacity; see
+      // PriorityQueueBase::enable_submission_ring
+      void enable_submission_ring(size_t capacity) {
+	for (auto& s : shards) {
+	  s->enable_submission_ring(capacity);
+	}
+      }
+
+
+      using ClientMetrics = typename Queue::ClientMetrics;
+      using SchedCounts = typename Queue::SchedCounts;
+      using ClientState = typename Queue::ClientState;
+
+
+      SchedCounts sched_counts() const {
+	SchedCounts total;
+	for (const auto& s : shards) {
+	  const SchedCounts c = s->sched_counts();
+	  total.reservation += c.reservation;
+	  total.priority += c.priority;
+	  total.limit_break += c.limit_break;
+	}
+	return total;
+      }
+
+
+      void enable_client_metrics() {
+	for (auto& s : shards) {
+	  s->enable_client_metrics();
+	}
+      }
+
+
+      bool get_client_metrics(const C& client_id, ClientMetrics& out) const {
+	return shard_of(client_id).get_client_metrics(client_id, out);
+      }
+
+
+      // see PriorityQueueBase::get_client_states; the shards share a
+      // clock, so the time returned, from the last of them, serves
+      // for all of them
+      Time get_client_states(std::vector<ClientState>& out) const {
+	Time taken_at = TimeZero;
+	for (const auto& s : shards) {
+	  taken_at = s->get_client_states(out);
+	}
+	return taken_at;
+      }
+
+
+      void restore_client_states(const std::vector<ClientState>& states,
+				 const Time taken_at) {
+	std::vector<std::vector<ClientState>> by_shard(shards.size());
+	for (const auto& state : states) {
+	  by_shard[shard_index(state.client)].push_back(state);
+	}
+	for (size_t i = 0; i < shards.size(); ++i) {
+	  shards[i]->restore_client_states(by_shard[i], taken_at);
+	}
+      }
+
+
+      bool save_client_states(const std::string& path) const {
+	static_assert(std::is_trivially_copyable<C>::value,
+		      "saving client states requires trivially copyable ids");
+	std::vector<ClientState> states;
+	const Time taken_at = get_client_states(states);
+	return write_client_states(path, states, taken_at);
+      }
+
+
+      bool load_client_states(const std::string& path) {
+	static_assert(std::is_trivially_copyable<C>::value,
+		      "loading client states requires trivially copyable ids");
+	std::vector<ClientState> states;
+	Time taken_at;
+	if (!read_client_states(path, states, taken_at)) {
+	  return false;
+	}
+	restore_client_states(states, taken_at);
+	return true;
+      }
+
+
+      // shards are snapshotted one at a time, so the result is not
+      // from a single instant
+      std::vector<std::pair<C,ClientMetrics>> get_all_client_metrics() const {
+	std::vector<std::pair<C,ClientMetrics>> result;
+	for (const auto& s : shards) {
+	  auto part = s->get_all_client_metrics();
+	  std::move(part.begin(), part.end(), std::back_inserter(result));
+	}
+	return result;
+      }
+
+
+      inline void add_request(R&& request,
+			      const C& client_id,
+			      const ReqParams& req_params,
+			      const Cost cost = 1u) {
+	add_request(Queue::make_request_ref(std::move(request)),
+		    client_id,
+		    req_params,
+		    Queue::current_time(),
+		    cost);
+      }
+
+
+      inline void add_request(R&& request,
+			      const C& client_id,
+			      const Cost cost = 1u) {
+	static const ReqParams null_req_params;
+	add_request(Queue::make_request_ref(std::move(request)),
+		    client_id,
+		    null_req_params,
+		    Queue::current_time(),
+		    cost);
+      }
+
+
+      inline void add_request_time(R&& request,
+				   const C& client_id,
+				   const ReqParams& req_params,
+				   const Time time,
+				   const Cost cost = 1u,
+				   const RequestKey key = Queue::no_request_key) {
+	add_request(Queue::make_request_ref(std::move(request)),
+		    client_id,
+		    req_params,
+		    time,
+		    cost,
+		    key);
+      }
+
+
+      // only locks the shard the client belongs to
+      void add_request(RequestRef&& request,
+		       const C& client_id,
+		       const ReqParams& req_params,
+		       const Time time,
+		       const Cost cost = 1u,
+		       const RequestKey key = Queue::no_request_key) {
+	shard_of(client_id).add_request(std::move(request),
+					client_id,
+					req_params,
+					time,
+					cost,
+					key);
+      }
+
+
+      inline PullReq pull_request() {
+	return pull_request(Queue::current_time());
+      }
+
+
+      PullReq pull_request(const Time now) {
+	while (true) {
+	  size_t best = shards.size();
+	  typename Queue::PeekReq best_peek;
+	  for (size_t i = 0; i < shards.size(); ++i) {
+	    typename Queue::PeekReq peek = shards[i]->peek_request(now);
+	    if (peek.precedes(best_peek)) {
+	      best = i;
+	      best_peek = peek;
+	    }
+	  }
+
+	  PullReq result;
+	  result.type = best_peek.type;
+	  switch(best_peek.type) {
+	  case NextReqType::none:
+	    return result;
+	  case NextReqType::future:
+	    result.data = best_peek.when_ready;
+	    return result;
+	  case NextReqType::returning:
+	    result = shards[best]->pull_request(now);
+	    // if the shard was emptied between the peek and the pull
+	    // (e.g., by a competing pull) look again
+	    if (result.is_retn()) {
+	      return result;
+	    }
+	    break;
+	  default:
+	    assert(false);
+	  }
+	}
+      } // pull_request
+
+    protected:
+
+      size_t shard_index(const C& client_id) const {
+	return std::hash<C>()(client_id) % shards.size();
+      }
+
+      Queue& shard_of(const C& client_id) {
+	return *shards[shard_index(client_id)];
+      }
+
+      const Queue& shard_of(const C& client_id) const {
+	return *shards[shard_index(client_id)];
+      }
+    }; // class ShardedPullPriorityQueue
+
+
     // PUSH version
-    template<typename C, typename R, bool IsDelayed=true, bool U1=false, uint B=2>
-    class PushPriorityQueue : public PriorityQueueBase<C,R,IsDelayed,U1,B> {
+    template<typename C, typename R, bool IsDelayed=true, bool U1=false, uint B=2,
+	     typename M=HashClientMap, typename T=DoubleTags,
+	     typename K=RealtimeClock, typename H=IndirectHeap,
+	     typename P=AllPhases, typename A=PooledAllocation>
+    class PushPriorityQueue : public PriorityQueueBase<C,R,IsDelayed,U1,B,M,T,K,H,P,A> {
 
     protected:
 
-      using super = PriorityQueueBase<C,R,IsDelayed,U1,B>;
+      using super = PriorityQueueBase<C,R,IsDelayed,U1,B,M,T,K,H,P,A>;
 
     public:
 
+      using RequestKey = typename super::RequestKey;
+
       // a function to see whether the server can handle another request
       using CanHandleRequestFunc = std::function<bool(void)>;
 
@@ -1430,27 +3745,71 @@ namespace crimson {
 
     protected:
 
+      using Lock = std::unique_lock<std::mutex>;
+
+      // a request popped from the heaps and waiting to be handed to
+      // handle_f once data_mtx is released
+      struct Dispatch {
+	C                         client;
+	typename super::RequestRef request;
+	PhaseType                 phase;
+	Cost                      cost;
+
+	Dispatch(const C& _client,
+		 typename super::RequestRef&& _request,
+		 PhaseType _phase,
+		 Cost _cost) :
+	  client(_client),
+	  request(std::move(_request)),
+	  phase(_phase),
+	  cost(_cost)
+	{
+	  // empty
+	}
+      };
+
       CanHandleRequestFunc can_handle_f;
       HandleRequestFunc    handle_f;
-      // for handling timed scheduling
-      std::mutex  sched_ahead_mtx;
-      std::condition_variable sched_ahead_cv;
-      Time sched_ahead_when = TimeZero;
+      // for handling timed scheduling; the timer on the process-wide
+      // wheel only posts sched_ahead_work to the process-wide dispatch
+      // pool, which does the scheduling, so handle_f never runs on the
+      // wheel's thread
+      c::DispatchPool&        dispatch_pool;
+      c::TimerWheel::TimerId  sched_ahead_job;
+      c::DispatchPool::JobId  sched_ahead_work;
+
+      // handle_f is called without data_mtx held, by one thread at a
+      // time; while a thread is dispatching, other threads leave the
+      // scheduling to it (see schedule_and_dispatch)
+      bool                  dispatching = false;
+      std::vector<Dispatch> to_dispatch;
+
+      // performance data collection
+      size_t                complete_count = 0;
 
-#ifdef PROFILE
     public:
-      ProfileTimer<std::chrono::nanoseconds> add_request_timer;
-      ProfileTimer<std::chrono::nanoseconds> request_complete_timer;
-    protected:
-#endif
 
-      // NB: threads declared last, so constructed last and destructed first
+      // null until enable_profiling is called
+      typename super::ProfileRef add_request_timer;
+      typename super::ProfileRef request_complete_timer;
 
-      std::thread sched_ahead_thd;
 
-    public:
+      // Starts timing each add and request_completed in percentile
+      // histograms (see ProfileHistogram), at the cost of two clock
+      // reads and a few relaxed atomic adds per call. Until then each
+      // call only tests for a null timer. Must be called before the
+      // queue is shared between threads.
+      void enable_profiling() {
+	add_request_timer.reset(new typename super::ProfileTimer);
+	request_complete_timer.reset(new typename super::ProfileTimer);
+      }
 
-      // push full constructor
+      // push full constructor; handle_f is called by threads adding
+      // requests or reporting completions, and for requests that
+      // only become eligible later, by a thread of the shared
+      // dispatch pool. It is never called on the shared timer wheel's
+      // thread, so a slow handle_f does not hold up other queues'
+      // timers.
       template<typename Rep, typename Per>
       PushPriorityQueue(typename super::ClientInfoFunc _client_info_f,
 			CanHandleRequestFunc _can_handle_f,
@@ -1462,11 +3821,17 @@ namespace crimson {
 			double anticipation_timeout = 0.0) :
 	super(_client_info_f,
 	      _idle_age, _erase_age, _check_time,
-	      _allow_limit_break, anticipation_timeout)
+	      _allow_limit_break, anticipation_timeout),
+	dispatch_pool(c::DispatchPool::shared())
       {
 	can_handle_f = _can_handle_f;
 	handle_f = _handle_f;
-	sched_ahead_thd = std::thread(&PushPriorityQueue::run_sched_ahead, this);
+	sched_ahead_work =
+	  dispatch_pool.add(std::bind(&PushPriorityQueue::run_sched_ahead,
+				      this));
+	sched_ahead_job =
+	  this->timer_wheel.add(std::bind(&PushPriorityQueue::wake_sched_ahead,
+					  this));
       }
 
 
@@ -1491,8 +3856,10 @@ namespace crimson {
 
       ~PushPriorityQueue() {
 	this->finishing = true;
-	sched_ahead_cv.notify_one();
-	sched_ahead_thd.join();
+	// waits for a wake-up in progress, so nothing posts the work
+	// after it's removed; then waits for the work in progress
+	this->timer_wheel.remove(sched_ahead_job);
+	dispatch_pool.remove(sched_ahead_work);
       }
 
     public:
@@ -1501,10 +3868,10 @@ namespace crimson {
 			      const C& client_id,
 			      const ReqParams& req_params,
 			      const Cost cost = 1u) {
-	add_request(typename super::RequestRef(new R(std::move(request))),
+	add_request(super::make_request_ref(std::move(request)),
 		    client_id,
 		    req_params,
-		    get_time(),
+		    super::current_time(),
 		    cost);
       }
 
@@ -1513,7 +3880,8 @@ namespace crimson {
 			      const C& client_id,
 			      const ReqParams& req_params,
 			      const Cost cost = 1u) {
-	add_request(request, req_params, client_id, get_time(), cost);
+	add_request(std::move(request), client_id, req_params,
+		    super::current_time(), cost);
       }
 
 
@@ -1521,12 +3889,14 @@ namespace crimson {
 				   const C& client_id,
 				   const ReqParams& req_params,
 				   const Time time,
-				   const Cost cost = 1u) {
-	add_request(typename super::RequestRef(new R(request)),
+				   const Cost cost = 1u,
+				   const RequestKey key = super::no_request_key) {
+	add_request(super::make_request_ref(R(request)),
 		    client_id,
 		    req_params,
 		    time,
-		    cost);
+		    cost,
+		    key);
       }
 
 
@@ -1534,79 +3904,166 @@ namespace crimson {
 		       const C& client_id,
 		       const ReqParams& req_params,
 		       const Time time,
-		       const Cost cost = 1u) {
-	typename super::DataGuard g(this->data_mtx);
-#ifdef PROFILE
-	add_request_timer.start();
-#endif
+		       const Cost cost = 1u,
+		       const RequestKey key = super::no_request_key) {
+	if (super::stage_request(request, client_id, req_params,
+				 time, cost, key)) {
+	  // if someone else holds the lock, hand the scheduling off to
+	  // the sched-ahead thread rather than wait
+	  Lock l(this->data_mtx, std::try_to_lock);
+	  if (l.owns_lock()) {
+	    super::drain_submission_ring();
+	    schedule_and_dispatch(l);
+	  } else {
+	    sched_at(super::current_time());
+	  }
+	  return;
+	}
+	Lock l(this->data_mtx);
+	const auto profile_start = super::profile_start(add_request_timer);
+	// anything staged goes first to keep each client's order
+	super::drain_submission_ring_through(l);
 	super::do_add_request(std::move(request),
 			      client_id,
 			      req_params,
 			      time,
-			      cost);
-	schedule_request();
-#ifdef PROFILE
-	add_request_timer.stop();
-#endif
+			      cost,
+			      key);
+	super::profile_stop(add_request_timer, profile_start);
+	schedule_and_dispatch(l);
+      }
+
+
+      // adds a batch of requests under one acquisition of the lock;
+      // see do_add_requests
+      template<typename I>
+      inline void add_requests(I first, I last) {
+	add_requests(first, last, super::current_time());
+      }
+
+
+      template<typename I>
+      void add_requests(I first, I last, const Time time) {
+	Lock l(this->data_mtx);
+	const auto profile_start = super::profile_start(add_request_timer);
+	super::drain_submission_ring_through(l);
+	super::do_add_requests(first, last, time);
+	super::profile_stop(add_request_timer, profile_start);
+	schedule_and_dispatch(l);
       }
 
 
       void request_completed() {
-	typename super::DataGuard g(this->data_mtx);
-#ifdef PROFILE
-	request_complete_timer.start();
-#endif
-	schedule_request();
-#ifdef PROFILE
-	request_complete_timer.stop();
-#endif
+	request_completed(1);
+      }
+
+
+      // reports count requests completed at once, e.g., a batch of
+      // completions from asynchronous I/O; a single scheduling pass
+      // then fills all the slots they freed
+      void request_completed(size_t count) {
+	assert(count > 0);
+	Lock l(this->data_mtx);
+	const auto profile_start = super::profile_start(request_complete_timer);
+	complete_count += count;
+	super::drain_submission_ring();
+	super::profile_stop(request_complete_timer, profile_start);
+	schedule_and_dispatch(l);
       }
 
     protected:
 
+      // l must hold data_mtx, and does again on return. Schedules
+      // requests until can_handle_f returns false or none is eligible,
+      // so that the server is filled however many slots have come
+      // free, handing each request scheduled to handle_f with
+      // data_mtx released. If another thread is already doing this,
+      // it's left to that thread, which will see the state this
+      // thread leaves; so handle_f is called in the order requests
+      // were scheduled and never concurrently. If handle_f throws,
+      // the exception propagates with l relocked and dispatching left
+      // to the next caller.
+      void schedule_and_dispatch(Lock& l) {
+	if (dispatching) {
+	  return;
+	}
+
+	// clears dispatching on every way out, relocking first so it
+	// is only ever changed under data_mtx
+	struct DispatchGuard {
+	  bool& dispatching;
+	  Lock& l;
+
+	  DispatchGuard(bool& _dispatching, Lock& _l) :
+	    dispatching(_dispatching),
+	    l(_l)
+	  {
+	    dispatching = true;
+	  }
+
+	  ~DispatchGuard() {
+	    if (!l.owns_lock()) {
+	      l.lock();
+	    }
+	    dispatching = false;
+	  }
+	};
+
+	DispatchGuard guard(dispatching, l);
+	while (true) {
+	  schedule_request();
+	  if (to_dispatch.empty()) {
+	    break;
+	  }
+
+	  Dispatch d = std::move(to_dispatch.back());
+	  to_dispatch.pop_back();
+	  l.unlock();
+	  handle_f(d.client, std::move(d.request), d.phase, d.cost);
+	  l.lock();
+	}
+      }
+
       // data_mtx should be held when called; furthermore, the heap
       // should not be empty and the top element of the heap should
-      // not be already handled
+      // not be already handled; the request is queued in to_dispatch
       //
-      // NOTE: the use of "super::ClientRec" in either the template
-      // construct or as a parameter to submit_top_request generated
-      // a compiler error in g++ 4.8.4, when ClientRec was
-      // "protected" rather than "public". By g++ 6.3.1 this was not
-      // an issue. But for backwards compatibility
-      // PriorityQueueBase::ClientRec is public.
-      template<typename C1,
-	       IndIntruHeapData super::ClientRec::*C2,
-	       typename C3,
-	       uint B4>
-      C submit_top_request(IndIntruHeap<C1,typename super::ClientRec,C2,C3,B4>& heap,
-			   PhaseType phase) {
+      template<typename HeapT>
+      C submit_top_request(HeapT& heap, PhaseType phase, const Time now) {
 	C client_result;
 	super::pop_process_request(heap,
+				   phase,
+				   now,
 				   [this, phase, &client_result]
 				   (const C& client,
 				    const Cost request_cost,
 				    typename super::RequestRef& request) {
 				     client_result = client;
-				     handle_f(client, std::move(request), phase, request_cost);
+				     to_dispatch.emplace_back(client,
+							      std::move(request),
+							      phase,
+							      request_cost);
 				   });
 	return client_result;
       }
 
 
       // data_mtx should be held when called
-      void submit_request(typename super::HeapId heap_id) {
-	C client;
+      void submit_request(typename super::HeapId heap_id, const Time now) {
 	switch(heap_id) {
 	case super::HeapId::reservation:
 	  // don't need to note client
-	  (void) submit_top_request(this->resv_heap, PhaseType::reservation);
+	  (void) submit_top_request(this->resv_heap,
+				    PhaseType::reservation,
+				    now);
 	  // unlike the other two cases, we do not reduce reservation
 	  // tags here
 	  ++this->reserv_sched_count;
 	  break;
 	case super::HeapId::ready:
-	  client = submit_top_request(this->ready_heap, PhaseType::priority);
-	  super::reduce_reservation_tags(client);
+	  (void) submit_top_request(this->ready_heap,
+				    PhaseType::priority,
+				    now);
 	  ++this->prop_sched_count;
 	  break;
 	default:
@@ -1619,7 +4076,7 @@ namespace crimson {
       // function has to be repeated in both push & pull
       // specializations
       typename super::NextReq next_request() {
-	return next_request(get_time());
+	return next_request(super::current_time());
       }
 
 
@@ -1639,7 +4096,8 @@ namespace crimson {
 
       // data_mtx should be held when called
       void schedule_request() {
-	typename super::NextReq next_req = next_request();
+	const Time now = super::current_time();
+	typename super::NextReq next_req = next_request(now);
 	switch (next_req.type) {
 	case super::NextReqType::none:
 	  return;
@@ -1647,7 +4105,7 @@ namespace crimson {
 	  sched_at(next_req.when_ready);
 	  break;
 	case super::NextReqType::returning:
-	  submit_request(next_req.heap_id);
+	  submit_request(next_req.heap_id, now);
 	  break;
 	default:
 	  assert(false);
@@ -1655,42 +4113,31 @@ namespace crimson {
       }
 
 
-      // this is the thread that handles running schedule_request at
-      // future times when nothing can be scheduled immediately
-      void run_sched_ahead() {
-	std::unique_lock<std::mutex> l(sched_ahead_mtx);
+      // runs on the timer wheel when sched_at's time comes; hands
+      // the work to the dispatch pool so the wheel's thread never
+      // waits on data_mtx or runs handle_f
+      void wake_sched_ahead() {
+	dispatch_pool.post(sched_ahead_work);
+      }
 
-	while (!this->finishing) {
-	  if (TimeZero == sched_ahead_when) {
-	    sched_ahead_cv.wait(l);
-	  } else {
-	    Time now;
-	    while (!this->finishing && (now = get_time()) < sched_ahead_when) {
-	      long microseconds_l = long(1 + 1000000 * (sched_ahead_when - now));
-	      auto microseconds = std::chrono::microseconds(microseconds_l);
-	      sched_ahead_cv.wait_for(l, microseconds);
-	    }
-	    sched_ahead_when = TimeZero;
-	    if (this->finishing) return;
 
-	    l.unlock();
-	    if (!this->finishing) {
-	      typename super::DataGuard g(this->data_mtx);
-	      schedule_request();
-	    }
-	    l.lock();
-	  }
-	}
+      // runs on a dispatch pool thread to schedule requests at future
+      // times when nothing could be scheduled immediately
+      void run_sched_ahead() {
+	if (this->finishing) return;
+	Lock dl(this->data_mtx);
+	super::drain_submission_ring();
+	schedule_and_dispatch(dl);
       }
 
 
       void sched_at(Time when) {
-	std::lock_guard<std::mutex> l(sched_ahead_mtx);
 	if (this->finishing) return;
-	if (TimeZero == sched_ahead_when || when < sched_ahead_when) {
-	  sched_ahead_when = when;
-	  sched_ahead_cv.notify_one();
-	}
+	// the wheel runs on the monotonic clock, so convert the delay
+	const auto delay = std::chrono::duration_cast<c::TimerWheel::Duration>(
+	  std::chrono::duration<double>(when - super::current_time()));
+	this->timer_wheel.arm_by(sched_ahead_job,
+				 c::TimerWheel::Clock::now() + delay);
       }
     }; // class PushPriorityQueue
 
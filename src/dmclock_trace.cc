@@ -0,0 +1,133 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+#include <errno.h>
+
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <memory>
+
+#include "dmclock_trace.h"
+
+
+namespace dmc = crimson::dmclock;
+
+
+namespace {
+  const char trace_magic[8] = { 'D', 'M', 'C', 'T', 'R', 'A', 'C', 'E' };
+  const uint32_t trace_version = 1;
+
+  struct TraceHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t event_size;
+    uint64_t count;
+  };
+
+  using File = std::unique_ptr<FILE,int(*)(FILE*)>;
+
+  // events this far beyond the base time are pinned tags
+  const dmc::Time pinned_time = 1e9;
+}
+
+
+bool dmc::write_trace(const std::string& path,
+		      const std::vector<TraceEvent>& events) {
+  File f(fopen(path.c_str(), "wb"), fclose);
+  if (!f) {
+    return false;
+  }
+  TraceHeader header;
+  memcpy(header.magic, trace_magic, sizeof(header.magic));
+  header.version = trace_version;
+  header.event_size = sizeof(TraceEvent);
+  header.count = events.size();
+  if (1 != fwrite(&header, sizeof(header), 1, f.get()) ||
+      events.size() != fwrite(events.data(), sizeof(TraceEvent),
+			      events.size(), f.get())) {
+    return false;
+  }
+  return 0 == fclose(f.release());
+}
+
+
+bool dmc::read_trace(const std::string& path,
+		     std::vector<TraceEvent>& events) {
+  File f(fopen(path.c_str(), "rb"), fclose);
+  if (!f) {
+    return false;
+  }
+  TraceHeader header;
+  if (1 != fread(&header, sizeof(header), 1, f.get()) ||
+      0 != memcmp(header.magic, trace_magic, sizeof(header.magic)) ||
+      trace_version != header.version ||
+      sizeof(TraceEvent) != header.event_size) {
+    errno = EINVAL;
+    return false;
+  }
+  const size_t start = events.size();
+  events.resize(start + header.count);
+  if (header.count != fread(events.data() + start, sizeof(TraceEvent),
+			    header.count, f.get())) {
+    events.resize(start);
+    errno = EINVAL;
+    return false;
+  }
+  return true;
+}
+
+
+const char* dmc::trace_type_name(TraceType type) {
+  switch(type) {
+  case TraceType::add:
+    return "add";
+  case TraceType::reservation:
+    return "resv";
+  case TraceType::priority:
+    return "prop";
+  case TraceType::limit_break:
+    return "break";
+  default:
+    return "?";
+  }
+}
+
+
+void dmc::format_trace_event(std::ostream& out,
+			     const TraceEvent& event,
+			     Time base) {
+  auto tag = [&out, base] (Time t) {
+    if (t - base > pinned_time || base - t > pinned_time) {
+      out << (t > base ? "max" : "min");
+    } else {
+      out << std::fixed << std::setprecision(6) << (t - base);
+    }
+  };
+
+  out << std::fixed << std::setprecision(6) << (event.now - base) <<
+    " " << trace_type_name(event.type) <<
+    " client:" << event.client <<
+    " cost:" << event.cost <<
+    " depth:" << event.client_depth <<
+    " clients:" << event.client_count <<
+    " arrival:";
+  tag(event.arrival);
+  out << " r:";
+  tag(event.reservation);
+  out << " p:";
+  tag(event.proportion);
+  out << " l:";
+  tag(event.limit);
+  out << (event.flags & TraceEvent::flag_ready ? " ready" : "");
+}
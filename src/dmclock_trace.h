@@ -0,0 +1,146 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+#pragma once
+
+
+#include <assert.h>
+
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+#include <ostream>
+
+#include "dmclock_util.h"
+
+
+namespace crimson {
+  namespace dmclock {
+
+    enum class TraceType : uint8_t {
+      add = 0,         // a request was queued
+      reservation = 1, // a request was dispatched by reservation
+      priority = 2,    // ... by weight, within its limit
+      limit_break = 3, // ... by weight, beyond its limit
+    };
+
+    // One scheduling decision, laid out to be written to a file as
+    // is. Tags are in seconds whatever the queue's tag policy, with
+    // pinned tags (e.g., the reservation of a client without one)
+    // showing as very large or small values. For an add they are
+    // those of the client's first queued request, which is what the
+    // heaps order the client by; for a dispatch they are those of
+    // the request dispatched.
+    struct TraceEvent {
+      static constexpr uint8_t flag_ready = 1; // within limit
+
+      TraceType type;
+      uint8_t   flags;
+      uint16_t  unused;
+      uint32_t  client_depth; // client's queued requests afterwards
+      uint32_t  cost;         // of the request added or dispatched
+      uint32_t  client_count; // clients the queue has records for
+      uint64_t  client;       // see TraceClientId
+      Time      now;          // time of the add or dispatch
+      Time      arrival;
+      Time      reservation;
+      Time      proportion;
+      Time      limit;
+    };
+
+    static_assert(sizeof(TraceEvent) == 64,
+		  "trace files depend on the size of TraceEvent");
+
+
+    // Identifies the client in a TraceEvent by std::hash of its id
+    // when the id type has one. Id types that don't (e.g., those used
+    // only with OrderedClientMap) are recorded as 0, so tracing adds
+    // no requirement on the id type.
+    template<typename C, typename = void>
+    struct TraceClientId {
+      static uint64_t get(const C&) { return 0; }
+    };
+
+    template<typename C>
+    struct TraceClientId<C,
+			 decltype(void(std::hash<C>()(std::declval<const C&>())))> {
+      static uint64_t get(const C& client) {
+	return std::hash<C>()(client);
+      }
+    };
+
+
+    /*
+     * Keeps the most recent capacity events, overwriting the oldest.
+     * It has no lock of its own; the queue records and copies events
+     * while holding data_mtx, so recording is a few stores into the
+     * next slot.
+     */
+    class TraceRing {
+      std::vector<TraceEvent> events;
+      uint64_t                mask;
+      uint64_t                recorded = 0;
+
+    public:
+
+      // capacity is rounded up to a power of two
+      explicit TraceRing(size_t capacity) {
+	assert(capacity > 0);
+	size_t size = 1;
+	while (size < capacity) {
+	  size *= 2;
+	}
+	events.resize(size);
+	mask = size - 1;
+      }
+
+      size_t capacity() const { return events.size(); }
+
+      // events recorded in all, including overwritten ones
+      uint64_t total() const { return recorded; }
+
+      // returns the slot for the next event, which the caller fills
+      TraceEvent& next() {
+	return events[recorded++ & mask];
+      }
+
+      // appends the events still held, oldest first
+      void copy(std::vector<TraceEvent>& out) const {
+	const uint64_t held = std::min<uint64_t>(recorded, events.size());
+	out.reserve(out.size() + held);
+	for (uint64_t i = recorded - held; i < recorded; ++i) {
+	  out.push_back(events[i & mask]);
+	}
+      }
+    }; // class TraceRing
+
+
+    // Trace files are a header followed by the events, in the byte
+    // order of the machine that wrote them; both return false and
+    // set errno if the file cannot be written or is not a trace.
+    bool write_trace(const std::string& path,
+		     const std::vector<TraceEvent>& events);
+    bool read_trace(const std::string& path,
+		    std::vector<TraceEvent>& events);
+
+    const char* trace_type_name(TraceType type);
+
+    // one line per event, with the time of each relative to base
+    void format_trace_event(std::ostream& out,
+			    const TraceEvent& event,
+			    Time base);
+  } // namespace dmclock
+} // namespace crimson
@@ -17,6 +17,7 @@
 
 #include <iomanip>
 #include <sstream>
+#include <thread>
 
 #include "dmclock_util.h"
 
@@ -32,3 +33,22 @@ std::string crimson::dmclock::format_time(const Time& time, uint modulo) {
 void crimson::dmclock::debugger() {
   raise(SIGCONT);
 }
+
+
+const crimson::dmclock::TscClock::Calibration&
+crimson::dmclock::TscClock::calibration() {
+  static const Calibration cal = [] {
+    Calibration result {0, 0.0, 0.0};
+#if defined(__x86_64__) || defined(__i386__)
+    const Time start_time = MonotonicClock::now();
+    const uint64_t start_tsc = __rdtsc();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    result.base_time = MonotonicClock::now();
+    result.base_tsc = __rdtsc();
+    result.seconds_per_tick =
+      (result.base_time - start_time) / double(result.base_tsc - start_tsc);
+#endif
+    return result;
+  }();
+  return cal;
+}
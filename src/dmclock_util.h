@@ -20,9 +20,15 @@
 #include <assert.h>
 #include <sys/time.h>
 
+#include <cstdint>
 #include <limits>
 #include <cmath>
 #include <chrono>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 
 namespace crimson {
@@ -52,6 +58,85 @@ namespace crimson {
 #endif
     }
 
+    // Clock sources determine where a queue gets the current time
+    // when the caller doesn't supply it. Each provides a static now()
+    // returning Time in seconds. Times passed to a queue explicitly
+    // (e.g., to add_request_time or pull_request) must come from the
+    // clock source that queue uses.
+
+    // Wall-clock time from get_time. The default. Steps whenever the
+    // system time is set.
+    struct RealtimeClock {
+      static Time now() {
+	return get_time();
+      }
+    };
+
+    // Seconds since an arbitrary point; never steps.
+    struct MonotonicClock {
+      static Time now() {
+#if defined(__linux__)
+	struct timespec now;
+	auto result = clock_gettime(CLOCK_MONOTONIC, &now);
+	(void) result; // reference result in case assert is compiled out
+	assert(0 == result);
+	return now.tv_sec + (now.tv_nsec / 1.0e9);
+#else
+	return std::chrono::duration<Time>(
+	  std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+      }
+    };
+
+    // As MonotonicClock, but only as precise as the kernel's tick
+    // (typically 1 to 4 ms), which lets it be read without entering
+    // the kernel. Falls back to MonotonicClock where unavailable.
+    struct MonotonicCoarseClock {
+      static Time now() {
+#if defined(__linux__) && defined(CLOCK_MONOTONIC_COARSE)
+	struct timespec now;
+	auto result = clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	(void) result; // reference result in case assert is compiled out
+	assert(0 == result);
+	return now.tv_sec + (now.tv_nsec / 1.0e9);
+#else
+	return MonotonicClock::now();
+#endif
+      }
+    };
+
+    // Reads the CPU's time-stamp counter, scaled by a rate measured
+    // once against MonotonicClock over about 10 ms; the queues take
+    // that measurement when constructed. The rate is never measured
+    // again, so TscClock drifts from MonotonicClock: 100 ns of jitter
+    // in the reads gives a rate error of 1e-5 (10 us per second, 36
+    // ms per hour), more if the calibrating thread is preempted, and
+    // NTP slewing of CLOCK_MONOTONIC is not followed. Only compare
+    // its times with one another; the queues only use differences,
+    // so the error makes reservations and limits that fraction
+    // faster or slower. Relies on an invariant TSC that is
+    // synchronized across cores, as on current x86-64 processors.
+    // Falls back to MonotonicClock on other architectures.
+    struct TscClock {
+      struct Calibration {
+	uint64_t base_tsc;
+	Time     base_time;
+	double   seconds_per_tick;
+      };
+
+      static Time now() {
+#if defined(__x86_64__) || defined(__i386__)
+	const Calibration& cal = calibration();
+	return cal.base_time +
+	  int64_t(__rdtsc() - cal.base_tsc) * cal.seconds_per_tick;
+#else
+	return MonotonicClock::now();
+#endif
+      }
+
+      static const Calibration& calibration();
+    };
+
     std::string format_time(const Time& time, uint modulo = 1000);
 
     void debugger();
@@ -0,0 +1,261 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+#pragma once
+
+
+#include <vector>
+#include <utility>
+#include <stdexcept>
+#include <type_traits>
+
+#include "assert.h"
+
+
+namespace crimson {
+
+  /*
+   * A map for small, densely allocated, non-negative integer keys
+   * (e.g., client ids handed out sequentially). The key is used
+   * directly as an index into a vector, so a lookup is a bounds check
+   * and a load. Memory use is proportional to the largest key ever
+   * inserted, so it is a poor choice for sparse keys.
+   *
+   * Presents the same interface as OpenHashMap; in particular
+   * erasing does not invalidate iterators, and iteration is in key
+   * order.
+   *
+   * K is the key type, which must be integral; V the mapped type,
+   * which must be default constructible.
+   */
+  template<typename K, typename V>
+  class DenseMap {
+
+    static_assert(std::is_integral<K>::value,
+		  "DenseMap keys must be of integral type");
+
+  public:
+
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<K,V>;
+    using size_type = size_t;
+
+  protected:
+
+    struct Slot {
+      bool       used = false;
+      value_type kv;
+    };
+
+    template<typename M, typename T>
+    class IteratorBase {
+      friend DenseMap;
+
+      M*     map;
+      size_t index;
+
+      IteratorBase(M* _map, size_t _index) :
+	map(_map),
+	index(_index)
+      {
+	skip_unused();
+      }
+
+      void skip_unused() {
+	while (index < map->slots.size() && !map->slots[index].used) {
+	  ++index;
+	}
+      }
+
+    public:
+
+      IteratorBase() :
+	map(nullptr),
+	index(0)
+      {
+	// empty
+      }
+
+      // allows conversion from iterator to const_iterator
+      template<typename M2, typename T2>
+      IteratorBase(const IteratorBase<M2,T2>& other) :
+	map(other.map),
+	index(other.index)
+      {
+	// empty
+      }
+
+      IteratorBase& operator++() {
+	++index;
+	skip_unused();
+	return *this;
+      }
+
+      IteratorBase operator++(int) {
+	IteratorBase result(*this);
+	++(*this);
+	return result;
+      }
+
+      bool operator==(const IteratorBase& other) const {
+	return map == other.map && index == other.index;
+      }
+
+      bool operator!=(const IteratorBase& other) const {
+	return !(*this == other);
+      }
+
+      T& operator*() const {
+	return map->slots[index].kv;
+      }
+
+      T* operator->() const {
+	return &map->slots[index].kv;
+      }
+
+      template<typename M2, typename T2>
+      friend class IteratorBase;
+    }; // class IteratorBase
+
+  public:
+
+    using iterator = IteratorBase<DenseMap, value_type>;
+    using const_iterator = IteratorBase<const DenseMap, const value_type>;
+
+  protected:
+
+    std::vector<Slot> slots;
+    size_t            used = 0;
+
+  public:
+
+    DenseMap() {
+      // empty
+    }
+
+    bool empty() const { return 0 == used; }
+
+    size_t size() const { return used; }
+
+    iterator begin() { return iterator(this, 0); }
+
+    iterator end() { return iterator(this, slots.size()); }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+
+    const_iterator end() const { return const_iterator(this, slots.size()); }
+
+    const_iterator cbegin() const { return begin(); }
+
+    const_iterator cend() const { return end(); }
+
+    iterator find(const K& key) {
+      return contains(key) ? iterator(this, size_t(key)) : end();
+    }
+
+    const_iterator find(const K& key) const {
+      return contains(key) ? const_iterator(this, size_t(key)) : end();
+    }
+
+    size_t count(const K& key) const {
+      return contains(key) ? 1 : 0;
+    }
+
+    V& at(const K& key) {
+      if (!contains(key)) {
+	throw std::out_of_range("DenseMap::at");
+      }
+      return slots[size_t(key)].kv.second;
+    }
+
+    const V& at(const K& key) const {
+      if (!contains(key)) {
+	throw std::out_of_range("DenseMap::at");
+      }
+      return slots[size_t(key)].kv.second;
+    }
+
+    V& operator[](const K& key) {
+      return insert_slot(key).first->kv.second;
+    }
+
+    std::pair<iterator,bool> emplace(const K& key, V&& value) {
+      auto r = insert_slot(key);
+      if (r.second) {
+	r.first->kv.second = std::move(value);
+      }
+      return std::make_pair(iterator(this, size_t(key)), r.second);
+    }
+
+    std::pair<iterator,bool> emplace(const K& key, const V& value) {
+      V copy(value);
+      return emplace(key, std::move(copy));
+    }
+
+    // returns iterator to the entry following the one erased
+    iterator erase(const_iterator pos) {
+      assert(pos.map == this && pos.index < slots.size());
+      erase_slot(slots[pos.index]);
+      return ++iterator(this, pos.index);
+    }
+
+    size_t erase(const K& key) {
+      if (!contains(key)) {
+	return 0;
+      }
+      erase_slot(slots[size_t(key)]);
+      return 1;
+    }
+
+    void clear() {
+      slots.clear();
+      used = 0;
+    }
+
+    // makes room for keys up to n - 1 without reallocating
+    void reserve(size_t n) {
+      slots.reserve(n);
+    }
+
+  protected:
+
+    bool contains(const K& key) const {
+      return key >= 0 && size_t(key) < slots.size() && slots[size_t(key)].used;
+    }
+
+    std::pair<Slot*,bool> insert_slot(const K& key) {
+      assert(key >= 0);
+      size_t i = size_t(key);
+      if (i >= slots.size()) {
+	slots.resize(i + 1);
+      }
+      Slot& s = slots[i];
+      if (s.used) {
+	return std::make_pair(&s, false);
+      }
+      s.used = true;
+      s.kv.first = key;
+      ++used;
+      return std::make_pair(&s, true);
+    }
+
+    void erase_slot(Slot& s) {
+      assert(s.used);
+      s.used = false;
+      s.kv = value_type();
+      --used;
+    }
+  }; // class DenseMap
+
+} // namespace crimson
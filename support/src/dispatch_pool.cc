@@ -0,0 +1,114 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+#include <algorithm>
+
+#include "dispatch_pool.h"
+
+
+crimson::DispatchPool::DispatchPool(unsigned thread_count) {
+  for (unsigned i = 0; i < thread_count; ++i) {
+    threads.emplace_back(&DispatchPool::run, this);
+  }
+}
+
+
+crimson::DispatchPool::~DispatchPool() {
+  {
+    Guard g(mtx);
+    finishing = true;
+    work_cv.notify_all();
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+}
+
+
+crimson::DispatchPool& crimson::DispatchPool::shared() {
+  static DispatchPool pool(std::max(2u, std::thread::hardware_concurrency()));
+  return pool;
+}
+
+
+crimson::DispatchPool::JobId
+crimson::DispatchPool::add(const std::function<void()>& body) {
+  Guard g(mtx);
+  const JobId id = next_id++;
+  jobs.emplace(id, std::unique_ptr<Job>(new Job(body)));
+  return id;
+}
+
+
+void crimson::DispatchPool::post(JobId id) {
+  Guard g(mtx);
+  Job* j = find_job(id);
+  if (!j || j->queued) return;
+
+  j->queued = true;
+  // a running job goes back on ready when it returns
+  if (!j->running) {
+    ready.push_back(id);
+    work_cv.notify_one();
+  }
+}
+
+
+void crimson::DispatchPool::remove(JobId id) {
+  Lock l(mtx);
+  Job* j = find_job(id);
+  if (!j) return;
+
+  // a queued entry left in ready is skipped once the job is gone
+  j->removed = true;
+  done_cv.wait(l, [j] { return !j->running; });
+  jobs.erase(id);
+}
+
+
+void crimson::DispatchPool::run() {
+  Lock l(mtx);
+  while (!finishing) {
+    if (ready.empty()) {
+      work_cv.wait(l);
+      continue;
+    }
+
+    const JobId id = ready.front();
+    ready.pop_front();
+    Job* j = find_job(id);
+    if (!j) continue;
+
+    j->queued = false;
+    j->running = true;
+    l.unlock();
+    j->body();
+    l.lock();
+    j->running = false;
+
+    if (j->queued && !j->removed) {
+      ready.push_back(id);
+      work_cv.notify_one();
+    }
+    done_cv.notify_all();
+  }
+}
+
+
+crimson::DispatchPool::Job* crimson::DispatchPool::find_job(JobId id) {
+  auto i = jobs.find(id);
+  if (jobs.end() == i || i->second->removed) {
+    return nullptr;
+  }
+  return i->second.get();
+}
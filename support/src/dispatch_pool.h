@@ -0,0 +1,119 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+#pragma once
+
+
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <deque>
+#include <vector>
+
+
+namespace crimson {
+
+  /*
+   * A small fixed set of threads that runs work handed off by
+   * TimerWheel callbacks (or anyone else) that may take too long to
+   * run on the wheel's own thread, so that objects needing such work
+   * share these threads rather than each starting one of its own.
+   *
+   * Like the wheel's timers, a job is registered once, with its
+   * body, and then posted as often as needed. Posting a job that is
+   * already queued does nothing, and a job never runs on two threads
+   * at once; one posted while it is running runs again once it
+   * returns. A slow job holds up only the thread running it.
+   */
+  class DispatchPool {
+
+  public:
+
+    using JobId = uint64_t;
+
+  protected:
+
+    using Lock = std::unique_lock<std::mutex>;
+    using Guard = std::lock_guard<std::mutex>;
+
+    struct Job {
+      std::function<void()> body;
+      bool                  queued = false;
+      bool                  running = false;
+      bool                  removed = false;
+
+      explicit Job(const std::function<void()>& _body) :
+	body(_body)
+      {
+	// empty
+      }
+    }; // struct Job
+
+    mutable std::mutex      mtx;
+    std::condition_variable work_cv; // wakes an idle thread
+    std::condition_variable done_cv; // signals a job finished
+    bool                    finishing = false;
+
+    JobId                   next_id = 1;
+
+    std::unordered_map<JobId,std::unique_ptr<Job>> jobs;
+    std::deque<JobId>       ready; // queued and not running
+
+    // put threads last so all other variables are initialized first
+
+    std::vector<std::thread> threads;
+
+  public:
+
+    explicit DispatchPool(unsigned thread_count);
+
+    DispatchPool(const DispatchPool&) = delete;
+    DispatchPool& operator=(const DispatchPool&) = delete;
+
+    // stops the threads; jobs still queued never run
+    ~DispatchPool();
+
+    // the pool shared by everything in the process, started on first
+    // use with a thread per core, but at least two
+    static DispatchPool& shared();
+
+    // registers a job that runs body each time it's posted
+    JobId add(const std::function<void()>& body);
+
+    // queues the job to run on one of the pool's threads
+    void post(JobId id);
+
+    // unregisters the job; if it's running, waits for it to finish so
+    // that whatever the body refers to may be destroyed once this
+    // returns. Must not be called from the job's own body.
+    void remove(JobId id);
+
+    // number of registered jobs
+    size_t size() const {
+      Guard g(mtx);
+      return jobs.size();
+    }
+
+  protected:
+
+    void run();
+
+    // mtx must be held by caller
+    Job* find_job(JobId id);
+  }; // class DispatchPool
+
+} // namespace crimson
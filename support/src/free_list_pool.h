@@ -0,0 +1,182 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <new>
+#include <array>
+#include <vector>
+#include <algorithm>
+
+#include "assert.h"
+
+
+namespace crimson {
+
+  /*
+   * A memory pool for small blocks. Blocks are carved out of larger
+   * slabs and, when freed, are kept on a free list for their size
+   * class rather than being returned to the system, so a workload
+   * that repeatedly allocates and frees objects of the same few sizes
+   * stops calling malloc once it reaches a steady state. Slabs are
+   * only released when the pool is destroyed.
+   *
+   * Requests larger than max_pooled_size go straight to operator
+   * new/delete.
+   *
+   * FreeListPool is not thread-safe; the caller must serialize
+   * access.
+   */
+  class FreeListPool {
+
+  public:
+
+    static constexpr size_t granularity = alignof(std::max_align_t);
+    static constexpr size_t max_pooled_size = 1024;
+
+  protected:
+
+    static constexpr size_t class_count = max_pooled_size / granularity;
+    static constexpr size_t slab_size = 8 * 1024;
+
+    struct FreeBlock {
+      FreeBlock* next;
+    };
+
+    std::array<FreeBlock*,class_count> free_lists;
+    std::vector<void*>                 slabs;
+
+  public:
+
+    FreeListPool() {
+      free_lists.fill(nullptr);
+    }
+
+    FreeListPool(const FreeListPool&) = delete;
+    FreeListPool& operator=(const FreeListPool&) = delete;
+
+    ~FreeListPool() {
+      for (void* s : slabs) {
+	::operator delete(s);
+      }
+    }
+
+    void* allocate(size_t bytes) {
+      if (bytes > max_pooled_size) {
+	return ::operator new(bytes);
+      }
+
+      const size_t c = size_class(bytes);
+      if (nullptr == free_lists[c]) {
+	add_slab(c);
+      }
+      FreeBlock* b = free_lists[c];
+      free_lists[c] = b->next;
+      return b;
+    }
+
+    void deallocate(void* p, size_t bytes) {
+      if (bytes > max_pooled_size) {
+	::operator delete(p);
+	return;
+      }
+
+      const size_t c = size_class(bytes);
+      FreeBlock* b = static_cast<FreeBlock*>(p);
+      b->next = free_lists[c];
+      free_lists[c] = b;
+    }
+
+    size_t slab_count() const { return slabs.size(); }
+
+  protected:
+
+    static size_t size_class(size_t bytes) {
+      return bytes <= granularity ? 0 : (bytes - 1) / granularity;
+    }
+
+    static size_t block_size(size_t c) {
+      return (c + 1) * granularity;
+    }
+
+    // carves a new slab into blocks for size class c and puts them
+    // on its free list
+    void add_slab(size_t c) {
+      const size_t block = block_size(c);
+      const size_t count = std::max<size_t>(1, slab_size / block);
+      char* slab = static_cast<char*>(::operator new(block * count));
+      slabs.push_back(slab);
+      for (size_t i = count; i > 0; --i) {
+	FreeBlock* b = reinterpret_cast<FreeBlock*>(slab + (i - 1) * block);
+	b->next = free_lists[c];
+	free_lists[c] = b;
+      }
+    }
+  }; // class FreeListPool
+
+
+  /*
+   * A standard allocator that draws from a FreeListPool. It holds a
+   * plain pointer to the pool, so the pool must outlive every
+   * container or shared_ptr that uses a copy of the allocator.
+   */
+  template<typename T>
+  class PoolAllocator {
+
+    static_assert(alignof(T) <= FreeListPool::granularity,
+		  "PoolAllocator does not support over-aligned types");
+
+    template<typename U>
+    friend class PoolAllocator;
+
+    FreeListPool* pool;
+
+  public:
+
+    using value_type = T;
+
+    explicit PoolAllocator(FreeListPool& _pool) :
+      pool(&_pool)
+    {
+      // empty
+    }
+
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>& other) :
+      pool(other.pool)
+    {
+      // empty
+    }
+
+    T* allocate(size_t n) {
+      return static_cast<T*>(pool->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n) {
+      pool->deallocate(p, n * sizeof(T));
+    }
+
+    template<typename U>
+    bool operator==(const PoolAllocator<U>& other) const {
+      return pool == other.pool;
+    }
+
+    template<typename U>
+    bool operator!=(const PoolAllocator<U>& other) const {
+      return pool != other.pool;
+    }
+  }; // class PoolAllocator
+
+} // namespace crimson
@@ -258,6 +258,11 @@ namespace crimson {
       i = end();
     }
 
+    // removes the item using the index it holds
+    void remove(T& item) {
+      remove(item.*heap_info);
+    }
+
     Iterator find(const I& ind_item) {
       for (HeapIndex i = 0; i < count; ++i) {
 	if (data[i] == ind_item) {
@@ -429,8 +434,10 @@ namespace crimson {
       // go up or down the heap; imagine the heap vector contains 0,
       // 10, 100, 20, 30, 200, 300, 40; then 200 is removed, and 40
       // would have to be sifted upwards
-      // sift(i);
-      sift(i);
+      // sift(i); nothing to do if the last element was removed
+      if (i < count) {
+	sift(i);
+      }
     }
 
     // default value of filter parameter to display_sorted
@@ -0,0 +1,350 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+#pragma once
+
+
+#include <memory>
+#include <vector>
+#include <iostream>
+#include <functional>
+#include <algorithm>
+#include <type_traits>
+
+#include "assert.h"
+#include "indirect_intrusive_heap.h"
+
+
+namespace crimson {
+
+  /*
+   * A variant of IndIntruHeap that keeps each element's sort key in
+   * the heap array next to the indirect pointer, so sifting compares
+   * keys in contiguous memory rather than dereferencing every element
+   * it passes. The key is taken from the element when it's pushed and
+   * refreshed only by promote, demote, and adjust, so those must be
+   * called after any change that affects it (as IndIntruHeap already
+   * requires for the heap to stay ordered).
+   *
+   * The template parameters are as for IndIntruHeap, except that C
+   * must also provide a type key_type, a static function
+   * key_type key(const T&), and an operator() that takes two const
+   * key_type& and returns true if the first must precede the second.
+   */
+  template<typename I,
+	   typename T,
+	   IndIntruHeapData T::*heap_info,
+	   typename C,
+	   uint K = 2>
+  class KeyedIndIntruHeap {
+
+    // shorthand
+    using HeapIndex = IndIntruHeapData;
+    using Key = typename C::key_type;
+
+    static_assert(
+      std::is_same<T,typename std::pointer_traits<I>::element_type>::value,
+      "class I must resolve to class T by indirection (pointer dereference)");
+
+    static_assert(
+      std::is_same<bool,
+      typename std::result_of<C(const Key&,const Key&)>::type>::value,
+      "class C must define operator() to take two const key_type& and "
+      "return a bool");
+
+    static_assert(K >= 2, "K (degree of branching) must be at least 2");
+
+    struct Entry {
+      Key key;
+      I   item;
+
+      Entry(const Key& _key, I&& _item) :
+	key(_key),
+	item(std::move(_item))
+      {
+	// empty
+      }
+    };
+
+    template<typename H, typename V>
+    class IteratorBase {
+      friend KeyedIndIntruHeap;
+
+      H*        heap;
+      HeapIndex index;
+
+      IteratorBase(H& _heap, HeapIndex _index) :
+	heap(&_heap),
+	index(_index)
+      {
+	// empty
+      }
+
+    public:
+
+      IteratorBase& operator++() {
+	if (index <= heap->count) {
+	  ++index;
+	}
+	return *this;
+      }
+
+      bool operator==(const IteratorBase& other) const {
+	return heap == other.heap && index == other.index;
+      }
+
+      bool operator!=(const IteratorBase& other) const {
+	return !(*this == other);
+      }
+
+      V& operator*() const {
+	return *heap->data[index].item;
+      }
+
+      V* operator->() const {
+	return &(*heap->data[index].item);
+      }
+    }; // class IteratorBase
+
+  public:
+
+    using Iterator = IteratorBase<KeyedIndIntruHeap, T>;
+    using ConstIterator = IteratorBase<const KeyedIndIntruHeap, const T>;
+
+  protected:
+
+    std::vector<Entry> data;
+    HeapIndex          count;
+    C                  comparator;
+
+  public:
+
+    KeyedIndIntruHeap() :
+      count(0)
+    {
+      // empty
+    }
+
+    bool empty() const { return 0 == count; }
+
+    size_t size() const { return (size_t) count; }
+
+    T& top() { return *data[0].item; }
+
+    const T& top() const { return *data[0].item; }
+
+    I& top_ind() { return data[0].item; }
+
+    const I& top_ind() const { return data[0].item; }
+
+    void push(I&& item) {
+      HeapIndex i = count++;
+      intru_data_of(item) = i;
+      const Key key = C::key(*item);
+      data.emplace_back(key, std::move(item));
+      sift_up(i);
+    }
+
+    void push(const I& item) {
+      I copy(item);
+      push(std::move(copy));
+    }
+
+    void pop() {
+      remove(HeapIndex(0));
+    }
+
+    void remove(Iterator& i) {
+      remove(i.index);
+      i = end();
+    }
+
+    // removes the item using the index it holds
+    void remove(T& item) {
+      remove(item.*heap_info);
+    }
+
+    Iterator find(const I& ind_item) {
+      for (HeapIndex i = 0; i < count; ++i) {
+	if (data[i].item == ind_item) {
+	  return Iterator(*this, i);
+	}
+      }
+      return end();
+    }
+
+    // reverse find -- start looking from bottom of heap
+    Iterator rfind(const I& ind_item) {
+      for (HeapIndex i = count; i > 0; --i) {
+	if (data[i-1].item == ind_item) {
+	  return Iterator(*this, i-1);
+	}
+      }
+      return end();
+    }
+
+    void promote(T& item) {
+      const HeapIndex i = item.*heap_info;
+      data[i].key = C::key(item);
+      sift_up(i);
+    }
+
+    void demote(T& item) {
+      const HeapIndex i = item.*heap_info;
+      data[i].key = C::key(item);
+      sift_down(i);
+    }
+
+    void adjust(T& item) {
+      const HeapIndex i = item.*heap_info;
+      data[i].key = C::key(item);
+      sift(i);
+    }
+
+    Iterator begin() {
+      return Iterator(*this, 0);
+    }
+
+    Iterator end() {
+      return Iterator(*this, count);
+    }
+
+    ConstIterator cbegin() const {
+      return ConstIterator(*this, 0);
+    }
+
+    ConstIterator cend() const {
+      return ConstIterator(*this, count);
+    }
+
+    // copies the heap into a vector and sorts it by key before
+    // displaying it
+    std::ostream&
+    display_sorted(std::ostream& out,
+		   std::function<bool(const T&)> filter = all_filter) const {
+      std::vector<const Entry*> sorted;
+      for (HeapIndex i = 0; i < count; ++i) {
+	sorted.push_back(&data[i]);
+      }
+      std::sort(sorted.begin(), sorted.end(),
+		[this] (const Entry* first, const Entry* second) -> bool {
+		  return this->comparator(first->key, second->key);
+		});
+
+      bool first = true;
+      for (auto e : sorted) {
+	if (filter(*e->item)) {
+	  if (!first) {
+	    out << ", ";
+	  } else {
+	    first = false;
+	  }
+	  out << *e->item;
+	}
+      }
+
+      return out;
+    }
+
+  protected:
+
+    static IndIntruHeapData& intru_data_of(I& item) {
+      return (*item).*heap_info;
+    }
+
+    void remove(HeapIndex i) {
+      std::swap(data[i], data[--count]);
+      intru_data_of(data[i].item) = i;
+      data.pop_back();
+
+      // as in IndIntruHeap, the element moved into the hole may have
+      // to go either up or down
+      if (i < count) {
+	sift(i);
+      }
+    }
+
+    // default value of filter parameter to display_sorted
+    static bool all_filter(const T& data) { return true; }
+
+    static inline HeapIndex parent(HeapIndex i) {
+      assert(0 != i);
+      return (i - 1) / K;
+    }
+
+    // index of left-most child
+    static inline HeapIndex lhs(HeapIndex i) { return K*i + 1; }
+
+    // moves the entry at i up into place, shifting the entries it
+    // passes down one level rather than swapping at each step
+    void sift_up(HeapIndex i) {
+      if (0 == i) return;
+      Entry moving(std::move(data[i]));
+      while (i > 0) {
+	const HeapIndex pi = parent(i);
+	if (!comparator(moving.key, data[pi].key)) {
+	  break;
+	}
+	data[i] = std::move(data[pi]);
+	intru_data_of(data[i].item) = i;
+	i = pi;
+      }
+      data[i] = std::move(moving);
+      intru_data_of(data[i].item) = i;
+    } // sift_up
+
+    // moves the entry at i down into place, shifting the entries it
+    // passes up one level
+    void sift_down(HeapIndex i) {
+      if (i >= count) return;
+      Entry moving(std::move(data[i]));
+      while (true) {
+	const HeapIndex li = lhs(i);
+	if (li >= count) break;
+
+	// find the index of min. child
+	const HeapIndex ri = std::min(li + K - 1, count - 1);
+	HeapIndex min_i = li;
+	for (HeapIndex k = li + 1; k <= ri; ++k) {
+	  if (comparator(data[k].key, data[min_i].key)) {
+	    min_i = k;
+	  }
+	}
+
+	if (!comparator(data[min_i].key, moving.key)) {
+	  // no child is smaller
+	  break;
+	}
+	data[i] = std::move(data[min_i]);
+	intru_data_of(data[i].item) = i;
+	i = min_i;
+      }
+      data[i] = std::move(moving);
+      intru_data_of(data[i].item) = i;
+    } // sift_down
+
+    void sift(HeapIndex i) {
+      if (i == 0) {
+	// if we're at top, can only go down
+	sift_down(i);
+      } else if (comparator(data[i].key, data[parent(i)].key)) {
+	// if we can go up, we will
+	sift_up(i);
+      } else {
+	// otherwise we'll try to go down
+	sift_down(i);
+      }
+    } // sift
+  }; // class KeyedIndIntruHeap
+
+} // namespace crimson
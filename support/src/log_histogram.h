@@ -0,0 +1,138 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <algorithm>
+#include <ostream>
+
+#include "assert.h"
+
+
+namespace crimson {
+
+  /*
+   * Counts unsigned values in power-of-two buckets. Bucket 0 holds
+   * 0 and bucket i holds [2^(i-1), 2^i); the last bucket also holds
+   * anything larger. Adding a value is a count-leading-zeros and an
+   * increment, so it is cheap enough to do on every request, at the
+   * cost of percentiles that are only good to within a factor of
+   * two.
+   */
+  template<size_t B = 32>
+  class LogHistogram {
+    static_assert(B >= 2 && B <= 65, "bucket count must be in [2, 65]");
+
+    std::array<uint64_t,B> counts;
+    uint64_t               total = 0;
+    uint64_t               sum = 0;
+    uint64_t               max_value = 0;
+
+  public:
+
+    static constexpr size_t bucket_count = B;
+
+    LogHistogram() {
+      counts.fill(0);
+    }
+
+    static size_t bucket_of(uint64_t value) {
+      if (0 == value) {
+	return 0;
+      }
+      const size_t b = 64 - __builtin_clzll(value);
+      return std::min(b, B - 1);
+    }
+
+    // the smallest value counted in bucket i
+    static uint64_t bucket_low(size_t i) {
+      return 0 == i ? 0 : uint64_t(1) << (i - 1);
+    }
+
+    // the largest value counted in bucket i, except for the last
+    // bucket, which has no upper bound
+    static uint64_t bucket_high(size_t i) {
+      return 0 == i ? 0 : bucket_low(i) * 2 - 1;
+    }
+
+    void add(uint64_t value) {
+      ++counts[bucket_of(value)];
+      ++total;
+      sum += value;
+      max_value = std::max(max_value, value);
+    }
+
+    void merge(const LogHistogram& other) {
+      for (size_t i = 0; i < B; ++i) {
+	counts[i] += other.counts[i];
+      }
+      total += other.total;
+      sum += other.sum;
+      max_value = std::max(max_value, other.max_value);
+    }
+
+    void clear() {
+      counts.fill(0);
+      total = 0;
+      sum = 0;
+      max_value = 0;
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t count(size_t bucket) const { return counts[bucket]; }
+    uint64_t max() const { return max_value; }
+
+    double mean() const {
+      return 0 == total ? 0.0 : double(sum) / total;
+    }
+
+    // an upper bound on the value below which the fraction p (in
+    // [0, 1]) of the values fall: the top of the bucket holding
+    // that value, or the largest value seen if that is lower
+    uint64_t percentile(double p) const {
+      assert(p >= 0.0 && p <= 1.0);
+      if (0 == total) {
+	return 0;
+      }
+      const uint64_t rank = std::max<uint64_t>(1, uint64_t(p * total + 0.5));
+      uint64_t seen = 0;
+      for (size_t i = 0; i < B - 1; ++i) {
+	seen += counts[i];
+	if (seen >= rank) {
+	  return std::min(bucket_high(i), max_value);
+	}
+      }
+      return max_value;
+    }
+
+    friend std::ostream& operator<<(std::ostream& out,
+				    const LogHistogram& h) {
+      out << "{ count:" << h.total << " mean:" << h.mean() <<
+	" max:" << h.max_value << " buckets:";
+      bool first = true;
+      for (size_t i = 0; i < B; ++i) {
+	if (0 == h.counts[i]) continue;
+	out << (first ? " " : ", ") << "[" << bucket_low(i) << "]:" <<
+	  h.counts[i];
+	first = false;
+      }
+      out << " }";
+      return out;
+    }
+  }; // class LogHistogram
+
+} // namespace crimson
@@ -0,0 +1,185 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <type_traits>
+
+
+namespace crimson {
+
+  /*
+   * A bounded, lock-free queue for many producers and a single
+   * consumer. Each slot carries a sequence number that tells
+   * producers whether it is free and the consumer whether it has
+   * been filled (after D. Vyukov's bounded queue), so producers only
+   * contend with one another on a single atomic increment and never
+   * wait on the consumer.
+   *
+   * try_push fails rather than waits when the ring is full. Only one
+   * thread at a time may consume.
+   *
+   * T must be move constructible.
+   */
+  template<typename T>
+  class MpscRing {
+
+    using Storage =
+      typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+    struct Slot {
+      std::atomic<size_t> seq;
+      Storage             data;
+    };
+
+    // padding keeps the producers' and consumer's positions on
+    // separate cache lines
+    static constexpr size_t cache_line = 64;
+
+    std::unique_ptr<Slot[]> slots;
+    const size_t            mask;
+
+    char                    pad1[cache_line];
+    std::atomic<size_t>     tail; // next slot to fill
+    char                    pad2[cache_line];
+    std::atomic<size_t>     head; // next slot to consume
+
+  public:
+
+    // capacity is rounded up to a power of two
+    explicit MpscRing(size_t capacity) :
+      slots(new Slot[round_up(capacity)]),
+      mask(round_up(capacity) - 1),
+      tail(0),
+      head(0)
+    {
+      for (size_t i = 0; i <= mask; ++i) {
+	slots[i].seq.store(i, std::memory_order_relaxed);
+      }
+    }
+
+    MpscRing(const MpscRing&) = delete;
+    MpscRing& operator=(const MpscRing&) = delete;
+
+    // no producer may still be pushing
+    ~MpscRing() {
+      consume([] (T&&) { /* discard */ });
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+    // only a snapshot when other threads are pushing or consuming
+    size_t size() const {
+      size_t t = tail.load(std::memory_order_acquire);
+      size_t h = head.load(std::memory_order_acquire);
+      return t - h;
+    }
+
+    // only a snapshot when other threads are pushing or consuming
+    bool empty() const { return 0 == size(); }
+
+    // Returns the position of the next slot to be claimed; once
+    // consumed_to is true of it, every item whose push started
+    // before this call has been consumed.
+    size_t push_position() const {
+      return tail.load(std::memory_order_acquire);
+    }
+
+    // true once consume has passed position pos
+    bool consumed_to(size_t pos) const {
+      return intptr_t(head.load(std::memory_order_acquire) - pos) >= 0;
+    }
+
+    // item is moved from only if the push succeeds; returns false if
+    // the ring is full
+    bool try_push(T& item) {
+      size_t pos = tail.load(std::memory_order_relaxed);
+      Slot* slot;
+      while (true) {
+	slot = &slots[pos & mask];
+	size_t seq = slot->seq.load(std::memory_order_acquire);
+	intptr_t diff = intptr_t(seq) - intptr_t(pos);
+	if (0 == diff) {
+	  if (tail.compare_exchange_weak(pos, pos + 1,
+					 std::memory_order_relaxed)) {
+	    break;
+	  }
+	} else if (diff < 0) {
+	  return false;
+	} else {
+	  pos = tail.load(std::memory_order_relaxed);
+	}
+      }
+
+      new (&slot->data) T(std::move(item));
+      slot->seq.store(pos + 1, std::memory_order_release);
+      return true;
+    }
+
+    // Passes the items pushed before the call, in order, to f as an
+    // rvalue, and returns the number consumed. Stops, without
+    // waiting, at the first slot a producer has claimed but not yet
+    // filled; it and everything after it are left for the next call,
+    // which the producer should arrange once its push returns. Items
+    // pushed during the call may or may not be consumed, but no more
+    // than capacity() items are consumed per call. If f throws, the
+    // item it was passed is still destroyed and its slot released
+    // before the exception propagates, so the ring stays usable.
+    template<typename F>
+    size_t consume(F&& f) {
+      // destroys the item and hands its slot back to the producers
+      // however f exits
+      struct Release {
+	MpscRing& ring;
+	Slot&     slot;
+	size_t    pos;
+
+	~Release() {
+	  reinterpret_cast<T*>(&slot.data)->~T();
+	  slot.seq.store(pos + ring.mask + 1, std::memory_order_release);
+	  ring.head.store(pos + 1, std::memory_order_release);
+	}
+      };
+
+      const size_t h = head.load(std::memory_order_relaxed);
+      const size_t end = tail.load(std::memory_order_acquire);
+      size_t pos = h;
+      for (; pos != end; ++pos) {
+	Slot& slot = slots[pos & mask];
+	if (slot.seq.load(std::memory_order_acquire) != pos + 1) {
+	  break;
+	}
+	Release release{*this, slot, pos};
+	f(std::move(*reinterpret_cast<T*>(&slot.data)));
+      }
+      return pos - h;
+    }
+
+  protected:
+
+    static size_t round_up(size_t n) {
+      size_t result = 1;
+      while (result < n) {
+	result <<= 1;
+      }
+      return result;
+    }
+  }; // class MpscRing
+
+} // namespace crimson
@@ -0,0 +1,348 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+#pragma once
+
+
+#include <vector>
+#include <utility>
+#include <functional>
+#include <stdexcept>
+#include <cstdint>
+
+#include "assert.h"
+
+
+namespace crimson {
+
+  /*
+   * A hash map that uses open addressing with linear probing, so
+   * entries live in one contiguous vector and a lookup usually
+   * touches a single cache line rather than chasing tree or bucket
+   * pointers.
+   *
+   * Erased entries leave a tombstone behind rather than shifting
+   * their neighbors, so erasing through an iterator does not disturb
+   * the positions of any other entries; this allows the idiom of
+   * advancing an iterator and then erasing the previous position.
+   * Tombstones are reclaimed when the table is rehashed.
+   *
+   * Iterators are invalidated by insertion (which may rehash) but
+   * not by erasure. The key of an entry must not be modified through
+   * an iterator.
+   *
+   * K is the key type, V the mapped type; both must be default
+   * constructible. H is the hash functor and E the equality functor.
+   */
+  template<typename K,
+	   typename V,
+	   typename H = std::hash<K>,
+	   typename E = std::equal_to<K>>
+  class OpenHashMap {
+
+  public:
+
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<K,V>;
+    using size_type = size_t;
+
+  protected:
+
+    enum class SlotState : uint8_t { empty, full, erased };
+
+    struct Slot {
+      SlotState  state = SlotState::empty;
+      value_type kv;
+    };
+
+    template<typename M, typename T>
+    class IteratorBase {
+      friend OpenHashMap;
+
+      M*     map;
+      size_t index;
+
+      IteratorBase(M* _map, size_t _index) :
+	map(_map),
+	index(_index)
+      {
+	skip_unused();
+      }
+
+      void skip_unused() {
+	while (index < map->slots.size() &&
+	       SlotState::full != map->slots[index].state) {
+	  ++index;
+	}
+      }
+
+    public:
+
+      IteratorBase() :
+	map(nullptr),
+	index(0)
+      {
+	// empty
+      }
+
+      // allows conversion from iterator to const_iterator
+      template<typename M2, typename T2>
+      IteratorBase(const IteratorBase<M2,T2>& other) :
+	map(other.map),
+	index(other.index)
+      {
+	// empty
+      }
+
+      IteratorBase& operator++() {
+	++index;
+	skip_unused();
+	return *this;
+      }
+
+      IteratorBase operator++(int) {
+	IteratorBase result(*this);
+	++(*this);
+	return result;
+      }
+
+      bool operator==(const IteratorBase& other) const {
+	return map == other.map && index == other.index;
+      }
+
+      bool operator!=(const IteratorBase& other) const {
+	return !(*this == other);
+      }
+
+      T& operator*() const {
+	return map->slots[index].kv;
+      }
+
+      T* operator->() const {
+	return &map->slots[index].kv;
+      }
+
+      template<typename M2, typename T2>
+      friend class IteratorBase;
+    }; // class IteratorBase
+
+  public:
+
+    using iterator = IteratorBase<OpenHashMap, value_type>;
+    using const_iterator = IteratorBase<const OpenHashMap, const value_type>;
+
+  protected:
+
+    // capacity is always zero or a power of two
+    static constexpr size_t min_capacity = 16;
+
+    std::vector<Slot> slots;
+    size_t            full = 0;     // live entries
+    size_t            erased = 0;   // tombstones
+    H                 hasher;
+    E                 equal;
+
+  public:
+
+    OpenHashMap() {
+      // empty
+    }
+
+    bool empty() const { return 0 == full; }
+
+    size_t size() const { return full; }
+
+    size_t capacity() const { return slots.size(); }
+
+    iterator begin() { return iterator(this, 0); }
+
+    iterator end() { return iterator(this, slots.size()); }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+
+    const_iterator end() const { return const_iterator(this, slots.size()); }
+
+    const_iterator cbegin() const { return begin(); }
+
+    const_iterator cend() const { return end(); }
+
+    iterator find(const K& key) {
+      size_t i = find_index(key);
+      return i < slots.size() ? iterator(this, i) : end();
+    }
+
+    const_iterator find(const K& key) const {
+      size_t i = find_index(key);
+      return i < slots.size() ? const_iterator(this, i) : end();
+    }
+
+    size_t count(const K& key) const {
+      return find_index(key) < slots.size() ? 1 : 0;
+    }
+
+    V& at(const K& key) {
+      size_t i = find_index(key);
+      if (i >= slots.size()) {
+	throw std::out_of_range("OpenHashMap::at");
+      }
+      return slots[i].kv.second;
+    }
+
+    const V& at(const K& key) const {
+      size_t i = find_index(key);
+      if (i >= slots.size()) {
+	throw std::out_of_range("OpenHashMap::at");
+      }
+      return slots[i].kv.second;
+    }
+
+    V& operator[](const K& key) {
+      return insert_index(key).first->kv.second;
+    }
+
+    std::pair<iterator,bool> emplace(const K& key, V&& value) {
+      auto r = insert_index(key);
+      if (r.second) {
+	r.first->kv.second = std::move(value);
+      }
+      return std::make_pair(iterator(this, r.first - slots.data()), r.second);
+    }
+
+    std::pair<iterator,bool> emplace(const K& key, const V& value) {
+      V copy(value);
+      return emplace(key, std::move(copy));
+    }
+
+    // returns iterator to the entry following the one erased
+    iterator erase(const_iterator pos) {
+      assert(pos.map == this && pos.index < slots.size());
+      erase_slot(slots[pos.index]);
+      return ++iterator(this, pos.index);
+    }
+
+    size_t erase(const K& key) {
+      size_t i = find_index(key);
+      if (i >= slots.size()) {
+	return 0;
+      }
+      erase_slot(slots[i]);
+      return 1;
+    }
+
+    void clear() {
+      slots.clear();
+      full = 0;
+      erased = 0;
+    }
+
+    // makes room for at least n entries without rehashing
+    void reserve(size_t n) {
+      size_t needed = min_capacity;
+      while (too_full(n, needed)) {
+	needed *= 2;
+      }
+      if (needed > slots.size()) {
+	rehash(needed);
+      }
+    }
+
+  protected:
+
+    // keep the load (including tombstones) at or below 3/4
+    static bool too_full(size_t used, size_t cap) {
+      return 4 * used > 3 * cap;
+    }
+
+    // Fibonacci hashing spreads identity hashes of small or regularly
+    // spaced integers across the table
+    size_t home_index(const K& key, size_t mask) const {
+      uint64_t h = uint64_t(hasher(key)) * 0x9E3779B97F4A7C15ull;
+      return size_t(h ^ (h >> 32)) & mask;
+    }
+
+    size_t find_index(const K& key) const {
+      if (slots.empty()) {
+	return slots.size();
+      }
+      const size_t mask = slots.size() - 1;
+      for (size_t i = home_index(key, mask); ; i = (i + 1) & mask) {
+	const Slot& s = slots[i];
+	if (SlotState::empty == s.state) {
+	  return slots.size();
+	} else if (SlotState::full == s.state && equal(s.kv.first, key)) {
+	  return i;
+	}
+      }
+    }
+
+    // returns the slot holding key, inserting a default-constructed
+    // value if needed; second is true if an insertion happened
+    std::pair<Slot*,bool> insert_index(const K& key) {
+      size_t i = find_index(key);
+      if (i < slots.size()) {
+	return std::make_pair(&slots[i], false);
+      }
+
+      if (slots.empty()) {
+	rehash(min_capacity);
+      } else if (too_full(full + erased + 1, slots.size())) {
+	// only grow if the live entries need it; otherwise the rehash
+	// just clears out tombstones
+	rehash(too_full(2 * (full + 1), slots.size()) ?
+	       2 * slots.size() : slots.size());
+      }
+
+      const size_t mask = slots.size() - 1;
+      for (i = home_index(key, mask); ; i = (i + 1) & mask) {
+	Slot& s = slots[i];
+	if (SlotState::full != s.state) {
+	  if (SlotState::erased == s.state) {
+	    --erased;
+	  }
+	  s.state = SlotState::full;
+	  s.kv.first = key;
+	  ++full;
+	  return std::make_pair(&s, true);
+	}
+      }
+    }
+
+    void erase_slot(Slot& s) {
+      assert(SlotState::full == s.state);
+      s.state = SlotState::erased;
+      // release whatever the value holds now rather than at rehash
+      s.kv = value_type();
+      --full;
+      ++erased;
+    }
+
+    void rehash(size_t new_capacity) {
+      std::vector<Slot> old_slots(new_capacity);
+      std::swap(slots, old_slots);
+      erased = 0;
+      const size_t mask = slots.size() - 1;
+      for (auto& o : old_slots) {
+	if (SlotState::full != o.state) continue;
+	for (size_t i = home_index(o.kv.first, mask); ; i = (i + 1) & mask) {
+	  if (SlotState::empty == slots[i].state) {
+	    slots[i].state = SlotState::full;
+	    slots[i].kv = std::move(o.kv);
+	    break;
+	  }
+	}
+      }
+    }
+  }; // class OpenHashMap
+
+} // namespace crimson
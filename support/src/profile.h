@@ -16,8 +16,14 @@
 #pragma once
 
 
+#include <assert.h>
+
 #include <cmath>
 #include <chrono>
+#include <atomic>
+#include <limits>
+#include <vector>
+#include <algorithm>
 
 
 namespace crimson {
@@ -88,7 +94,7 @@ namespace crimson {
 	this->high = duration_count;
       } else {
 	if (duration_count < this->low) this->low = duration_count;
-	else if (duration_count > this->high) this->high = duration_count;
+	if (duration_count > this->high) this->high = duration_count;
       }
       ++this->count;
       is_timing = false;
@@ -106,16 +112,211 @@ namespace crimson {
     ProfileCombiner() {}
 
     void combine(const ProfileTimer<T>& timer) {
-      if (0 == this->count) {
+      if (0 == timer.count) {
+	return;
+      } else if (0 == this->count) {
 	this->low = timer.low;
 	this->high = timer.high;
       } else {
+	// a timer's low and high can both extend the range
 	if (timer.low < this->low) this->low = timer.low;
-	else if (timer.high > this->high) this->high = timer.high;
+	if (timer.high > this->high) this->high = timer.high;
       }
       this->count += timer.count;
       this->sum += timer.sum;
       this->sum_squares += timer.sum_squares;
     }
   }; // class ProfileCombiner
+
+
+  /*
+   * A timer that keeps a log-linear histogram of its durations (as
+   * HdrHistogram does), so it can report tail latencies as well as
+   * the mean. Each power of two is split into 2^SubBits buckets, so
+   * a percentile is within 1/2^SubBits of the true value.
+   *
+   * Unlike ProfileTimer it may be used from many threads at once:
+   * start returns the time rather than keeping it, and each thread
+   * records into one of Shards sets of counters with relaxed atomic
+   * adds, so threads rarely share a cache line. snapshot sums the
+   * shards without stopping the recorders, and Snapshot::combine
+   * merges the timers of several queues.
+   */
+  template<typename T, uint SubBits = 3, uint Shards = 8>
+  class ProfileHistogram {
+
+  public:
+
+    using clock = std::chrono::steady_clock;
+    using rep = typename T::rep;
+
+    static constexpr uint sub_count = 1u << SubBits;
+    static constexpr uint bucket_count = (65 - SubBits) << SubBits;
+
+    static uint bucket_of(uint64_t value) {
+      if (value < 2 * sub_count) {
+	return uint(value);
+      }
+      const uint msb = 63 - __builtin_clzll(value);
+      const uint shift = msb - SubBits;
+      return ((shift + 1) << SubBits) |
+	uint((value >> shift) & (sub_count - 1));
+    }
+
+    // the smallest value counted in the bucket
+    static uint64_t bucket_low(uint bucket) {
+      const uint octave = bucket >> SubBits;
+      const uint64_t sub = bucket & (sub_count - 1);
+      if (0 == octave) {
+	return sub;
+      }
+      return (sub_count + sub) << (octave - 1);
+    }
+
+    // the largest value counted in the bucket
+    static uint64_t bucket_high(uint bucket) {
+      return bucket + 1 < bucket_count ?
+	bucket_low(bucket + 1) - 1 :
+	std::numeric_limits<uint64_t>::max();
+    }
+
+
+    class Snapshot {
+      friend ProfileHistogram;
+
+      std::vector<uint64_t> counts;
+      uint64_t count = 0;
+      uint64_t sum = 0;
+      uint64_t low = std::numeric_limits<uint64_t>::max();
+      uint64_t high = 0;
+
+    public:
+
+      Snapshot() : counts(bucket_count, 0) {}
+
+      void combine(const Snapshot& other) {
+	for (uint i = 0; i < bucket_count; ++i) {
+	  counts[i] += other.counts[i];
+	}
+	count += other.count;
+	sum += other.sum;
+	low = std::min(low, other.low);
+	high = std::max(high, other.high);
+      }
+
+      void combine(const ProfileHistogram& timer) {
+	combine(timer.snapshot());
+      }
+
+      uint64_t get_count() const { return count; }
+      uint64_t get_sum() const { return sum; }
+      uint64_t get_low() const { return 0 == count ? 0 : low; }
+      uint64_t get_high() const { return high; }
+      double get_mean() const {
+	if (0 == count) return nan("");
+	return sum / double(count);
+      }
+
+      // the duration that the fraction p (in [0, 1]) of the
+      // recorded ones did not exceed, to within a bucket
+      uint64_t get_percentile(double p) const {
+	assert(p >= 0.0 && p <= 1.0);
+	if (0 == count) {
+	  return 0;
+	}
+	const uint64_t rank = std::max<uint64_t>(1, uint64_t(p * count + 0.5));
+	uint64_t seen = 0;
+	for (uint i = 0; i < bucket_count; ++i) {
+	  seen += counts[i];
+	  if (seen >= rank) {
+	    return std::max(get_low(), std::min(bucket_high(i), high));
+	  }
+	}
+	return high;
+      }
+    }; // class Snapshot
+
+  private:
+
+    struct Shard {
+      std::atomic<uint64_t> sum;
+      std::atomic<uint64_t> low;
+      std::atomic<uint64_t> high;
+      std::atomic<uint64_t> counts[bucket_count];
+    };
+
+    Shard shards[Shards];
+
+    // threads are given shards round-robin as they first record
+    static uint thread_shard() {
+      static std::atomic<uint> next(0);
+      thread_local const uint mine = next++ % Shards;
+      return mine;
+    }
+
+  public:
+
+    ProfileHistogram() {
+      for (auto& s : shards) {
+	s.sum = 0;
+	s.low = std::numeric_limits<uint64_t>::max();
+	s.high = 0;
+	for (auto& c : s.counts) {
+	  c = 0;
+	}
+      }
+    }
+
+    ProfileHistogram(const ProfileHistogram&) = delete;
+    ProfileHistogram& operator=(const ProfileHistogram&) = delete;
+
+    clock::time_point start() const {
+      return clock::now();
+    }
+
+    void stop(clock::time_point start_time) {
+      const rep duration =
+	std::chrono::duration_cast<T>(clock::now() - start_time).count();
+      record(duration > 0 ? uint64_t(duration) : 0);
+    }
+
+    void record(uint64_t value) {
+      Shard& s = shards[thread_shard()];
+      s.counts[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+      s.sum.fetch_add(value, std::memory_order_relaxed);
+
+      // the extremes rarely change, so read before trying to write
+      uint64_t cur = s.low.load(std::memory_order_relaxed);
+      while (value < cur &&
+	     !s.low.compare_exchange_weak(cur, value,
+					  std::memory_order_relaxed)) {
+	// cur reloaded
+      }
+      cur = s.high.load(std::memory_order_relaxed);
+      while (value > cur &&
+	     !s.high.compare_exchange_weak(cur, value,
+					   std::memory_order_relaxed)) {
+	// cur reloaded
+      }
+    }
+
+    // recording may continue while this runs, so the totals may
+    // include part of a concurrent record
+    Snapshot snapshot() const {
+      Snapshot result;
+      for (const auto& s : shards) {
+	for (uint i = 0; i < bucket_count; ++i) {
+	  const uint64_t c = s.counts[i].load(std::memory_order_relaxed);
+	  result.counts[i] += c;
+	  result.count += c;
+	}
+	result.sum += s.sum.load(std::memory_order_relaxed);
+	result.low = std::min(result.low,
+			      s.low.load(std::memory_order_relaxed));
+	result.high = std::max(result.high,
+			       s.high.load(std::memory_order_relaxed));
+      }
+      return result;
+    }
+  }; // class ProfileHistogram
 } // namespace crimson
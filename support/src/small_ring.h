@@ -0,0 +1,332 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <memory>
+#include <iterator>
+#include <utility>
+#include <type_traits>
+
+#include "assert.h"
+
+
+namespace crimson {
+
+  /*
+   * A double-ended queue that keeps its first N elements in storage
+   * inside the object itself and only allocates once more are
+   * needed, at which point the elements move to a ring buffer that
+   * doubles in size as required. When the queue drains, the buffer
+   * is released and the inline storage is used again. This suits
+   * queues that are usually short, where std::deque's up-front
+   * allocations dominate the memory use.
+   *
+   * Supports pushing at the back, popping at the front, and erasing
+   * anywhere (which shifts the elements on the shorter side of the
+   * erased one). Iterators are invalidated by any modification other
+   * than erase, which returns a valid iterator to the following
+   * element.
+   *
+   * T is the element type and must be move constructible and move
+   * assignable; N is the inline capacity and must be a power of two;
+   * A is the allocator used once the inline capacity is exceeded.
+   */
+  template<typename T, size_t N, typename A = std::allocator<T>>
+  class SmallRing {
+
+    static_assert(N > 0 && 0 == (N & (N - 1)),
+		  "SmallRing inline capacity must be a power of two");
+
+    using AllocTraits = std::allocator_traits<A>;
+
+  public:
+
+    using value_type = T;
+    using size_type = size_t;
+    using allocator_type = A;
+
+  protected:
+
+    template<typename Q, typename V>
+    class IteratorBase {
+      friend SmallRing;
+
+      Q*     ring;
+      size_t index; // logical position; 0 is the front
+
+      IteratorBase(Q* _ring, size_t _index) :
+	ring(_ring),
+	index(_index)
+      {
+	// empty
+      }
+
+    public:
+
+      using iterator_category = std::bidirectional_iterator_tag;
+      using value_type = typename std::remove_const<V>::type;
+      using difference_type = std::ptrdiff_t;
+      using pointer = V*;
+      using reference = V&;
+
+      IteratorBase() :
+	ring(nullptr),
+	index(0)
+      {
+	// empty
+      }
+
+      // allows conversion from iterator to const_iterator
+      template<typename Q2, typename V2>
+      IteratorBase(const IteratorBase<Q2,V2>& other) :
+	ring(other.ring),
+	index(other.index)
+      {
+	// empty
+      }
+
+      IteratorBase& operator++() {
+	++index;
+	return *this;
+      }
+
+      IteratorBase operator++(int) {
+	IteratorBase result(*this);
+	++index;
+	return result;
+      }
+
+      IteratorBase& operator--() {
+	--index;
+	return *this;
+      }
+
+      IteratorBase operator--(int) {
+	IteratorBase result(*this);
+	--index;
+	return result;
+      }
+
+      bool operator==(const IteratorBase& other) const {
+	return ring == other.ring && index == other.index;
+      }
+
+      bool operator!=(const IteratorBase& other) const {
+	return !(*this == other);
+      }
+
+      V& operator*() const {
+	return ring->at_index(index);
+      }
+
+      V* operator->() const {
+	return &ring->at_index(index);
+      }
+
+      template<typename Q2, typename V2>
+      friend class IteratorBase;
+    }; // class IteratorBase
+
+  public:
+
+    using iterator = IteratorBase<SmallRing, T>;
+    using const_iterator = IteratorBase<const SmallRing, const T>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  protected:
+
+    using Storage =
+      typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+    A       alloc;
+    T*      buf;
+    size_t  mask;   // capacity - 1
+    size_t  head;   // physical position of the front
+    size_t  count;
+    Storage inline_buf[N];
+
+  public:
+
+    explicit SmallRing(const A& _alloc = A()) :
+      alloc(_alloc),
+      buf(reinterpret_cast<T*>(inline_buf)),
+      mask(N - 1),
+      head(0),
+      count(0)
+    {
+      // empty
+    }
+
+    SmallRing(const SmallRing&) = delete;
+    SmallRing& operator=(const SmallRing&) = delete;
+
+    ~SmallRing() {
+      clear();
+    }
+
+    bool empty() const { return 0 == count; }
+
+    size_t size() const { return count; }
+
+    size_t capacity() const { return mask + 1; }
+
+    // true if the elements are held in the inline storage
+    bool is_inline() const {
+      return buf == reinterpret_cast<const T*>(inline_buf);
+    }
+
+    T& front() {
+      assert(count > 0);
+      return buf[head];
+    }
+
+    const T& front() const {
+      assert(count > 0);
+      return buf[head];
+    }
+
+    T& back() {
+      assert(count > 0);
+      return at_index(count - 1);
+    }
+
+    const T& back() const {
+      assert(count > 0);
+      return at_index(count - 1);
+    }
+
+    template<typename... Args>
+    void emplace_back(Args&&... args) {
+      if (count > mask) {
+	grow();
+      }
+      new (&buf[(head + count) & mask]) T(std::forward<Args>(args)...);
+      ++count;
+    }
+
+    void push_back(T&& item) {
+      emplace_back(std::move(item));
+    }
+
+    void pop_front() {
+      assert(count > 0);
+      buf[head].~T();
+      head = (head + 1) & mask;
+      --count;
+      if (0 == count) {
+	reset();
+      }
+    }
+
+    // removes the element at pos, shifting whichever side of it is
+    // shorter to close the gap (as std::deque does), so erasing at
+    // either end is constant time; returns an iterator to the element
+    // that followed
+    iterator erase(const_iterator pos) {
+      assert(pos.ring == this && pos.index < count);
+      if (pos.index < count - 1 - pos.index) {
+	for (size_t i = pos.index; i > 0; --i) {
+	  at_index(i) = std::move(at_index(i - 1));
+	}
+	buf[head].~T();
+	head = (head + 1) & mask;
+      } else {
+	for (size_t i = pos.index + 1; i < count; ++i) {
+	  at_index(i - 1) = std::move(at_index(i));
+	}
+	at_index(count - 1).~T();
+      }
+      --count;
+      if (0 == count) {
+	reset();
+      }
+      return iterator(this, pos.index);
+    }
+
+    void clear() {
+      for (size_t i = 0; i < count; ++i) {
+	at_index(i).~T();
+      }
+      count = 0;
+      reset();
+    }
+
+    iterator begin() { return iterator(this, 0); }
+
+    iterator end() { return iterator(this, count); }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+
+    const_iterator end() const { return const_iterator(this, count); }
+
+    const_iterator cbegin() const { return begin(); }
+
+    const_iterator cend() const { return end(); }
+
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+
+    const_reverse_iterator rbegin() const {
+      return const_reverse_iterator(end());
+    }
+
+    const_reverse_iterator rend() const {
+      return const_reverse_iterator(begin());
+    }
+
+  protected:
+
+    T& at_index(size_t i) {
+      return buf[(head + i) & mask];
+    }
+
+    const T& at_index(size_t i) const {
+      return buf[(head + i) & mask];
+    }
+
+    // moves the elements, in order, to a buffer of twice the capacity
+    void grow() {
+      const size_t new_cap = 2 * (mask + 1);
+      T* new_buf = AllocTraits::allocate(alloc, new_cap);
+      for (size_t i = 0; i < count; ++i) {
+	T& item = at_index(i);
+	new (&new_buf[i]) T(std::move(item));
+	item.~T();
+      }
+      release();
+      buf = new_buf;
+      mask = new_cap - 1;
+      head = 0;
+    }
+
+    // must only be called when empty; returns to the inline storage
+    void reset() {
+      release();
+      buf = reinterpret_cast<T*>(inline_buf);
+      mask = N - 1;
+      head = 0;
+    }
+
+    void release() {
+      if (!is_inline()) {
+	AllocTraits::deallocate(alloc, buf, mask + 1);
+      }
+    }
+  }; // class SmallRing
+
+} // namespace crimson
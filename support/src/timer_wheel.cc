@@ -0,0 +1,313 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+#include <algorithm>
+
+#include "timer_wheel.h"
+
+
+namespace chrono = std::chrono;
+
+
+namespace {
+  // rotates right so that bit n of x becomes bit 0
+  inline uint64_t rotate_right(uint64_t x, unsigned n) {
+    return 0 == n ? x : (x >> n) | (x << (64 - n));
+  }
+}
+
+
+constexpr crimson::TimerWheel::TimerId crimson::TimerWheel::no_timer;
+
+
+crimson::TimerWheel::TimerWheel(Duration _tick) :
+  tick(_tick),
+  start(Clock::now())
+{
+  for (unsigned level = 0; level < levels; ++level) {
+    occupied[level] = 0;
+    for (unsigned slot = 0; slot < slot_count; ++slot) {
+      slots[level][slot] = nullptr;
+    }
+  }
+  thd = std::thread(&TimerWheel::run, this);
+}
+
+
+crimson::TimerWheel::~TimerWheel() {
+  {
+    Guard g(mtx);
+    finishing = true;
+    wake_cv.notify_all();
+  }
+  thd.join();
+}
+
+
+crimson::TimerWheel& crimson::TimerWheel::shared() {
+  static TimerWheel wheel;
+  return wheel;
+}
+
+
+crimson::TimerWheel::TimerId
+crimson::TimerWheel::add(const std::function<void()>& body) {
+  Guard g(mtx);
+  return make_timer(body, Duration::zero()).id;
+}
+
+
+void crimson::TimerWheel::arm(TimerId id, TimePoint when) {
+  Guard g(mtx);
+  Timer* t = find_timer(id);
+  if (t) {
+    arm_timer(*t, tick_at(when));
+  }
+}
+
+
+void crimson::TimerWheel::arm_by(TimerId id, TimePoint when) {
+  Guard g(mtx);
+  Timer* t = find_timer(id);
+  if (t) {
+    const uint64_t expires = tick_at(when);
+    if (!t->armed || expires < t->expires) {
+      arm_timer(*t, expires);
+    }
+  }
+}
+
+
+void crimson::TimerWheel::disarm(TimerId id) {
+  Guard g(mtx);
+  Timer* t = find_timer(id);
+  if (t && t->armed) {
+    unlink(*t);
+  }
+}
+
+
+void crimson::TimerWheel::remove(TimerId id) {
+  Lock l(mtx);
+  Timer* t = find_timer(id);
+  if (!t) return;
+
+  t->removed = true;
+  if (t->armed) {
+    unlink(*t);
+  }
+
+  if (running == id) {
+    // the thread erases it once the callback returns
+    if (std::this_thread::get_id() != thd.get_id()) {
+      done_cv.wait(l, [this, id] { return running != id; });
+    }
+  } else {
+    timers.erase(id);
+  }
+}
+
+
+void crimson::TimerWheel::run() {
+  Lock l(mtx);
+  while (!finishing) {
+    const uint64_t target = next_event();
+    if (never == target) {
+      wake_tick = never;
+      wake_cv.wait(l);
+    } else {
+      const TimePoint when = start + tick * target;
+      if (Clock::now() < when) {
+	wake_tick = target;
+	wake_cv.wait_until(l, when);
+      } else {
+	now_tick = target;
+	process_tick(l);
+      }
+    }
+    wake_tick = 0;
+  }
+}
+
+
+crimson::TimerWheel::Timer&
+crimson::TimerWheel::make_timer(const std::function<void()>& body,
+				Duration period) {
+  const TimerId id = next_id++;
+  Timer* t = new Timer(id, body, period);
+  timers.emplace(id, std::unique_ptr<Timer>(t));
+  return *t;
+}
+
+
+crimson::TimerWheel::Timer* crimson::TimerWheel::find_timer(TimerId id) {
+  auto i = timers.find(id);
+  if (timers.end() == i || i->second->removed) {
+    return nullptr;
+  }
+  return i->second.get();
+}
+
+
+uint64_t crimson::TimerWheel::tick_at(TimePoint when) const {
+  if (when <= start) {
+    return 0;
+  }
+  const auto since = chrono::duration_cast<Duration>(when - start);
+  return uint64_t((since + tick - Duration(1)) / tick);
+}
+
+
+void crimson::TimerWheel::arm_timer(Timer& t, uint64_t expires) {
+  if (t.armed) {
+    unlink(t);
+  }
+  t.expires = std::max(expires, now_tick);
+  t.armed = true;
+  const uint64_t event = place(t);
+  if (event < wake_tick) {
+    wake_cv.notify_one();
+  }
+}
+
+
+uint64_t crimson::TimerWheel::place(Timer& t) {
+  // timers beyond the wheel's reach go in the furthest slot of the
+  // top level and get placed again when it's reached
+  const uint64_t span = uint64_t(1) << (level_bits * levels);
+  const uint64_t when = std::min(t.expires, now_tick + span - 1);
+  const uint64_t delta = when - now_tick;
+
+  unsigned level = 0;
+  while (level + 1 < levels &&
+	 delta >= (uint64_t(1) << (level_bits * (level + 1)))) {
+    ++level;
+  }
+  const unsigned shift = level_bits * level;
+  const unsigned slot = (when >> shift) & slot_mask;
+
+  t.level = level;
+  t.slot = slot;
+  t.prev = nullptr;
+  t.next = slots[level][slot];
+  if (t.next) {
+    t.next->prev = &t;
+  }
+  slots[level][slot] = &t;
+  occupied[level] |= uint64_t(1) << slot;
+
+  return (when >> shift) << shift;
+}
+
+
+void crimson::TimerWheel::unlink(Timer& t) {
+  if (t.prev) {
+    t.prev->next = t.next;
+  } else {
+    slots[t.level][t.slot] = t.next;
+    if (!t.next) {
+      occupied[t.level] &= ~(uint64_t(1) << t.slot);
+    }
+  }
+  if (t.next) {
+    t.next->prev = t.prev;
+  }
+  t.prev = nullptr;
+  t.next = nullptr;
+  t.armed = false;
+}
+
+
+uint64_t crimson::TimerWheel::next_event() const {
+  uint64_t result = never;
+
+  // level 0 slots hold the ticks from now_tick to now_tick + 63
+  if (occupied[0]) {
+    const unsigned index = now_tick & slot_mask;
+    const unsigned offset =
+      __builtin_ctzll(rotate_right(occupied[0], index));
+    result = now_tick + offset;
+  }
+
+  // the slots of higher levels are moved down once the wheel reaches
+  // the start of the span they cover. If now_tick is that start, the
+  // current slot is still to be moved; otherwise its span has already
+  // started, so it's next reached a full turn from now
+  for (unsigned level = 1; level < levels; ++level) {
+    if (!occupied[level]) continue;
+    const unsigned shift = level_bits * level;
+    const uint64_t position = now_tick >> shift;
+    const uint64_t first =
+      (now_tick & ((uint64_t(1) << shift) - 1)) ? 1 : 0;
+    const unsigned index = (position + first) & slot_mask;
+    const unsigned offset =
+      first + __builtin_ctzll(rotate_right(occupied[level], index));
+    result = std::min(result, (position + offset) << shift);
+  }
+
+  return result;
+}
+
+
+void crimson::TimerWheel::cascade(unsigned level, unsigned slot) {
+  Timer* t = slots[level][slot];
+  slots[level][slot] = nullptr;
+  occupied[level] &= ~(uint64_t(1) << slot);
+  while (t) {
+    Timer* next = t->next;
+    (void) place(*t);
+    t = next;
+  }
+}
+
+
+void crimson::TimerWheel::process_tick(Lock& l) {
+  const uint64_t current = now_tick;
+
+  for (unsigned level = 1; level < levels; ++level) {
+    const unsigned shift = level_bits * level;
+    if (current & ((uint64_t(1) << shift) - 1)) break;
+    cascade(level, (current >> shift) & slot_mask);
+  }
+
+  const unsigned slot = current & slot_mask;
+  for (Timer* t = slots[0][slot]; t; t = t->next) {
+    t->armed = false;
+    due.push_back(t->id);
+  }
+  slots[0][slot] = nullptr;
+  occupied[0] &= ~(uint64_t(1) << slot);
+
+  // anything armed from here on is due no sooner than the next tick
+  now_tick = current + 1;
+
+  for (TimerId id : due) {
+    Timer* t = find_timer(id);
+    // skip timers removed or re-armed by an earlier callback
+    if (!t || t->armed) continue;
+
+    running = id;
+    l.unlock();
+    t->body();
+    l.lock();
+    running = no_timer;
+
+    if (t->removed) {
+      timers.erase(id);
+    } else if (t->period > Duration::zero() && !t->armed) {
+      arm_timer(*t, tick_at(Clock::now() + t->period));
+    }
+    done_cv.notify_all();
+  }
+  due.clear();
+}
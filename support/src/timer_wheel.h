@@ -0,0 +1,206 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+#pragma once
+
+
+#include <cstdint>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+
+namespace crimson {
+
+  /*
+   * A hierarchical timing wheel (after Varghese and Lauck) run by a
+   * single thread, so that many objects needing deferred or periodic
+   * work can share one thread rather than each sleeping in its own.
+   *
+   * Time is divided into ticks. Each level of the wheel has 64 slots;
+   * a slot at level 0 covers one tick and a slot at level n covers
+   * 64^n ticks. Timers due soon sit at level 0 and ones further out
+   * at higher levels, moving down a level each time the wheel reaches
+   * their slot. Arming and disarming are constant time, and the
+   * thread sleeps until the next occupied slot rather than waking
+   * every tick.
+   *
+   * A timer is registered once, with its callback, and then armed
+   * and disarmed as often as needed; it runs at most once per arming
+   * and never before the time it was armed for. Periodic timers are
+   * re-armed by the wheel after each run. Callbacks run on the
+   * wheel's thread without its lock held, so they may arm, disarm,
+   * and remove timers (including their own), but a long callback
+   * delays all the others.
+   */
+  class TimerWheel {
+
+  public:
+
+    using Clock = std::chrono::steady_clock;
+    using TimePoint = Clock::time_point;
+    using Duration = std::chrono::microseconds;
+    using TimerId = uint64_t;
+
+    static constexpr TimerId no_timer = 0;
+
+  protected:
+
+    using Lock = std::unique_lock<std::mutex>;
+    using Guard = std::lock_guard<std::mutex>;
+
+    static constexpr unsigned level_bits = 6;
+    static constexpr unsigned slot_count = 1u << level_bits;
+    static constexpr uint64_t slot_mask = slot_count - 1;
+    static constexpr unsigned levels = 5;
+
+    static constexpr uint64_t never = UINT64_MAX;
+
+    struct Timer {
+      TimerId               id;
+      std::function<void()> body;
+      Duration              period;     // zero for one-shot timers
+      uint64_t              expires = 0; // tick at which it's due
+      bool                  armed = false;
+      bool                  removed = false;
+      unsigned              level = 0;
+      unsigned              slot = 0;
+      Timer*                prev = nullptr;
+      Timer*                next = nullptr;
+
+      Timer(TimerId _id,
+	    const std::function<void()>& _body,
+	    Duration _period) :
+	id(_id),
+	body(_body),
+	period(_period)
+      {
+	// empty
+      }
+    }; // struct Timer
+
+    const Duration          tick;
+    const TimePoint         start;
+
+    mutable std::mutex      mtx;
+    std::condition_variable wake_cv; // wakes the wheel's thread
+    std::condition_variable done_cv; // signals a callback finished
+    bool                    finishing = false;
+
+    uint64_t                now_tick = 0;  // next tick to process
+    uint64_t                wake_tick = 0; // tick the thread sleeps until
+    TimerId                 next_id = 1;
+    TimerId                 running = no_timer;
+
+    Timer*                  slots[levels][slot_count];
+    uint64_t                occupied[levels]; // bit per non-empty slot
+
+    std::unordered_map<TimerId,std::unique_ptr<Timer>> timers;
+    std::vector<TimerId>    due; // used by the thread for each tick
+
+    // put thread last so all other variables are initialized first
+
+    std::thread             thd;
+
+  public:
+
+    explicit TimerWheel(Duration _tick = Duration(100));
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // stops the thread; timers still registered never run
+    ~TimerWheel();
+
+    // the wheel shared by everything in the process, started on
+    // first use
+    static TimerWheel& shared();
+
+    // registers a timer that runs body each time it's armed and
+    // comes due; it starts out disarmed
+    TimerId add(const std::function<void()>& body);
+
+    // registers a timer that runs body every period, starting one
+    // period from now
+    template<typename D>
+    TimerId add_every(D period, const std::function<void()>& body) {
+      Duration p = std::chrono::duration_cast<Duration>(period);
+      Guard g(mtx);
+      Timer& t = make_timer(body, p);
+      arm_timer(t, tick_at(Clock::now() + p));
+      return t.id;
+    }
+
+    // arms the timer to run at when, replacing any earlier arming
+    void arm(TimerId id, TimePoint when);
+
+    // arms the timer to run at when unless it's already armed to run
+    // sooner
+    void arm_by(TimerId id, TimePoint when);
+
+    void disarm(TimerId id);
+
+    // unregisters the timer; if its callback is running on another
+    // thread, waits for it to finish so that whatever the callback
+    // refers to may be destroyed once this returns
+    void remove(TimerId id);
+
+    // number of registered timers
+    size_t size() const {
+      Guard g(mtx);
+      return timers.size();
+    }
+
+  protected:
+
+    void run();
+
+    // mtx must be held by caller
+    Timer& make_timer(const std::function<void()>& body, Duration period);
+
+    // mtx must be held by caller
+    Timer* find_timer(TimerId id);
+
+    // first tick at or after when, so timers never run early
+    uint64_t tick_at(TimePoint when) const;
+
+    // mtx must be held by caller
+    void arm_timer(Timer& t, uint64_t expires);
+
+    // links an armed timer into the slot for its expiry and returns
+    // the tick at which the wheel next has to look at it; mtx must be
+    // held by caller
+    uint64_t place(Timer& t);
+
+    // mtx must be held by caller
+    void unlink(Timer& t);
+
+    // the earliest tick at which a timer is due or a slot has to be
+    // moved down a level; mtx must be held by caller
+    uint64_t next_event() const;
+
+    // moves every timer in a slot down to lower levels; mtx must be
+    // held by caller
+    void cascade(unsigned level, unsigned slot);
+
+    // processes the tick the wheel has reached, running the timers
+    // due; l must hold mtx and is released while callbacks run
+    void process_tick(Lock& l);
+  }; // class TimerWheel
+
+} // namespace crimson
@@ -0,0 +1,134 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+#include <chrono>
+#include <thread>
+#include <atomic>
+
+#include "gtest/gtest.h"
+
+#include "dispatch_pool.h"
+
+
+namespace chrono = std::chrono;
+using Pool = crimson::DispatchPool;
+
+
+namespace {
+  template<typename P>
+  bool wait_for(P pred) {
+    const auto end = chrono::steady_clock::now() + chrono::seconds(2);
+    while (!pred()) {
+      if (chrono::steady_clock::now() >= end) return false;
+      std::this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    return true;
+  }
+}
+
+
+TEST(DispatchPool, post_while_running) {
+  Pool pool(2);
+
+  std::atomic<int> runs(0);
+  std::atomic<int> inside(0);
+  std::atomic<bool> overlap(false);
+  std::atomic<bool> release(false);
+
+  Pool::JobId id = pool.add([&] {
+      if (inside++) {
+	overlap = true;
+      }
+      ++runs;
+      while (!release) {
+	std::this_thread::yield();
+      }
+      --inside;
+    });
+  EXPECT_EQ(1u, pool.size());
+
+  pool.post(id);
+  ASSERT_TRUE(wait_for([&] { return 1 == inside.load(); }));
+
+  // both land while the first run is blocked, and make one more run
+  pool.post(id);
+  pool.post(id);
+  std::this_thread::sleep_for(chrono::milliseconds(20));
+  EXPECT_EQ(1, runs.load()) << "a job never runs on two threads at once";
+
+  release = true;
+  ASSERT_TRUE(wait_for([&] { return 2 == runs.load() && 0 == inside; }));
+  std::this_thread::sleep_for(chrono::milliseconds(20));
+  EXPECT_EQ(2, runs.load());
+  EXPECT_FALSE(overlap.load());
+
+  pool.remove(id);
+  EXPECT_EQ(0u, pool.size());
+}
+
+
+TEST(DispatchPool, slow_job_independent) {
+  Pool pool(2);
+
+  std::atomic<bool> release(false);
+  std::atomic<int> fast_runs(0);
+
+  Pool::JobId slow = pool.add([&] {
+      while (!release) {
+	std::this_thread::yield();
+      }
+    });
+  Pool::JobId fast = pool.add([&] { ++fast_runs; });
+
+  pool.post(slow);
+  pool.post(fast);
+  EXPECT_TRUE(wait_for([&] { return 1 == fast_runs.load(); })) <<
+    "a slow job holds up only the thread running it";
+
+  release = true;
+  pool.remove(slow);
+  pool.remove(fast);
+}
+
+
+TEST(DispatchPool, remove_waits) {
+  Pool pool(1);
+
+  std::atomic<bool> started(false);
+  std::atomic<bool> finished(false);
+  std::atomic<int> other_runs(0);
+
+  Pool::JobId id = pool.add([&] {
+      started = true;
+      std::this_thread::sleep_for(chrono::milliseconds(50));
+      finished = true;
+    });
+  Pool::JobId other = pool.add([&] { ++other_runs; });
+
+  pool.post(id);
+  ASSERT_TRUE(wait_for([&] { return started.load(); }));
+
+  // queued behind the running job, then removed before it can run
+  pool.post(other);
+  pool.remove(other);
+
+  pool.remove(id);
+  EXPECT_TRUE(finished.load()) <<
+    "remove returns only once the running job has finished";
+
+  std::this_thread::sleep_for(chrono::milliseconds(20));
+  EXPECT_EQ(0, other_runs.load()) << "a removed job does not run";
+  EXPECT_EQ(0u, pool.size());
+
+  pool.post(id); // no longer registered; ignored
+}
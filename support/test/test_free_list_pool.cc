@@ -0,0 +1,79 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+#include <memory>
+#include <deque>
+#include <set>
+
+#include "gtest/gtest.h"
+
+#include "free_list_pool.h"
+
+
+TEST(FreeListPool, reuse_blocks) {
+  crimson::FreeListPool pool;
+
+  void* p1 = pool.allocate(40);
+  void* p2 = pool.allocate(40);
+  EXPECT_NE(p1, p2);
+  EXPECT_EQ(1u, pool.slab_count());
+
+  pool.deallocate(p1, 40);
+  EXPECT_EQ(p1, pool.allocate(48)) <<
+    "a freed block is reused by the next request in its size class";
+
+  void* p3 = pool.allocate(200);
+  EXPECT_EQ(2u, pool.slab_count()) << "each size class has its own slabs";
+
+  void* big = pool.allocate(crimson::FreeListPool::max_pooled_size + 1);
+  EXPECT_EQ(2u, pool.slab_count()) << "large requests bypass the pool";
+  pool.deallocate(big, crimson::FreeListPool::max_pooled_size + 1);
+
+  pool.deallocate(p1, 48);
+  pool.deallocate(p2, 40);
+  pool.deallocate(p3, 200);
+}
+
+
+TEST(FreeListPool, steady_state_churn) {
+  crimson::FreeListPool pool;
+  crimson::PoolAllocator<int> alloc(pool);
+
+  using Queue = std::deque<int,crimson::PoolAllocator<int>>;
+
+  std::set<std::shared_ptr<Queue>> live;
+  for (int i = 0; i < 100; ++i) {
+    auto q = std::allocate_shared<Queue>(alloc, alloc);
+    for (int j = 0; j < i; ++j) {
+      q->push_back(j);
+    }
+    live.insert(q);
+  }
+  live.clear();
+
+  const size_t slabs = pool.slab_count();
+  EXPECT_LT(0u, slabs);
+
+  // the same population again should be satisfied from the free
+  // lists alone
+  for (int i = 0; i < 100; ++i) {
+    auto q = std::allocate_shared<Queue>(alloc, alloc);
+    for (int j = 0; j < i; ++j) {
+      q->push_back(j);
+    }
+    live.insert(q);
+  }
+  live.clear();
+
+  EXPECT_EQ(slabs, pool.slab_count());
+}
@@ -0,0 +1,195 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "indirect_intrusive_heap.h"
+#include "keyed_intrusive_heap.h"
+
+
+struct KElem {
+  int id;
+  int data;
+
+  crimson::IndIntruHeapData heap_data;
+  crimson::IndIntruHeapData heap_data_alt;
+
+  KElem(int _id, int _data) : id(_id), data(_data) { }
+
+  friend std::ostream& operator<<(std::ostream& out, const KElem& d) {
+    out << d.data;
+    return out;
+  }
+};
+
+
+// sorted low to high, ties broken by id so both heaps agree on order
+struct KElemCompare {
+  using key_type = std::pair<int,int>;
+
+  static key_type key(const KElem& e) {
+    return key_type(e.data, e.id);
+  }
+
+  bool operator()(const key_type& k1, const key_type& k2) const {
+    return k1 < k2;
+  }
+
+  bool operator()(const KElem& d1, const KElem& d2) const {
+    return key(d1) < key(d2);
+  }
+};
+
+
+TEST(KeyedIndIntruHeap, basics) {
+  crimson::KeyedIndIntruHeap<std::shared_ptr<KElem>,
+			     KElem,
+			     &KElem::heap_data,
+			     KElemCompare> heap;
+
+  EXPECT_TRUE(heap.empty());
+
+  const int values[] = { 2, 99, 1, -17, 0, 1000, -12, -5, 12, 5 };
+  int id = 0;
+  for (int v : values) {
+    heap.push(std::make_shared<KElem>(id++, v));
+  }
+  EXPECT_EQ(10u, heap.size());
+
+  std::ostringstream out;
+  heap.display_sorted(out);
+  EXPECT_EQ("-17, -12, -5, 0, 1, 2, 5, 12, 99, 1000", out.str());
+
+  const int sorted[] = { -17, -12, -5, 0, 1, 2, 5, 12, 99, 1000 };
+  for (int v : sorted) {
+    EXPECT_EQ(v, heap.top().data);
+    heap.pop();
+  }
+  EXPECT_TRUE(heap.empty());
+}
+
+
+TEST(KeyedIndIntruHeap, key_refreshed_on_adjust) {
+  crimson::KeyedIndIntruHeap<std::shared_ptr<KElem>,
+			     KElem,
+			     &KElem::heap_data,
+			     KElemCompare,
+			     3> heap;
+
+  std::vector<std::shared_ptr<KElem>> elems;
+  for (int i = 0; i < 20; ++i) {
+    elems.push_back(std::make_shared<KElem>(i, 10 * i));
+    heap.push(elems.back());
+  }
+
+  // changing the element alone leaves the cached key, and so the
+  // order, as it was
+  elems[15]->data = -1;
+  EXPECT_EQ(0, heap.top().id);
+
+  heap.promote(*elems[15]);
+  EXPECT_EQ(15, heap.top().id);
+
+  elems[15]->data = 1000;
+  heap.demote(*elems[15]);
+  EXPECT_EQ(0, heap.top().id);
+
+  elems[0]->data = 500;
+  heap.adjust(*elems[0]);
+  EXPECT_EQ(1, heap.top().id);
+
+  auto i = heap.rfind(elems[1]);
+  heap.remove(i);
+  EXPECT_EQ(2, heap.top().id);
+  EXPECT_EQ(19u, heap.size());
+}
+
+
+// runs the same random operations against an IndIntruHeap and a
+// KeyedIndIntruHeap and checks they always agree on the top
+template<uint K>
+void compare_with_indirect_heap() {
+  crimson::IndIntruHeap<std::shared_ptr<KElem>,
+			KElem,
+			&KElem::heap_data,
+			KElemCompare,
+			K> plain;
+  crimson::KeyedIndIntruHeap<std::shared_ptr<KElem>,
+			     KElem,
+			     &KElem::heap_data_alt,
+			     KElemCompare,
+			     K> keyed;
+
+  std::mt19937 gen(K);
+  std::uniform_int_distribution<int> value(0, 1000);
+  std::vector<std::shared_ptr<KElem>> live;
+  int next_id = 0;
+
+  for (int step = 0; step < 5000; ++step) {
+    const int op = gen() % 4;
+    if (live.empty() || 0 == op) {
+      auto e = std::make_shared<KElem>(next_id++, value(gen));
+      plain.push(e);
+      keyed.push(e);
+      live.push_back(e);
+    } else if (1 == op) {
+      auto& e = live[gen() % live.size()];
+      e->data = value(gen);
+      plain.adjust(*e);
+      keyed.adjust(*e);
+    } else if (2 == op) {
+      const size_t at = gen() % live.size();
+      auto pi = plain.rfind(live[at]);
+      plain.remove(pi);
+      auto ki = keyed.rfind(live[at]);
+      keyed.remove(ki);
+      live.erase(live.begin() + at);
+    } else {
+      const int id = plain.top().id;
+      plain.pop();
+      keyed.pop();
+      for (auto i = live.begin(); i != live.end(); ++i) {
+	if ((*i)->id == id) {
+	  live.erase(i);
+	  break;
+	}
+      }
+    }
+
+    ASSERT_EQ(plain.size(), keyed.size());
+    if (!plain.empty()) {
+      ASSERT_EQ(plain.top().id, keyed.top().id) << "step " << step;
+    }
+  }
+
+  while (!plain.empty()) {
+    ASSERT_EQ(plain.top().id, keyed.top().id);
+    plain.pop();
+    keyed.pop();
+  }
+  EXPECT_TRUE(keyed.empty());
+}
+
+
+TEST(KeyedIndIntruHeap, matches_indirect_heap) {
+  compare_with_indirect_heap<2>();
+  compare_with_indirect_heap<3>();
+  compare_with_indirect_heap<4>();
+  compare_with_indirect_heap<8>();
+}
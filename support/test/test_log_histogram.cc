@@ -0,0 +1,71 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+#include <sstream>
+
+#include "gtest/gtest.h"
+
+#include "log_histogram.h"
+
+
+TEST(LogHistogram, buckets) {
+  using H = crimson::LogHistogram<8>;
+
+  EXPECT_EQ(0u, H::bucket_of(0));
+  EXPECT_EQ(1u, H::bucket_of(1));
+  EXPECT_EQ(2u, H::bucket_of(2));
+  EXPECT_EQ(2u, H::bucket_of(3));
+  EXPECT_EQ(3u, H::bucket_of(4));
+  EXPECT_EQ(7u, H::bucket_of(64));
+  EXPECT_EQ(7u, H::bucket_of(1u << 20)) << "last bucket takes the rest";
+
+  for (size_t i = 1; i < H::bucket_count; ++i) {
+    EXPECT_EQ(i, H::bucket_of(H::bucket_low(i)));
+    EXPECT_EQ(i, H::bucket_of(H::bucket_high(i)));
+  }
+}
+
+
+TEST(LogHistogram, counts_and_percentiles) {
+  crimson::LogHistogram<> h;
+
+  EXPECT_EQ(0u, h.count());
+  EXPECT_EQ(0u, h.percentile(0.99));
+
+  for (uint64_t v = 1; v <= 1000; ++v) {
+    h.add(v);
+  }
+  EXPECT_EQ(1000u, h.count());
+  EXPECT_EQ(1000u, h.max());
+  EXPECT_DOUBLE_EQ(500.5, h.mean());
+  EXPECT_EQ(64u, h.count(7)); // 64..127
+
+  // each is the top of the bucket holding the true value
+  EXPECT_EQ(511u, h.percentile(0.5));
+  EXPECT_EQ(1000u, h.percentile(0.99)) << "capped by the max";
+  EXPECT_EQ(1u, h.percentile(0.0));
+
+  crimson::LogHistogram<> other;
+  other.add(0);
+  other.add(5000);
+  h.merge(other);
+  EXPECT_EQ(1002u, h.count());
+  EXPECT_EQ(5000u, h.max());
+  EXPECT_EQ(1u, h.count(0));
+
+  std::ostringstream out;
+  other.clear();
+  other.add(3);
+  out << other;
+  EXPECT_EQ("{ count:1 mean:3 max:3 buckets: [2]:1 }", out.str());
+}
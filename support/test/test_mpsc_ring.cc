@@ -0,0 +1,189 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+#include <memory>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+
+#include "gtest/gtest.h"
+
+#include "mpsc_ring.h"
+
+
+TEST(MpscRing, fill_and_consume) {
+  crimson::MpscRing<std::unique_ptr<int>> r(5);
+  EXPECT_EQ(8u, r.capacity()) << "capacity rounds up to a power of two";
+  EXPECT_TRUE(r.empty());
+
+  // go around the ring a few times
+  int next_push = 0;
+  int next_pop = 0;
+  for (int round = 0; round < 3; ++round) {
+    while (true) {
+      std::unique_ptr<int> p(new int(next_push));
+      if (!r.try_push(p)) {
+	EXPECT_TRUE(bool(p)) << "a failed push leaves the item alone";
+	break;
+      }
+      EXPECT_FALSE(bool(p));
+      ++next_push;
+    }
+    EXPECT_EQ(8u, r.size());
+
+    size_t n = r.consume([&] (std::unique_ptr<int>&& p) {
+	EXPECT_EQ(next_pop, *p);
+	++next_pop;
+      });
+    EXPECT_EQ(8u, n);
+    EXPECT_TRUE(r.empty());
+  }
+}
+
+
+TEST(MpscRing, concurrent_producers) {
+  constexpr int producers = 4;
+  constexpr int per_producer = 20000;
+
+  crimson::MpscRing<std::pair<int,int>> r(64);
+  std::atomic<int> started(0);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < producers; ++t) {
+    threads.emplace_back([&r, &started, t] () {
+	++started;
+	for (int i = 0; i < per_producer; ++i) {
+	  std::pair<int,int> item(t, i);
+	  while (!r.try_push(item)) {
+	    std::this_thread::yield();
+	  }
+	}
+      });
+  }
+
+  // items from each producer must arrive in the order pushed
+  std::vector<int> next(producers, 0);
+  int consumed = 0;
+  while (consumed < producers * per_producer) {
+    consumed += r.consume([&next] (std::pair<int,int>&& item) {
+	EXPECT_EQ(next[item.first], item.second);
+	next[item.first] = item.second + 1;
+      });
+  }
+
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  EXPECT_TRUE(r.empty());
+  for (int t = 0; t < producers; ++t) {
+    EXPECT_EQ(per_producer, next[t]);
+  }
+}
+
+
+namespace {
+  // moving one in blocks until released, to hold a producer between
+  // claiming its slot and filling it
+  struct Gate {
+    std::mutex              mtx;
+    std::condition_variable cv;
+    bool                    entered = false;
+    bool                    released = false;
+  };
+
+  struct Gated {
+    Gate* gate;
+    int   value;
+
+    Gated(Gate* _gate, int _value) : gate(_gate), value(_value) {}
+    Gated(Gated&& other) : gate(other.gate), value(other.value) {
+      if (gate) {
+	std::unique_lock<std::mutex> l(gate->mtx);
+	gate->entered = true;
+	gate->cv.notify_all();
+	gate->cv.wait(l, [this] () { return gate->released; });
+      }
+    }
+  };
+}
+
+
+TEST(MpscRing, consume_stops_at_unfilled_slot) {
+  crimson::MpscRing<Gated> r(8);
+  Gate gate;
+
+  std::thread slow([&] () {
+      Gated item(&gate, 0);
+      EXPECT_TRUE(r.try_push(item));
+    });
+  {
+    std::unique_lock<std::mutex> l(gate.mtx);
+    gate.cv.wait(l, [&] () { return gate.entered; });
+  }
+
+  Gated fast(nullptr, 1);
+  EXPECT_TRUE(r.try_push(fast));
+  EXPECT_EQ(2u, r.size());
+
+  std::vector<int> values;
+  auto collect = [&values] (Gated&& item) { values.push_back(item.value); };
+  EXPECT_EQ(0u, r.consume(collect)) <<
+    "the unfilled slot holds back the ones after it without waiting";
+
+  {
+    std::lock_guard<std::mutex> l(gate.mtx);
+    gate.released = true;
+  }
+  gate.cv.notify_all();
+  slow.join();
+
+  EXPECT_EQ(2u, r.consume(collect));
+  EXPECT_EQ(std::vector<int>({0, 1}), values);
+  EXPECT_TRUE(r.empty());
+}
+
+
+TEST(MpscRing, consume_throws) {
+  crimson::MpscRing<std::shared_ptr<int>> r(4);
+  std::shared_ptr<int> first(new int(1));
+  std::weak_ptr<int> watch(first);
+  for (int i = 1; i <= 3; ++i) {
+    std::shared_ptr<int> p(1 == i ? first : std::make_shared<int>(i));
+    EXPECT_TRUE(r.try_push(p));
+  }
+  first.reset();
+
+  EXPECT_THROW(r.consume([] (std::shared_ptr<int>&& p) {
+	throw std::runtime_error("consumer failed");
+      }),
+    std::runtime_error);
+  EXPECT_TRUE(watch.expired()) << "the item f threw on was destroyed";
+  EXPECT_EQ(2u, r.size()) << "its slot was released";
+
+  std::vector<int> values;
+  EXPECT_EQ(2u, r.consume([&values] (std::shared_ptr<int>&& p) {
+	values.push_back(*p);
+      }));
+  EXPECT_EQ(std::vector<int>({2, 3}), values);
+
+  // the released slot can be reused
+  for (int i = 0; i < 4; ++i) {
+    std::shared_ptr<int> p(new int(i));
+    EXPECT_TRUE(r.try_push(p));
+  }
+  EXPECT_EQ(4u, r.size());
+}
@@ -0,0 +1,144 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+#include <memory>
+#include <map>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "open_hash_map.h"
+#include "dense_map.h"
+
+
+TEST(OpenHashMap, insert_find_erase) {
+  crimson::OpenHashMap<int,std::string> m;
+
+  EXPECT_TRUE(m.empty());
+  EXPECT_EQ(m.end(), m.find(3));
+
+  m[3] = "three";
+  m[7] = "seven";
+  auto r = m.emplace(11, std::string("eleven"));
+  EXPECT_TRUE(r.second);
+  EXPECT_EQ("eleven", r.first->second);
+
+  r = m.emplace(3, std::string("trois"));
+  EXPECT_FALSE(r.second) << "emplace does not replace existing entries";
+  EXPECT_EQ("three", m.at(3));
+
+  EXPECT_EQ(3u, m.size());
+  EXPECT_EQ("seven", m.find(7)->second);
+  EXPECT_EQ(1u, m.count(11));
+  EXPECT_THROW(m.at(5), std::out_of_range);
+
+  EXPECT_EQ(1u, m.erase(7));
+  EXPECT_EQ(0u, m.erase(7));
+  EXPECT_EQ(m.end(), m.find(7));
+  EXPECT_EQ(2u, m.size());
+  EXPECT_EQ("three", m.at(3));
+  EXPECT_EQ("eleven", m.at(11));
+}
+
+
+TEST(OpenHashMap, grow_and_reuse_tombstones) {
+  crimson::OpenHashMap<unsigned,std::shared_ptr<int>> m;
+  std::map<unsigned,int> reference;
+
+  // repeatedly fill and drain so tombstones accumulate and must be
+  // reclaimed
+  for (unsigned round = 0; round < 5; ++round) {
+    for (unsigned i = 0; i < 1000; ++i) {
+      unsigned key = i * 64 + round;
+      m[key] = std::make_shared<int>(int(key));
+      reference[key] = int(key);
+    }
+    for (unsigned i = 0; i < 1000; i += 2) {
+      unsigned key = i * 64 + round;
+      m.erase(key);
+      reference.erase(key);
+    }
+  }
+
+  EXPECT_EQ(reference.size(), m.size());
+  for (const auto& r : reference) {
+    auto i = m.find(r.first);
+    ASSERT_NE(m.end(), i);
+    EXPECT_EQ(r.second, *i->second);
+  }
+
+  size_t visited = 0;
+  for (const auto& e : m) {
+    EXPECT_EQ(1u, reference.count(e.first));
+    ++visited;
+  }
+  EXPECT_EQ(reference.size(), visited);
+}
+
+
+TEST(OpenHashMap, erase_while_iterating) {
+  crimson::OpenHashMap<int,int> m;
+  for (int i = 0; i < 100; ++i) {
+    m[i] = i;
+  }
+
+  // the idiom used when cleaning client records
+  for (auto i = m.begin(); i != m.end(); /* empty */) {
+    auto i2 = i++;
+    if (0 == i2->second % 3) {
+      m.erase(i2);
+    }
+  }
+
+  EXPECT_EQ(66u, m.size());
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(0 == i % 3 ? 0u : 1u, m.count(i));
+  }
+}
+
+
+TEST(DenseMap, insert_find_erase) {
+  crimson::DenseMap<unsigned,std::string> m;
+
+  EXPECT_TRUE(m.empty());
+  EXPECT_EQ(m.end(), m.find(3));
+
+  m[3] = "three";
+  m[0] = "zero";
+  m[9] = "nine";
+
+  EXPECT_EQ(3u, m.size());
+  EXPECT_EQ("zero", m.at(0));
+  EXPECT_THROW(m.at(5), std::out_of_range);
+  EXPECT_THROW(m.at(50), std::out_of_range);
+
+  // iterates in key order
+  auto i = m.begin();
+  EXPECT_EQ(0u, i->first);
+  ++i;
+  EXPECT_EQ(3u, i->first);
+  ++i;
+  EXPECT_EQ(9u, i->first);
+  ++i;
+  EXPECT_EQ(m.end(), i);
+
+  for (auto j = m.begin(); j != m.end(); /* empty */) {
+    auto j2 = j++;
+    if (j2->first != 3) {
+      m.erase(j2);
+    }
+  }
+  EXPECT_EQ(1u, m.size());
+  EXPECT_EQ("three", m.at(3));
+  EXPECT_EQ(0u, m.count(9));
+}
@@ -0,0 +1,146 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "profile.h"
+
+
+using Histogram = crimson::ProfileHistogram<std::chrono::nanoseconds>;
+
+
+TEST(ProfileHistogram, buckets) {
+  // the first 2 * 8 values have buckets of their own
+  for (uint64_t v = 0; v < 16; ++v) {
+    EXPECT_EQ(v, Histogram::bucket_of(v));
+  }
+  EXPECT_EQ(16u, Histogram::bucket_of(16));
+  EXPECT_EQ(16u, Histogram::bucket_of(17));
+  EXPECT_EQ(17u, Histogram::bucket_of(18));
+
+  // buckets tile the range without gaps, each at most 1/8 of its
+  // lowest value wide
+  for (uint b = 0; b + 1 < Histogram::bucket_count; ++b) {
+    EXPECT_EQ(b, Histogram::bucket_of(Histogram::bucket_low(b)));
+    EXPECT_EQ(b, Histogram::bucket_of(Histogram::bucket_high(b)));
+    EXPECT_EQ(Histogram::bucket_high(b) + 1, Histogram::bucket_low(b + 1));
+    const uint64_t width =
+      Histogram::bucket_high(b) - Histogram::bucket_low(b) + 1;
+    EXPECT_LE(width * 8, std::max<uint64_t>(8, Histogram::bucket_low(b)));
+  }
+  EXPECT_EQ(Histogram::bucket_count - 1,
+	    Histogram::bucket_of(std::numeric_limits<uint64_t>::max()));
+}
+
+
+TEST(ProfileHistogram, percentiles) {
+  Histogram h;
+  EXPECT_EQ(0u, h.snapshot().get_count());
+  EXPECT_EQ(0u, h.snapshot().get_percentile(0.99));
+
+  for (uint64_t v = 1; v <= 10000; ++v) {
+    h.record(v);
+  }
+  Histogram::Snapshot snap = h.snapshot();
+  EXPECT_EQ(10000u, snap.get_count());
+  EXPECT_EQ(1u, snap.get_low());
+  EXPECT_EQ(10000u, snap.get_high());
+  EXPECT_DOUBLE_EQ(5000.5, snap.get_mean());
+
+  auto near = [] (uint64_t expected, uint64_t actual) {
+    return actual >= expected && actual <= expected + expected / 8;
+  };
+  EXPECT_TRUE(near(5000, snap.get_percentile(0.5)));
+  EXPECT_TRUE(near(9900, snap.get_percentile(0.99)));
+  EXPECT_TRUE(near(9990, snap.get_percentile(0.999)));
+  EXPECT_EQ(10000u, snap.get_percentile(1.0));
+  EXPECT_EQ(1u, snap.get_percentile(0.0));
+
+  // a slow outlier shows in the tail but not the median
+  Histogram other;
+  other.record(1000000);
+  snap.combine(other);
+  EXPECT_EQ(10001u, snap.get_count());
+  EXPECT_EQ(1000000u, snap.get_high());
+  EXPECT_TRUE(near(5000, snap.get_percentile(0.5)));
+  EXPECT_EQ(1000000u, snap.get_percentile(1.0));
+}
+
+
+TEST(ProfileHistogram, threads) {
+  Histogram h;
+  constexpr int thread_count = 12;
+  constexpr int per_thread = 20000;
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&h, t] {
+	for (int i = 0; i < per_thread; ++i) {
+	  h.record(t + 1);
+	}
+      });
+  }
+  // snapshots while recording never see more than was recorded
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_GE(uint64_t(thread_count * per_thread), h.snapshot().get_count());
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  Histogram::Snapshot snap = h.snapshot();
+  EXPECT_EQ(uint64_t(thread_count * per_thread), snap.get_count());
+  EXPECT_EQ(uint64_t(per_thread) * thread_count * (thread_count + 1) / 2,
+	    snap.get_sum());
+  EXPECT_EQ(1u, snap.get_low());
+  EXPECT_EQ(uint64_t(thread_count), snap.get_high());
+}
+
+
+TEST(ProfileHistogram, timing) {
+  Histogram h;
+  auto start = h.start();
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  h.stop(start);
+  Histogram::Snapshot snap = h.snapshot();
+  EXPECT_EQ(1u, snap.get_count());
+  EXPECT_LE(2000000u, snap.get_high());
+}
+
+
+TEST(ProfileCombiner, low_and_high) {
+  crimson::ProfileTimer<std::chrono::nanoseconds> middle;
+  crimson::ProfileTimer<std::chrono::nanoseconds> wide;
+  // wide margins, since an empty interval can still be preempted
+  middle.start();
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  middle.stop();
+  wide.start();
+  wide.stop();
+  wide.start();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  wide.stop();
+  ASSERT_LT(wide.get_low(), middle.get_low());
+  ASSERT_GT(wide.get_high(), middle.get_high());
+
+  // the second timer extends the range at both ends
+  crimson::ProfileCombiner<std::chrono::nanoseconds> combiner;
+  combiner.combine(middle);
+  combiner.combine(wide);
+  EXPECT_EQ(3u, combiner.get_count());
+  EXPECT_EQ(wide.get_low(), combiner.get_low());
+  EXPECT_EQ(wide.get_high(), combiner.get_high());
+}
@@ -0,0 +1,181 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+#include <memory>
+#include <deque>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "small_ring.h"
+#include "free_list_pool.h"
+
+
+TEST(SmallRing, inline_then_spill) {
+  crimson::SmallRing<std::unique_ptr<int>,2> r;
+
+  EXPECT_TRUE(r.empty());
+  EXPECT_TRUE(r.is_inline());
+
+  r.emplace_back(new int(1));
+  r.emplace_back(new int(2));
+  EXPECT_TRUE(r.is_inline()) << "two elements fit inline";
+
+  // wrap around within the inline storage
+  r.pop_front();
+  r.emplace_back(new int(3));
+  EXPECT_TRUE(r.is_inline());
+  EXPECT_EQ(2, *r.front());
+
+  r.emplace_back(new int(4));
+  r.emplace_back(new int(5));
+  EXPECT_FALSE(r.is_inline()) << "a third element spills to the heap";
+  EXPECT_EQ(4u, r.size());
+  EXPECT_EQ(4u, r.capacity());
+
+  std::vector<int> seen;
+  for (const auto& p : r) {
+    seen.push_back(*p);
+  }
+  EXPECT_EQ(std::vector<int>({2, 3, 4, 5}), seen);
+  EXPECT_EQ(5, *r.back());
+
+  while (!r.empty()) {
+    r.pop_front();
+  }
+  EXPECT_TRUE(r.is_inline()) << "draining returns to inline storage";
+}
+
+
+TEST(SmallRing, erase_matches_deque) {
+  crimson::FreeListPool pool;
+  crimson::PoolAllocator<int> alloc(pool);
+  crimson::SmallRing<int,4,crimson::PoolAllocator<int>> r(alloc);
+  std::deque<int> d;
+
+  // offset the head so erasing has to cope with wrapping
+  for (int i = 0; i < 3; ++i) {
+    r.emplace_back(-1);
+    r.pop_front();
+  }
+  for (int i = 0; i < 20; ++i) {
+    r.emplace_back(i);
+    d.push_back(i);
+  }
+
+  // erase multiples of three going forwards
+  for (auto i = r.begin(); i != r.end(); /* no inc */) {
+    if (0 == *i % 3) {
+      i = r.erase(i);
+    } else {
+      ++i;
+    }
+  }
+  for (auto i = d.begin(); i != d.end(); /* no inc */) {
+    if (0 == *i % 3) {
+      i = d.erase(i);
+    } else {
+      ++i;
+    }
+  }
+
+  // erase multiples of two going backwards, as ClientRec does
+  for (auto i = r.rbegin(); i != r.rend(); /* no inc */) {
+    if (0 == *i % 2) {
+      i = decltype(i){ r.erase(std::next(i).base()) };
+    } else {
+      ++i;
+    }
+  }
+  for (auto i = d.rbegin(); i != d.rend(); /* no inc */) {
+    if (0 == *i % 2) {
+      i = decltype(i){ d.erase(std::next(i).base()) };
+    } else {
+      ++i;
+    }
+  }
+
+  EXPECT_EQ(std::vector<int>(d.begin(), d.end()),
+	    std::vector<int>(r.begin(), r.end()));
+
+  r.clear();
+  EXPECT_TRUE(r.empty());
+  EXPECT_TRUE(r.is_inline());
+}
+
+
+namespace {
+  // counts the moves erase makes to close the gap
+  struct MoveCounter {
+    static int moves;
+    int value;
+
+    MoveCounter(int _value) : value(_value) {}
+    MoveCounter(MoveCounter&& other) : value(other.value) {}
+    MoveCounter& operator=(MoveCounter&& other) {
+      ++moves;
+      value = other.value;
+      return *this;
+    }
+  };
+  int MoveCounter::moves = 0;
+}
+
+
+TEST(SmallRing, erase_shifts_shorter_side) {
+  crimson::SmallRing<MoveCounter,8> r;
+  std::deque<int> d;
+  for (int i = 0; i < 40; ++i) {
+    r.emplace_back(i);
+    d.push_back(i);
+  }
+
+  auto check = [&] () {
+    std::vector<int> values;
+    for (auto& m : r) {
+      values.push_back(m.value);
+    }
+    EXPECT_EQ(std::vector<int>(d.begin(), d.end()), values);
+  };
+
+  MoveCounter::moves = 0;
+  auto i = r.erase(r.begin());
+  d.erase(d.begin());
+  EXPECT_EQ(0, MoveCounter::moves) << "erasing the front moves nothing";
+  EXPECT_EQ(1, i->value);
+  check();
+
+  i = r.erase(std::prev(r.end()));
+  d.pop_back();
+  EXPECT_EQ(0, MoveCounter::moves) << "erasing the back moves nothing";
+  EXPECT_TRUE(r.end() == i);
+  check();
+
+  // 38 left; the third and third-last only shift two each
+  i = r.erase(std::next(r.begin(), 2));
+  d.erase(std::next(d.begin(), 2));
+  EXPECT_EQ(2, MoveCounter::moves);
+  EXPECT_EQ(4, i->value);
+  i = r.erase(std::prev(r.end(), 3));
+  d.erase(std::prev(d.end(), 3));
+  EXPECT_EQ(4, MoveCounter::moves);
+  EXPECT_EQ(37, i->value);
+  check();
+
+  // the middle shifts half
+  MoveCounter::moves = 0;
+  r.erase(std::next(r.begin(), 18));
+  d.erase(std::next(d.begin(), 18));
+  EXPECT_EQ(17, MoveCounter::moves);
+  check();
+}
@@ -0,0 +1,180 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Copyright (C) 2017 Red Hat Inc.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 2.1, as published by the Free Software Foundation.  See file
+ * COPYING.
+ */
+
+
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "timer_wheel.h"
+
+
+namespace chrono = std::chrono;
+using Wheel = crimson::TimerWheel;
+
+
+TEST(TimerWheel, arm_and_rearm) {
+  Wheel wheel(chrono::microseconds(500));
+
+  std::atomic<int> runs(0);
+  std::atomic<bool> early(false);
+  Wheel::TimePoint due;
+
+  Wheel::TimerId id = wheel.add([&] {
+      if (Wheel::Clock::now() < due) {
+	early = true;
+      }
+      ++runs;
+    });
+  EXPECT_EQ(1u, wheel.size());
+
+  due = Wheel::Clock::now() + chrono::milliseconds(20);
+  wheel.arm(id, due);
+  wheel.arm_by(id, due + chrono::milliseconds(500));
+  std::this_thread::sleep_for(chrono::milliseconds(100));
+  EXPECT_EQ(1, runs.load()) <<
+    "arm_by with a later time leaves the earlier arming alone";
+
+  // arm far out, then pull it in
+  due = Wheel::Clock::now() + chrono::milliseconds(10);
+  wheel.arm(id, due + chrono::seconds(100));
+  wheel.arm_by(id, due);
+  std::this_thread::sleep_for(chrono::milliseconds(100));
+  EXPECT_EQ(2, runs.load());
+
+  wheel.arm(id, Wheel::Clock::now() + chrono::milliseconds(10));
+  wheel.disarm(id);
+  std::this_thread::sleep_for(chrono::milliseconds(50));
+  EXPECT_EQ(2, runs.load()) << "a disarmed timer does not run";
+
+  EXPECT_FALSE(early.load()) << "timers never run before they're due";
+
+  wheel.remove(id);
+  EXPECT_EQ(0u, wheel.size());
+}
+
+
+TEST(TimerWheel, order_across_levels) {
+  // with 10us ticks, timers 1ms to 100ms out span three levels
+  Wheel wheel(chrono::microseconds(10));
+
+  std::mutex mtx;
+  std::vector<int> order;
+  std::atomic<int> early(0);
+
+  const auto now = Wheel::Clock::now();
+  const int delays_ms[] = { 90, 3, 40, 1, 65, 12 };
+  std::vector<Wheel::TimerId> ids;
+  for (int d : delays_ms) {
+    const auto due = now + chrono::milliseconds(d);
+    Wheel::TimerId id = wheel.add([&, d, due] {
+	if (Wheel::Clock::now() < due) {
+	  ++early;
+	}
+	std::lock_guard<std::mutex> g(mtx);
+	order.push_back(d);
+      });
+    wheel.arm(id, due);
+    ids.push_back(id);
+  }
+
+  std::this_thread::sleep_for(chrono::milliseconds(200));
+
+  std::lock_guard<std::mutex> g(mtx);
+  EXPECT_EQ(std::vector<int>({ 1, 3, 12, 40, 65, 90 }), order);
+  EXPECT_EQ(0, early.load());
+
+  for (auto id : ids) {
+    wheel.remove(id);
+  }
+}
+
+
+// processing the last tick before a level 1 slot's span leaves the
+// wheel at the start of that span, with the slot still to be moved
+// down
+TEST(TimerWheel, cascade_at_span_start) {
+  struct TestWheel : public Wheel {
+    using Wheel::Wheel;
+    using Wheel::start;
+  };
+  TestWheel wheel(chrono::milliseconds(1));
+
+  std::atomic<bool> ran(false);
+  Wheel::TimerId edge = wheel.add([] {});
+  Wheel::TimerId later = wheel.add([&ran] { ran = true; });
+  wheel.arm(edge, wheel.start + chrono::milliseconds(63));
+  wheel.arm(later, wheel.start + chrono::milliseconds(100));
+
+  const auto end = Wheel::Clock::now() + chrono::seconds(1);
+  while (!ran && Wheel::Clock::now() < end) {
+    std::this_thread::sleep_for(chrono::milliseconds(5));
+  }
+  EXPECT_TRUE(ran.load()) <<
+    "a timer in the slot after the edge runs on time, not a turn later";
+
+  wheel.remove(edge);
+  wheel.remove(later);
+}
+
+
+TEST(TimerWheel, periodic_and_remove) {
+  Wheel wheel(chrono::microseconds(100));
+
+  std::atomic<int> runs(0);
+  Wheel::TimerId id =
+    wheel.add_every(chrono::milliseconds(5), [&runs] { ++runs; });
+
+  std::this_thread::sleep_for(chrono::milliseconds(100));
+  wheel.remove(id);
+  const int seen = runs.load();
+  EXPECT_LE(5, seen);
+  EXPECT_GE(20, seen);
+
+  std::this_thread::sleep_for(chrono::milliseconds(30));
+  EXPECT_EQ(seen, runs.load()) << "nothing runs once removed";
+}
+
+
+TEST(TimerWheel, remove_waits_for_callback) {
+  Wheel wheel(chrono::microseconds(100));
+
+  std::atomic<bool> started(false);
+  std::atomic<bool> finished(false);
+  Wheel::TimerId id = wheel.add([&] {
+      started = true;
+      std::this_thread::sleep_for(chrono::milliseconds(50));
+      finished = true;
+    });
+  wheel.arm(id, Wheel::Clock::now());
+
+  while (!started) {
+    std::this_thread::yield();
+  }
+  wheel.remove(id);
+  EXPECT_TRUE(finished.load());
+
+  // a callback may remove its own timer
+  std::atomic<int> runs(0);
+  std::atomic<Wheel::TimerId> self(Wheel::no_timer);
+  self = wheel.add_every(chrono::milliseconds(10), [&] {
+      ++runs;
+      wheel.remove(self);
+    });
+  std::this_thread::sleep_for(chrono::milliseconds(60));
+  EXPECT_EQ(1, runs.load());
+  EXPECT_EQ(0u, wheel.size());
+}
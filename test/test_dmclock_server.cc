@@ -17,8 +17,21 @@
 #include <chrono>
 #include <iostream>
 #include <list>
+#include <map>
+#include <algorithm>
 #include <vector>
-
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <poll.h>
+#endif
 
 #include "dmclock_server.h"
 #include "dmclock_util.h"
@@ -35,6 +48,20 @@ namespace dmc = crimson::dmclock;
 struct Request {
 };
 
+// a small request descriptor that the queues store by value
+struct InPlaceOp {
+  int id;
+
+  InPlaceOp(int _id = -1) : id(_id) {}
+};
+
+namespace crimson {
+  namespace dmclock {
+    template<>
+    struct RequestInPlace<InPlaceOp> : public std::true_type {};
+  }
+}
+
 
 namespace crimson {
   namespace dmclock {
@@ -180,6 +207,51 @@ namespace crimson {
     } // TEST
 
 
+    // more clients than are cleaned in one batch go idle and get
+    // erased, while the ones still in use stay
+    TEST(dmclock_server, client_erase_many) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &info;
+      };
+
+      Queue pq(client_info_f,
+	       std::chrono::milliseconds(100),
+	       std::chrono::milliseconds(200),
+	       std::chrono::milliseconds(20),
+	       false);
+
+      constexpr ClientId client_count = 5000;
+      constexpr ClientId kept_count = 10;
+
+      ReqParams req_params(1,1);
+      for (ClientId c = 0; c < client_count; ++c) {
+	pq.add_request(Request{}, c, req_params);
+      }
+      while (pq.pull_request().is_retn()) {
+	// empty
+      }
+      EXPECT_EQ(size_t(client_count), pq.client_count());
+
+      const auto end =
+	std::chrono::steady_clock::now() + std::chrono::milliseconds(500);
+      while (std::chrono::steady_clock::now() < end) {
+	for (ClientId c = 0; c < kept_count; ++c) {
+	  pq.add_request(Request{}, c, req_params);
+	  EXPECT_TRUE(pq.pull_request().is_retn());
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+
+      EXPECT_EQ(size_t(kept_count), pq.client_count()) <<
+	"only the clients still in use remain";
+      EXPECT_TRUE(pq.empty());
+    }
+
+
     TEST(dmclock_server, delayed_tag_calc) {
       using ClientId = int;
       constexpr ClientId client1 = 17;
@@ -225,6 +297,49 @@ namespace crimson {
       }
     }
 
+    // a request advances the reservation and limit tags by the larger
+    // of its op and byte charges
+    template<typename T>
+    static void test_request_tag_bytes() {
+      using Tag = dmc::BasicRequestTag<T>;
+      const Time t{100};
+      const Tag prev(T::from_time(t), T::from_time(t), T::from_time(t), t);
+
+      // 100 ops/s and 1 MB/s
+      dmc::ClientInfo limited(0.0, 1.0, 100.0, 0.0, 1.0e6);
+      Tag big(prev, limited, ReqParams(0, 0, 500000), t);
+      EXPECT_NEAR(t + 0.5, T::to_time(big.limit), 1e-9) <<
+	"bytes govern large requests";
+      EXPECT_EQ(500000u, big.bytes);
+      Tag small(prev, limited, ReqParams(0, 0, 1000), t);
+      EXPECT_NEAR(t + 0.01, T::to_time(small.limit), 1e-9) <<
+	"ops govern small requests";
+      Tag none(prev, limited, ReqParams(0, 0), t);
+      EXPECT_NEAR(t + 0.01, T::to_time(none.limit), 1e-9);
+      EXPECT_EQ(Tag::max_tag, big.reservation) << "still no reservation";
+
+      // a reservation and limit in bytes alone
+      dmc::ClientInfo bytes_only(0.0, 1.0, 0.0, 1.0e6, 2.0e6);
+      Tag both(prev, bytes_only, ReqParams(0, 0, 250000), t);
+      EXPECT_NEAR(t + 0.25, T::to_time(both.reservation), 1e-9);
+      EXPECT_NEAR(t + 0.125, T::to_time(both.limit), 1e-9);
+      EXPECT_NEAR(t + 1.0, T::to_time(both.proportion), 1e-9) <<
+	"weight is in ops only";
+
+      // a zero-byte request from a client with only a byte
+      // reservation is charged a byte rather than pinning every tag
+      dmc::ClientInfo resv_bytes_only(0.0, 0.0, 0.0, 1.0e6);
+      Tag empty(prev, resv_bytes_only, ReqParams(0, 0, 0), t);
+      EXPECT_NEAR(t + 1.0e-6, T::to_time(empty.reservation), 1e-9);
+      EXPECT_EQ(Tag::max_tag, empty.proportion);
+    }
+
+
+    TEST(dmclock_server, request_tag_bytes) {
+      test_request_tag_bytes<dmc::DoubleTags>();
+      test_request_tag_bytes<dmc::FixedPointTags>();
+    }
+
 #if 0
     TEST(dmclock_server, reservation_timing) {
       using ClientId = int;
@@ -591,6 +706,78 @@ namespace crimson {
     } // TEST
 
 
+
+    TEST(dmclock_server, remove_by_key) {
+      struct MyReq {
+	int id;
+
+	MyReq(int _id) :
+	  id(_id)
+	{
+	  // empty
+	}
+      }; // MyReq
+
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,MyReq>;
+      using MyReqRef = typename Queue::RequestRef;
+
+      ClientId client1 = 17;
+      ClientId client2 = 98;
+
+      dmc::ClientInfo info1(0.0, 1.0, 0.0);
+
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &info1;
+      };
+
+      Queue pq(client_info_f, true);
+
+      ReqParams req_params(1,1);
+      Time t = 100.0;
+
+      // the key of each request is its id divided by 10
+      pq.add_request_time(MyReq(71), client1, req_params, t, 1u, 7);
+      pq.add_request_time(MyReq(81), client1, req_params, t, 1u, 8);
+      pq.add_request_time(MyReq(72), client1, req_params, t, 1u, 7);
+      pq.add_request_time(MyReq(1), client1, req_params, t);
+      pq.add_request_time(MyReq(73), client2, req_params, t + 0.5, 1u, 7);
+      pq.add_request_time(MyReq(91), client2, req_params, t + 0.5, 1u, 9);
+
+      EXPECT_EQ(6u, pq.request_count());
+
+      std::vector<int> removed;
+      auto accum = [&removed] (MyReqRef&& r) {
+	removed.push_back(r->id);
+      };
+
+      EXPECT_EQ(3u, pq.remove_by_key(7, accum));
+      std::sort(removed.begin(), removed.end());
+      EXPECT_EQ(std::vector<int>({71, 72, 73}), removed);
+      EXPECT_EQ(3u, pq.request_count());
+      EXPECT_EQ(0u, pq.remove_by_key(7, accum)) <<
+	"a key's requests are only removed once";
+
+      // requests removed by a filter leave the index as well
+      pq.remove_by_req_filter([] (MyReqRef&& r) -> bool {
+	  return 81 == r->id;
+	});
+      EXPECT_EQ(0u, pq.remove_by_key(8, accum));
+
+      // as do requests that are pulled
+      std::vector<int> pulled;
+      for (int i = 0; i < 2; ++i) {
+	Queue::PullReq pr = pq.pull_request(t + 10);
+	ASSERT_TRUE(pr.is_retn());
+	pulled.push_back(pr.get_retn().request->id);
+      }
+      std::sort(pulled.begin(), pulled.end());
+      EXPECT_EQ(std::vector<int>({1, 91}), pulled);
+      EXPECT_EQ(0u, pq.remove_by_key(9, accum));
+      EXPECT_EQ(0u, pq.request_count());
+    } // TEST
+
+
     TEST(dmclock_server_pull, pull_weight) {
       using ClientId = int;
       using Queue = dmc::PullPriorityQueue<ClientId,Request>;
@@ -1068,5 +1255,1888 @@ namespace crimson {
       auto& retn = boost::get<Queue::PullReq::Retn>(pr.data);
       EXPECT_EQ(client1, retn.client);
     }
+
+
+    // a client of large requests held back by its byte limit leaves
+    // the server to a client of small ones
+    TEST(dmclock_server_pull, pull_bytes_limit) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+
+      constexpr ClientId big_client = 1;
+      constexpr ClientId small_client = 2;
+
+      dmc::ClientInfo big_info(0.0, 1.0, 0.0, 0.0, 1.0e6);
+      dmc::ClientInfo small_info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return big_client == c ? &big_info : &small_info;
+      };
+
+      Queue pq(client_info_f, false);
+
+      const Time t = dmc::get_time();
+      for (int i = 0; i < 3; ++i) {
+	pq.add_request_time(Request{}, big_client, ReqParams(0, 0, 1000000), t);
+	pq.add_request_time(Request{}, small_client, ReqParams(0, 0, 4096), t);
+      }
+
+      std::map<ClientId,int> served;
+      Queue::PullReq pr = pq.pull_request(t);
+      while (pr.is_retn()) {
+	++served[pr.get_retn().client];
+	pr = pq.pull_request(t);
+      }
+      EXPECT_EQ(1, served[big_client]) << "one megabyte per second";
+      EXPECT_EQ(3, served[small_client]);
+
+      ASSERT_TRUE(pr.is_future());
+      EXPECT_NEAR(t + 1.0, pr.getTime(), 1e-6);
+
+      pr = pq.pull_request(t + 1.0);
+      ASSERT_TRUE(pr.is_retn());
+      EXPECT_EQ(big_client, pr.get_retn().client);
+      EXPECT_TRUE(pq.pull_request(t + 1.0).is_future());
+    }
+
+
+    TEST(dmclock_server_pull, pull_bytes_reservation) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+
+      constexpr ClientId resv_client = 1;
+      constexpr ClientId other_client = 2;
+
+      dmc::ClientInfo resv_info(0.0, 1.0, 0.0, 1.0e6, 0.0);
+      dmc::ClientInfo other_info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return resv_client == c ? &resv_info : &other_info;
+      };
+
+      Queue pq(client_info_f, false);
+
+      const Time t = dmc::get_time();
+      for (int i = 0; i < 3; ++i) {
+	pq.add_request_time(Request{}, resv_client, ReqParams(0, 0, 500000), t);
+      }
+      pq.add_request_time(Request{}, other_client, ReqParams(0, 0), t);
+
+      // reservation tags fall at t, t + 0.5 and t + 1.0
+      for (int i = 0; i < 2; ++i) {
+	Queue::PullReq pr = pq.pull_request(t + 0.6);
+	ASSERT_TRUE(pr.is_retn());
+	EXPECT_EQ(resv_client, pr.get_retn().client);
+	EXPECT_EQ(PhaseType::reservation, pr.get_retn().phase);
+      }
+
+      Queue::PullReq pr = pq.pull_request(t + 0.6);
+      ASSERT_TRUE(pr.is_retn());
+      EXPECT_EQ(PhaseType::priority, pr.get_retn().phase);
+    }
+
+
+    // a client with only a byte reservation and no weight can send a
+    // request with no bytes
+    template<typename T>
+    static void test_zero_byte_request() {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request,true,false,2,
+					   dmc::HashClientMap,T>;
+
+      dmc::ClientInfo info(0.0, 0.0, 0.0, 1.0e6, 0.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &info;
+      };
+
+      Queue pq(client_info_f, false);
+
+      const Time t = 100.0;
+      pq.add_request_time(Request{}, 1, ReqParams(0, 0, 4096), t);
+      pq.add_request_time(Request{}, 1, ReqParams(0, 0, 0), t);
+      for (int i = 0; i < 2; ++i) {
+	typename Queue::PullReq pr = pq.pull_request(t + 1.0);
+	ASSERT_TRUE(pr.is_retn());
+	EXPECT_EQ(PhaseType::reservation, pr.get_retn().phase);
+      }
+      EXPECT_TRUE(pq.empty());
+    }
+
+
+    TEST(dmclock_server_pull, pull_zero_byte_request) {
+      test_zero_byte_request<dmc::DoubleTags>();
+      test_zero_byte_request<dmc::FixedPointTags>();
+    }
+
+
+    // the credit a weight dispatch gives toward the reservation
+    // leaves pinned reservation tags pinned
+    TEST(dmclock_server_pull, reservation_credit_keeps_pinned_tags) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request,false,true,2,
+					   dmc::HashClientMap,
+					   dmc::FixedPointTags>;
+
+      // the client gains a reservation after two requests are tagged
+      dmc::ClientInfo weight_only(0.0, 1.0, 0.0);
+      dmc::ClientInfo reserved(1.0, 1.0, 0.0);
+      const dmc::ClientInfo* info = &weight_only;
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return info;
+      };
+
+      Queue pq(client_info_f, false);
+      pq.enable_trace(8);
+
+      // tags are calculated, and the info looked up, on add
+      const Time t = 100.0;
+      for (int i = 0; i < 2; ++i) {
+	pq.add_request_time(Request{}, 1, ReqParams(1, 1), t);
+      }
+      info = &reserved;
+      pq.add_request_time(Request{}, 1, ReqParams(1, 1), t);
+
+      // the first two go by weight, each crediting a second to the
+      // third's reservation tag
+      const PhaseType phases[] = {
+	PhaseType::priority, PhaseType::priority, PhaseType::reservation };
+      for (PhaseType phase : phases) {
+	Queue::PullReq pr = pq.pull_request(t);
+	ASSERT_TRUE(pr.is_retn());
+	EXPECT_EQ(phase, pr.get_retn().phase);
+      }
+
+      std::vector<dmc::TraceEvent> events;
+      pq.get_trace(events);
+      ASSERT_EQ(6u, events.size());
+      EXPECT_EQ(dmc::TimeMax, events[3].reservation);
+      EXPECT_EQ(dmc::TimeMax, events[4].reservation) <<
+	"the credit from the first dispatch left it pinned";
+      EXPECT_EQ(t - 2.0, events[5].reservation);
+    }
+
+
+    TEST(dmclock_server_pull, pull_requests_batch) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+      using Retn = Queue::PullReq::Retn;
+
+      ClientId client1 = 17;
+      ClientId client2 = 98;
+
+      dmc::ClientInfo info1(0.0, 1.0, 0.0);
+      dmc::ClientInfo info2(0.0, 2.0, 0.0);
+
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	if (client1 == c) return &info1;
+	else if (client2 == c) return &info2;
+	else {
+	  ADD_FAILURE() << "client info looked up for non-existant client";
+	  return nullptr;
+	}
+      };
+
+      Queue pq(client_info_f, false);
+
+      ReqParams req_params(1,1);
+
+      auto now = dmc::get_time();
+
+      for (int i = 0; i < 5; ++i) {
+	pq.add_request_time(Request{}, client1, req_params, now);
+	pq.add_request_time(Request{}, client2, req_params, now, 2u);
+      }
+
+      std::vector<Retn> out;
+      Queue::PullBatch batch = pq.pull_requests(now, 6, out);
+      EXPECT_TRUE(batch.is_full());
+      EXPECT_EQ(6u, batch.count);
+      ASSERT_EQ(6u, out.size());
+      EXPECT_EQ(4u, pq.request_count());
+
+      int c1_count = 0;
+      int c2_count = 0;
+      for (auto& retn : out) {
+	if (client1 == retn.client) ++c1_count;
+	else if (client2 == retn.client) ++c2_count;
+	else ADD_FAILURE() << "got request from neither of two clients";
+	EXPECT_EQ(PhaseType::priority, retn.phase);
+	EXPECT_TRUE(retn.request);
+      }
+      // client2 has twice the weight but its requests cost twice as
+      // much, so each client is served about the same number of times
+      EXPECT_EQ(3, c1_count);
+      EXPECT_EQ(3, c2_count);
+
+      // pulling by cost stops before the budget would be exceeded
+      out.clear();
+      batch = pq.pull_requests_cost(now, 4, out);
+      EXPECT_TRUE(batch.is_full());
+      uint64_t total_cost = 0;
+      for (auto& retn : out) {
+	total_cost += retn.cost;
+      }
+      EXPECT_GE(4u, total_cost);
+      EXPECT_LT(2u, total_cost);
+
+      // draining the rest appends to what is in the vector already
+      size_t prior = out.size();
+      batch = pq.pull_requests(now, 100, out);
+      EXPECT_TRUE(batch.is_none());
+      EXPECT_EQ(prior + batch.count, out.size());
+      EXPECT_EQ(4u, out.size());
+      EXPECT_EQ(0u, pq.request_count());
+    } // dmclock_server_pull.pull_requests_batch
+
+    // with churn, records of erased clients are first used up so that
+    // the batch's clients are not allocated in the order they appear
+    static void test_add_requests_batch(bool churn) {
+      struct MyReq {
+	int id;
+
+	MyReq(int _id) :
+	  id(_id)
+	{
+	  // empty
+	}
+      }; // MyReq
+
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,MyReq>;
+      using AddReq = Queue::AddReq;
+      using MyReqRef = Queue::RequestRef;
+
+      ClientId client1 = 17;
+      ClientId client2 = 98;
+      ClientId client3 = 52;
+
+      dmc::ClientInfo info1(0.0, 1.0, 0.0);
+      dmc::ClientInfo info2(0.0, 2.0, 0.0);
+      dmc::ClientInfo info3(1.0, 1.0, 0.0);
+      dmc::ClientInfo churn_info(0.0, 1.0, 0.0);
+
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	if (client1 == c) return &info1;
+	else if (client2 == c) return &info2;
+	else if (client3 == c) return &info3;
+	else if (c >= 1000) return &churn_info;
+	else {
+	  ADD_FAILURE() << "client info looked up for non-existant client";
+	  return nullptr;
+	}
+      };
+
+      Queue pq_single(client_info_f,
+		      std::chrono::milliseconds(100),
+		      std::chrono::milliseconds(200),
+		      std::chrono::milliseconds(20),
+		      false);
+      Queue pq_batch(client_info_f,
+		     std::chrono::milliseconds(100),
+		     std::chrono::milliseconds(200),
+		     std::chrono::milliseconds(20),
+		     false);
+
+      if (churn) {
+	const ReqParams churn_params(1,1);
+	for (ClientId c = 1000; c < 1064; ++c) {
+	  pq_single.add_request(MyReq(-1), c, churn_params);
+	  pq_batch.add_request(MyReq(-1), c, churn_params);
+	}
+	while (pq_single.pull_request().is_retn()) {
+	  // empty
+	}
+	while (pq_batch.pull_request().is_retn()) {
+	  // empty
+	}
+
+	const auto end =
+	  std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while ((pq_single.client_count() || pq_batch.client_count()) &&
+	       std::chrono::steady_clock::now() < end) {
+	  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	}
+	ASSERT_EQ(0u, pq_single.client_count());
+	ASSERT_EQ(0u, pq_batch.client_count());
+      }
+
+      const ClientId order[] = { client1, client2, client1, client3, client2,
+				 client2, client1, client3, client2, client1 };
+      const ReqParams req_params(1,1);
+      auto now = dmc::get_time();
+
+      std::vector<AddReq> batch;
+      int id = 0;
+      for (auto c : order) {
+	pq_single.add_request_time(MyReq(id), c, req_params, now);
+	batch.emplace_back(c, MyReqRef(new MyReq(id)), req_params);
+	++id;
+      }
+      pq_batch.add_requests(batch.begin(), batch.end(), now);
+
+      EXPECT_EQ(3u, pq_batch.client_count());
+      EXPECT_EQ(10u, pq_batch.request_count());
+
+      for (int i = 0; i < 10; ++i) {
+	Queue::PullReq pr_single = pq_single.pull_request(now);
+	Queue::PullReq pr_batch = pq_batch.pull_request(now);
+	ASSERT_TRUE(pr_single.is_retn());
+	ASSERT_TRUE(pr_batch.is_retn());
+	auto& retn_single = pr_single.get_retn();
+	auto& retn_batch = pr_batch.get_retn();
+	if (0 == i) {
+	  EXPECT_EQ(client3, retn_batch.client) <<
+	    "reservation is served first";
+	  EXPECT_EQ(PhaseType::reservation, retn_batch.phase);
+	}
+	EXPECT_EQ(retn_single.client, retn_batch.client) <<
+	  "batch add schedules the same as adding one at a time";
+	EXPECT_EQ(retn_single.phase, retn_batch.phase);
+	EXPECT_EQ(retn_single.request->id, retn_batch.request->id) <<
+	  "requests of a client keep their order within a batch";
+      }
+
+      EXPECT_TRUE(pq_batch.pull_request(now).is_none());
+    }
+
+
+    TEST(dmclock_server_pull, add_requests_batch) {
+      test_add_requests_batch(false);
+      test_add_requests_batch(true);
+    } // dmclock_server_pull.add_requests_batch
+
+    // weight-based scheduling must not depend on how client records
+    // are indexed
+    template<typename M>
+    static void test_client_map_policy() {
+      using ClientId = uint;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request,true,false,2,M>;
+
+      ClientId client1 = 3;
+      ClientId client2 = 12;
+
+      dmc::ClientInfo info1(0.0, 1.0, 0.0);
+      dmc::ClientInfo info2(0.0, 2.0, 0.0);
+
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return client1 == c ? &info1 : &info2;
+      };
+
+      Queue pq(client_info_f, false);
+
+      ReqParams req_params(1,1);
+      for (int i = 0; i < 5; ++i) {
+	pq.add_request(Request{}, client1, req_params);
+	pq.add_request(Request{}, client2, req_params);
+      }
+      EXPECT_EQ(2u, pq.client_count());
+
+      int c1_count = 0;
+      int c2_count = 0;
+      for (int i = 0; i < 6; ++i) {
+	typename Queue::PullReq pr = pq.pull_request();
+	ASSERT_TRUE(pr.is_retn());
+	if (client1 == pr.get_retn().client) ++c1_count;
+	else ++c2_count;
+      }
+      EXPECT_EQ(2, c1_count);
+      EXPECT_EQ(4, c2_count);
+
+      pq.remove_by_client(client2);
+      EXPECT_EQ(3u, pq.request_count());
+    }
+
+
+    TEST(dmclock_server_pull, client_map_policies) {
+      test_client_map_policy<dmc::HashClientMap>();
+      test_client_map_policy<dmc::OrderedClientMap>();
+      test_client_map_policy<dmc::DenseClientMap>();
+    }
+
+    // runs a mix of reservation, weight, and limit constrained clients
+    // and returns who was served in which phase, followed by when the
+    // queue says to come back
+    template<typename T>
+    static std::vector<std::pair<int,PhaseType>> run_tag_policy(Time& when) {
+      using ClientId = int;
+      using Queue =
+	dmc::PullPriorityQueue<ClientId,Request,true,false,2,
+			       dmc::HashClientMap,T>;
+
+      // inverses that are exact in both binary and nanoseconds
+      dmc::ClientInfo info1(2.0, 1.0, 0.0);
+      dmc::ClientInfo info2(0.0, 2.0, 4.0);
+      dmc::ClientInfo info3(0.0, 4.0, 8.0);
+
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return 1 == c ? &info1 : (2 == c ? &info2 : &info3);
+      };
+
+      Queue pq(client_info_f, false);
+
+      ReqParams req_params(1,1);
+      Time t = 1000.0;
+      for (int i = 0; i < 8; ++i) {
+	for (ClientId c = 1; c <= 3; ++c) {
+	  pq.add_request_time(Request{}, c, req_params, t);
+	}
+	t += 0.125;
+      }
+
+      std::vector<std::pair<int,PhaseType>> result;
+      while (true) {
+	typename Queue::PullReq pr = pq.pull_request(t);
+	if (!pr.is_retn()) {
+	  EXPECT_TRUE(pr.is_future());
+	  when = pr.getTime();
+	  break;
+	}
+	result.emplace_back(pr.get_retn().client, pr.get_retn().phase);
+      }
+      return result;
+    }
+
+
+    TEST(dmclock_server_pull, fixed_point_tags) {
+      Time double_when;
+      Time fixed_when;
+      auto double_served = run_tag_policy<dmc::DoubleTags>(double_when);
+      auto fixed_served = run_tag_policy<dmc::FixedPointTags>(fixed_when);
+
+      EXPECT_LT(0u, fixed_served.size());
+      EXPECT_GT(24u, fixed_served.size()) << "limits hold some requests back";
+      EXPECT_EQ(double_served, fixed_served) <<
+	"integer tags schedule the same as double tags";
+      EXPECT_EQ(double_when, fixed_when);
+    }
+
+    // a queue tags requests using the time from its clock source, so
+    // the time it says to come back is in that clock's terms
+    template<typename K>
+    static void test_clock_source() {
+      using ClientId = int;
+      using Queue =
+	dmc::PullPriorityQueue<ClientId,Request,true,false,2,
+			       dmc::HashClientMap,dmc::DoubleTags,K>;
+
+      Time prev = K::now();
+      for (int i = 0; i < 100; ++i) {
+	Time t = K::now();
+	EXPECT_LE(prev, t) << "clock never goes backwards";
+	prev = t;
+      }
+      EXPECT_NEAR(dmc::MonotonicClock::now(), K::now(), 0.05);
+
+      dmc::ClientInfo info(0.0, 1.0, 1.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &info;
+      };
+
+      Queue pq(client_info_f, false);
+
+      ReqParams req_params(1,1);
+      pq.add_request(Request{}, 1, req_params);
+      pq.add_request(Request{}, 1, req_params);
+
+      const Time start = K::now();
+      EXPECT_TRUE(pq.pull_request().is_retn());
+      typename Queue::PullReq pr = pq.pull_request();
+      ASSERT_TRUE(pr.is_future()) << "limit holds back the second request";
+      EXPECT_LT(start, pr.getTime());
+      EXPECT_GT(start + 3.0, pr.getTime());
+    }
+
+
+    TEST(dmclock_server_pull, clock_sources) {
+      test_clock_source<dmc::MonotonicClock>();
+      test_clock_source<dmc::MonotonicCoarseClock>();
+      test_clock_source<dmc::TscClock>();
+    }
+
+    // adds, removes, and pulls requests for many clients with
+    // differing reservations, weights, and limits, and returns who was
+    // served in which phase
+    template<typename H, typename A = dmc::PooledAllocation>
+    static std::vector<std::pair<int,PhaseType>> run_heap_policy() {
+      using ClientId = int;
+      using Queue =
+	dmc::PullPriorityQueue<ClientId,Request,true,false,3,
+			       dmc::HashClientMap,dmc::DoubleTags,
+			       dmc::RealtimeClock,H,dmc::AllPhases,A>;
+
+      std::vector<dmc::ClientInfo> infos;
+      for (int c = 0; c < 40; ++c) {
+	infos.emplace_back(c % 4 ? 0.0 : 5.0 + c,
+			   1.0 + c % 7,
+			   c % 3 ? 0.0 : 20.0 + c);
+      }
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &infos[c];
+      };
+
+      Queue pq(client_info_f, false);
+
+      std::vector<std::pair<int,PhaseType>> result;
+      ReqParams req_params(1,1);
+      Time t = 1000.0;
+      for (int round = 0; round < 50; ++round) {
+	for (ClientId c = round % 5; c < 40; c += 1 + round % 3) {
+	  pq.add_request_time(Request{}, c, req_params, t);
+	}
+	if (round % 10 == 9) {
+	  pq.remove_by_client(round % 40);
+	}
+	t += 0.05;
+	for (int i = 0; i < 12; ++i) {
+	  typename Queue::PullReq pr = pq.pull_request(t);
+	  if (!pr.is_retn()) break;
+	  result.emplace_back(pr.get_retn().client, pr.get_retn().phase);
+	}
+      }
+      return result;
+    }
+
+
+    TEST(dmclock_server_pull, heap_policies) {
+      auto indirect_served = run_heap_policy<dmc::IndirectHeap>();
+      auto keyed_served = run_heap_policy<dmc::KeyCachingHeap>();
+
+      EXPECT_LT(100u, keyed_served.size());
+      EXPECT_EQ(indirect_served, keyed_served) <<
+	"caching keys in the heap doesn't change the schedule";
+    }
+
+
+    TEST(dmclock_server_pull, allocation_policies) {
+      auto pooled_served =
+	run_heap_policy<dmc::IndirectHeap,dmc::PooledAllocation>();
+      auto heap_served =
+	run_heap_policy<dmc::IndirectHeap,dmc::HeapAllocation>();
+
+      EXPECT_LT(100u, heap_served.size());
+      EXPECT_EQ(pooled_served, heap_served) <<
+	"where records are allocated doesn't change the schedule";
+    }
+
+
+    // serves requests from clients with the given infos and returns
+    // who was served in which phase
+    template<typename P>
+    static std::vector<std::pair<int,PhaseType>>
+    run_phase_policy(const std::vector<dmc::ClientInfo>& infos) {
+      using ClientId = int;
+      using Queue =
+	dmc::PullPriorityQueue<ClientId,Request,true,false,2,
+			       dmc::HashClientMap,dmc::DoubleTags,
+			       dmc::RealtimeClock,dmc::IndirectHeap,P>;
+
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &infos[c];
+      };
+
+      Queue pq(client_info_f, false);
+
+      std::vector<std::pair<int,PhaseType>> result;
+      ReqParams req_params(1,1);
+      Time t = 1000.0;
+      for (int round = 0; round < 20; ++round) {
+	for (ClientId c = 0; c < ClientId(infos.size()); ++c) {
+	  pq.add_request_time(Request{}, c, req_params, t);
+	}
+	t += 0.1;
+	for (int i = 0; i < 6; ++i) {
+	  typename Queue::PullReq pr = pq.pull_request(t);
+	  if (!pr.is_retn()) break;
+	  result.emplace_back(pr.get_retn().client, pr.get_retn().phase);
+	}
+      }
+      EXPECT_EQ(infos.size(), pq.client_count());
+      EXPECT_EQ(20 * infos.size() - result.size(), pq.request_count());
+      return result;
+    }
+
+
+    TEST(dmclock_server_pull, phase_policies) {
+      std::vector<dmc::ClientInfo> weights =
+	{ {0.0, 1.0, 0.0}, {0.0, 2.0, 0.0}, {0.0, 5.0, 0.0} };
+      auto all = run_phase_policy<dmc::AllPhases>(weights);
+      EXPECT_EQ(60u, all.size());
+      EXPECT_EQ(all, run_phase_policy<dmc::WeightOnly>(weights)) <<
+	"without reservations or limits weight-only queues agree";
+      EXPECT_EQ(all, run_phase_policy<dmc::NoLimit>(weights));
+      EXPECT_EQ(all, run_phase_policy<dmc::NoReservation>(weights));
+
+      std::vector<dmc::ClientInfo> reservations =
+	{ {10.0, 1.0, 0.0}, {0.0, 2.0, 0.0}, {20.0, 5.0, 0.0} };
+      auto resv = run_phase_policy<dmc::AllPhases>(reservations);
+      EXPECT_NE(resv.end(),
+		std::find_if(resv.begin(), resv.end(),
+			     [] (const std::pair<int,PhaseType>& p) {
+			       return PhaseType::reservation == p.second;
+			     }));
+      EXPECT_EQ(resv, run_phase_policy<dmc::NoLimit>(reservations));
+      for (const auto& p : run_phase_policy<dmc::WeightOnly>(reservations)) {
+	EXPECT_EQ(PhaseType::priority, p.second) <<
+	  "reservations are ignored when compiled out";
+      }
+
+      std::vector<dmc::ClientInfo> limits =
+	{ {0.0, 1.0, 5.0}, {0.0, 2.0, 0.0}, {0.0, 5.0, 10.0} };
+      auto lim = run_phase_policy<dmc::AllPhases>(limits);
+      EXPECT_GT(60u, lim.size()) << "limits hold some requests back";
+      EXPECT_EQ(lim, run_phase_policy<dmc::NoReservation>(limits));
+      EXPECT_EQ(60u, run_phase_policy<dmc::WeightOnly>(limits).size()) <<
+	"limits are ignored when compiled out";
+    }
+
+
+    // handle_f is called without the queue's lock held, so it may
+    // call back into the queue, and calls are never concurrent
+    TEST(dmclock_server, push_dispatch_outside_lock) {
+      using ClientId = int;
+      using Queue = dmc::PushPriorityQueue<ClientId,Request>;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &info;
+      };
+
+      constexpr int capacity = 4;
+      constexpr int per_thread = 2000;
+      constexpr int thread_count = 4;
+
+      std::atomic<int> outstanding(0);
+      std::atomic<int> in_handler(0);
+      std::atomic<int> served(0);
+      std::atomic<bool> overlapped(false);
+      Queue* queue = nullptr;
+
+      auto server_ready_f = [&] () -> bool {
+	return outstanding < capacity;
+      };
+      auto submit_req_f = [&] (const ClientId& c,
+			       std::unique_ptr<Request> req,
+			       dmc::PhaseType phase,
+			       uint64_t req_cost) {
+	if (in_handler++ > 0) {
+	  overlapped = true;
+	}
+	++outstanding;
+	++served;
+	// complete every other request right away, from within the
+	// handler; this would deadlock if the lock were held
+	if (served % 2) {
+	  --outstanding;
+	  --in_handler;
+	  queue->request_completed();
+	} else {
+	  --in_handler;
+	}
+      };
+
+      Queue pq(client_info_f, server_ready_f, submit_req_f, false);
+      queue = &pq;
+
+      std::vector<std::thread> threads;
+      for (int t = 0; t < thread_count; ++t) {
+	threads.emplace_back([&, t] {
+	    ReqParams req_params(1,1);
+	    for (int i = 0; i < per_thread; ++i) {
+	      pq.add_request(Request{}, t, req_params);
+	      if (0 == i % 8 && outstanding > 0) {
+		--outstanding;
+		pq.request_completed();
+	      }
+	    }
+	  });
+      }
+      for (auto& t : threads) {
+	t.join();
+      }
+
+      // drain what the server held back
+      while (served < thread_count * per_thread) {
+	if (outstanding > 0) {
+	  --outstanding;
+	}
+	pq.request_completed();
+      }
+
+      EXPECT_EQ(thread_count * per_thread, served.load());
+      EXPECT_FALSE(overlapped.load()) << "handle_f is never run concurrently";
+      EXPECT_TRUE(pq.empty());
+    }
+
+
+    // a handler that throws does not leave the queue unable to
+    // dispatch
+    TEST(dmclock_server, push_dispatch_throws) {
+      using ClientId = int;
+      using Queue = dmc::PushPriorityQueue<ClientId,Request>;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &info;
+      };
+
+      bool throw_next = true;
+      int served = 0;
+      auto server_ready_f = [] () -> bool { return true; };
+      auto submit_req_f = [&] (const ClientId& c,
+			       std::unique_ptr<Request> req,
+			       dmc::PhaseType phase,
+			       uint64_t req_cost) {
+	if (throw_next) {
+	  throw_next = false;
+	  throw std::runtime_error("handler failed");
+	}
+	++served;
+      };
+
+      Queue pq(client_info_f, server_ready_f, submit_req_f, false);
+
+      ReqParams req_params(1,1);
+      EXPECT_THROW(pq.add_request(Request{}, 1, req_params),
+		   std::runtime_error);
+
+      pq.add_request(Request{}, 1, req_params);
+      EXPECT_EQ(1, served) << "dispatching resumes after the exception";
+      EXPECT_TRUE(pq.empty());
+    }
+
+
+    // a queue whose handler is slow to run a timed dispatch does not
+    // hold up the timed dispatches of another queue
+    TEST(dmclock_server, push_sched_ahead_independent) {
+      using ClientId = int;
+      using Queue = dmc::PushPriorityQueue<ClientId,Request>;
+
+      dmc::ClientInfo slow_info(0.0, 1.0, 20.0);
+      dmc::ClientInfo fast_info(0.0, 1.0, 10.0);
+      auto slow_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &slow_info;
+      };
+      auto fast_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &fast_info;
+      };
+      auto server_ready_f = [] () -> bool { return true; };
+
+      std::atomic<int> slow_served(0);
+      std::atomic<int> fast_served(0);
+      std::atomic<double> fast_second(0.0);
+
+      auto slow_f = [&] (const ClientId& c,
+			 std::unique_ptr<Request> req,
+			 dmc::PhaseType phase,
+			 uint64_t req_cost) {
+	if (1 == slow_served++) {
+	  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	}
+      };
+      auto fast_f = [&] (const ClientId& c,
+			 std::unique_ptr<Request> req,
+			 dmc::PhaseType phase,
+			 uint64_t req_cost) {
+	if (1 == fast_served++) {
+	  fast_second = dmc::get_time();
+	}
+      };
+
+      Queue slow_pq(slow_info_f, server_ready_f, slow_f, false);
+      Queue fast_pq(fast_info_f, server_ready_f, fast_f, false);
+
+      // the second request of each is held back by its limit, until
+      // 50ms from now for slow_pq and 100ms for fast_pq
+      const Time start = dmc::get_time();
+      ReqParams req_params(1,1);
+      for (int i = 0; i < 2; ++i) {
+	slow_pq.add_request_time(Request{}, 1, req_params, start);
+	fast_pq.add_request_time(Request{}, 1, req_params, start);
+      }
+      EXPECT_EQ(1, slow_served.load());
+      EXPECT_EQ(1, fast_served.load());
+
+      const auto end =
+	std::chrono::steady_clock::now() + std::chrono::seconds(2);
+      while ((slow_served < 2 || fast_served < 2) &&
+	     std::chrono::steady_clock::now() < end) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      ASSERT_EQ(2, fast_served.load());
+      EXPECT_LT(fast_second - start, 0.4) <<
+	"slow_pq's handler does not delay fast_pq";
+    }
+
+
+    // one scheduling pass fills every free slot in the server
+    TEST(dmclock_server, push_fill_free_slots) {
+      using ClientId = int;
+      using Queue = dmc::PushPriorityQueue<ClientId,Request>;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &info;
+      };
+
+      int slots = 0;
+      int served = 0;
+      auto server_ready_f = [&] () -> bool { return slots > 0; };
+      auto submit_req_f = [&] (const ClientId& c,
+			       std::unique_ptr<Request> req,
+			       dmc::PhaseType phase,
+			       uint64_t req_cost) {
+	--slots;
+	++served;
+      };
+
+      Queue pq(client_info_f, server_ready_f, submit_req_f, false);
+
+      ReqParams req_params(1,1);
+      for (int i = 0; i < 20; ++i) {
+	pq.add_request(Request{}, i % 3, req_params);
+      }
+      EXPECT_EQ(0, served) << "server stalled";
+
+      slots = 8;
+      pq.request_completed(8);
+      EXPECT_EQ(8, served) << "a batch of completions fills every slot";
+      EXPECT_EQ(0, slots);
+
+      slots = 3;
+      pq.request_completed();
+      EXPECT_EQ(11, served) << "so does a single completion";
+
+      slots = 100;
+      pq.add_request(Request{}, 0, req_params);
+      EXPECT_EQ(21, served) << "and an add";
+      EXPECT_EQ(90, slots);
+      EXPECT_TRUE(pq.empty());
+    }
+
+
+    TEST(dmclock_server, push_key_caching_heap) {
+      using ClientId = int;
+      using Queue =
+	dmc::PushPriorityQueue<ClientId,Request,true,false,2,
+			       dmc::HashClientMap,dmc::DoubleTags,
+			       dmc::RealtimeClock,dmc::KeyCachingHeap>;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &info;
+      };
+
+      std::mutex mtx;
+      std::condition_variable cv;
+      int served = 0;
+      auto server_ready_f = [] () -> bool { return true; };
+      auto submit_req_f = [&] (const ClientId& c,
+			       std::unique_ptr<Request> req,
+			       dmc::PhaseType phase,
+			       uint64_t req_cost) {
+	std::lock_guard<std::mutex> l(mtx);
+	++served;
+	cv.notify_one();
+      };
+
+      Queue pq(client_info_f, server_ready_f, submit_req_f, false);
+
+      ReqParams req_params(1,1);
+      for (int i = 0; i < 10; ++i) {
+	pq.add_request(Request{}, i % 3, req_params);
+      }
+
+      std::unique_lock<std::mutex> l(mtx);
+      cv.wait_for(l, std::chrono::seconds(5), [&] { return served == 10; });
+      EXPECT_EQ(10, served);
+    }
+
+    // A client that becomes active after the others have built up a
+    // backlog should compete with the lowest proportion tag among
+    // them rather than from the current time.
+    TEST(dmclock_server_pull, idle_client_activation) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request,false>;
+
+      ClientId client1 = 17;
+      ClientId client2 = 98;
+      ClientId client3 = 33;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &info;
+      };
+
+      Queue pq(client_info_f, false);
+
+      ReqParams req_params(1,1);
+      Time t = 100.0;
+
+      for (int i = 0; i < 10; ++i) {
+	pq.add_request_time(Request{}, client1, req_params, t);
+	pq.add_request_time(Request{}, client2, req_params, t + 0.5);
+      }
+
+      for (int i = 0; i < 3; ++i) {
+	Queue::PullReq pr = pq.pull_request(t + 1);
+	ASSERT_TRUE(pr.is_retn());
+	EXPECT_NE(client3, pr.get_retn().client);
+      }
+
+      // client3's own proportion tag would be 200, far behind the
+      // 17 requests still queued
+      pq.add_request_time(Request{}, client3, req_params, t + 100);
+
+      int c3_count = 0;
+      for (int i = 0; i < 2; ++i) {
+	Queue::PullReq pr = pq.pull_request(t + 101);
+	ASSERT_TRUE(pr.is_retn());
+	if (client3 == pr.get_retn().client) ++c3_count;
+      }
+      EXPECT_EQ(1, c3_count) <<
+	"newly active client should be served among the next two requests";
+
+      EXPECT_EQ(16u, pq.request_count());
+    }
+
+
+    TEST(dmclock_server_pull, submission_ring) {
+      struct MyReq {
+	int id;
+
+	MyReq(int _id) :
+	  id(_id)
+	{
+	  // empty
+	}
+      }; // MyReq
+
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,MyReq>;
+
+      constexpr int producers = 4;
+      constexpr int per_producer = 2000;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &info;
+      };
+
+      Queue pq(client_info_f, false);
+      // small enough that producers sometimes find it full and fall
+      // back to taking the lock
+      pq.enable_submission_ring(16);
+
+      std::vector<std::thread> threads;
+      for (int t = 0; t < producers; ++t) {
+	threads.emplace_back([&pq, t] () {
+	    ReqParams req_params(1,1);
+	    for (int i = 0; i < per_producer; ++i) {
+	      pq.add_request(MyReq(i), t, req_params);
+	    }
+	  });
+      }
+
+      // each client's requests must come out in the order added
+      std::vector<int> next(producers, 0);
+      int pulled = 0;
+      while (pulled < producers * per_producer) {
+	Queue::PullReq pr = pq.pull_request();
+	if (!pr.is_retn()) {
+	  std::this_thread::yield();
+	  continue;
+	}
+	auto& retn = pr.get_retn();
+	EXPECT_EQ(next[retn.client], retn.request->id);
+	next[retn.client] = retn.request->id + 1;
+	++pulled;
+      }
+
+      for (auto& t : threads) {
+	t.join();
+      }
+
+      EXPECT_TRUE(pq.empty());
+      EXPECT_EQ(0u, pq.request_count());
+    }
+
+
+    TEST(dmclock_server_pull, pull_request_wait) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+      using Clock = std::chrono::steady_clock;
+      using std::chrono::milliseconds;
+
+      dmc::ClientInfo info(0.0, 1.0, 10.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &info;
+      };
+
+      Queue pq(client_info_f, false);
+      ReqParams req_params(1,1);
+
+      // nothing queued; waits out the timeout
+      auto start = Clock::now();
+      EXPECT_TRUE(pq.pull_request_wait(milliseconds(50)).is_none());
+      EXPECT_LE(milliseconds(50), Clock::now() - start);
+
+      // woken by an add
+      std::thread adder([&] {
+	  std::this_thread::sleep_for(milliseconds(50));
+	  pq.add_request(Request{}, 1, req_params);
+	});
+      start = Clock::now();
+      EXPECT_TRUE(pq.pull_request_wait(std::chrono::seconds(10)).is_retn());
+      EXPECT_GT(std::chrono::seconds(5), Clock::now() - start);
+      adder.join();
+
+      // woken when the limit lets the next request through, about
+      // 100ms after the first
+      pq.add_request(Request{}, 1, req_params);
+      start = Clock::now();
+      Queue::PullReq pr = pq.pull_request_wait(std::chrono::seconds(10));
+      EXPECT_TRUE(pr.is_retn());
+      EXPECT_LE(milliseconds(50), Clock::now() - start);
+      EXPECT_GT(std::chrono::seconds(5), Clock::now() - start);
+
+      // limited and timing out first returns when to come back
+      pq.add_request(Request{}, 1, req_params);
+      pr = pq.pull_request_wait(milliseconds(1));
+      EXPECT_TRUE(pr.is_future());
+    }
+
+
+    TEST(dmclock_server_pull, pull_request_wait_staged) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &info;
+      };
+
+      Queue pq(client_info_f, false);
+      pq.enable_submission_ring(16);
+
+      constexpr int workers = 3;
+      constexpr int total = 3000;
+      std::atomic<int> pulled(0);
+      std::vector<std::thread> threads;
+      for (int w = 0; w < workers; ++w) {
+	threads.emplace_back([&] {
+	    while (pulled < total) {
+	      if (pq.pull_request_wait(std::chrono::milliseconds(20)).is_retn()) {
+		++pulled;
+	      }
+	    }
+	  });
+      }
+
+      ReqParams req_params(1,1);
+      for (int i = 0; i < total; ++i) {
+	pq.add_request(Request{}, i % 5, req_params);
+	if (0 == i % 100) {
+	  std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+      }
+
+      for (auto& t : threads) {
+	t.join();
+      }
+      EXPECT_EQ(total, pulled.load());
+      EXPECT_TRUE(pq.empty());
+    }
+
+
+#ifdef __linux__
+    static bool fd_readable(int fd, int timeout_ms) {
+      struct pollfd p = { fd, POLLIN, 0 };
+      return 1 == ::poll(&p, 1, timeout_ms);
+    }
+
+
+    TEST(dmclock_server_pull, ready_fds) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+
+      dmc::ClientInfo info(0.0, 1.0, 10.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &info;
+      };
+
+      Queue pq(client_info_f, false);
+      ASSERT_TRUE(pq.enable_ready_fds());
+      const int efd = pq.ready_fd();
+      const int tfd = pq.timer_fd();
+
+      // readable at first so the loop takes a look
+      EXPECT_TRUE(fd_readable(efd, 0));
+      EXPECT_TRUE(pq.pull_request().is_none());
+      EXPECT_FALSE(fd_readable(efd, 0));
+      EXPECT_FALSE(fd_readable(tfd, 0));
+
+      ReqParams req_params(1,1);
+      pq.add_request(Request{}, 1, req_params);
+      EXPECT_TRUE(fd_readable(efd, 0));
+      pq.add_request(Request{}, 1, req_params);
+
+      EXPECT_TRUE(pq.pull_request().is_retn());
+      EXPECT_TRUE(fd_readable(efd, 0)) << "not cleared while returning";
+
+      // the second is held back by the limit, so the timer is armed
+      EXPECT_TRUE(pq.pull_request().is_future());
+      EXPECT_FALSE(fd_readable(efd, 0));
+      EXPECT_FALSE(fd_readable(tfd, 0));
+      EXPECT_TRUE(fd_readable(tfd, 5000));
+      EXPECT_TRUE(pq.pull_request().is_retn());
+
+      // nothing left, so the timer is disarmed and cleared
+      EXPECT_TRUE(pq.pull_request().is_none());
+      EXPECT_FALSE(fd_readable(tfd, 0));
+      EXPECT_FALSE(fd_readable(efd, 0));
+
+      // pulling in batches arms it in the same way
+      pq.add_request(Request{}, 1, req_params);
+      EXPECT_TRUE(fd_readable(efd, 0));
+      std::vector<Queue::PullReq::Retn> out;
+      Queue::PullBatch batch = pq.pull_requests(4, out);
+      EXPECT_TRUE(batch.is_future());
+      EXPECT_EQ(0u, batch.count);
+      EXPECT_FALSE(fd_readable(efd, 0));
+      EXPECT_TRUE(fd_readable(tfd, 5000));
+      batch = pq.pull_requests(4, out);
+      EXPECT_EQ(1u, batch.count);
+      EXPECT_TRUE(batch.is_none());
+      EXPECT_FALSE(fd_readable(tfd, 0));
+    }
+
+
+    // an event loop waiting on the fds never misses a staged request
+    TEST(dmclock_server_pull, ready_fds_staged) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &info;
+      };
+
+      Queue pq(client_info_f, false);
+      pq.enable_submission_ring(16);
+      ASSERT_TRUE(pq.enable_ready_fds());
+
+      constexpr int total = 3000;
+      std::thread producer([&] {
+	  ReqParams req_params(1,1);
+	  for (int i = 0; i < total; ++i) {
+	    pq.add_request(Request{}, i % 5, req_params);
+	    if (0 == i % 100) {
+	      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	    }
+	  }
+	});
+
+      int pulled = 0;
+      while (pulled < total) {
+	struct pollfd p[2] = { { pq.ready_fd(), POLLIN, 0 },
+			       { pq.timer_fd(), POLLIN, 0 } };
+	// a lost wakeup would leave us here until the timeout
+	ASSERT_LT(0, ::poll(p, 2, 10000)) << "pulled " << pulled;
+	while (pq.pull_request().is_retn()) {
+	  ++pulled;
+	}
+      }
+
+      producer.join();
+      EXPECT_EQ(total, pulled);
+      EXPECT_TRUE(pq.empty());
+    }
+#endif // __linux__
+
+
+    TEST(dmclock_server_pull, profiling) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &info;
+      };
+
+      Queue pq(client_info_f, false);
+      pq.add_request(Request{}, 1, ReqParams(1,1));
+      EXPECT_TRUE(pq.pull_request().is_retn());
+      EXPECT_FALSE(pq.add_request_timer) << "off by default";
+      EXPECT_FALSE(pq.pull_request_timer);
+
+      pq.enable_profiling();
+      for (int i = 0; i < 3; ++i) {
+	pq.add_request(Request{}, 1, ReqParams(1,1));
+      }
+      for (int i = 0; i < 4; ++i) {
+	pq.pull_request();
+      }
+      ASSERT_TRUE(pq.add_request_timer);
+      ASSERT_TRUE(pq.pull_request_timer);
+      EXPECT_EQ(3u, pq.add_request_timer->snapshot().get_count());
+      EXPECT_EQ(4u, pq.pull_request_timer->snapshot().get_count()) <<
+	"pulls that find nothing are timed too";
+    }
+
+
+    TEST(dmclock_server_pull, client_metrics) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+
+      ClientId reserved = 1;
+      ClientId weighted = 2;
+      ClientId limited = 3;
+      dmc::ClientInfo reserved_info(100.0, 1.0, 0.0);
+      dmc::ClientInfo weighted_info(0.0, 1.0, 0.0);
+      dmc::ClientInfo limited_info(0.0, 1.0, 1.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	if (reserved == c) return &reserved_info;
+	if (weighted == c) return &weighted_info;
+	return &limited_info;
+      };
+
+      Queue pq(client_info_f, true);
+
+      Queue::ClientMetrics m;
+      EXPECT_FALSE(pq.get_client_metrics(reserved, m)) << "off by default";
+      EXPECT_TRUE(pq.get_all_client_metrics().empty());
+
+      const dmc::Time t = dmc::get_time();
+      ReqParams req_params(1,1);
+      pq.add_request_time(Request{}, reserved, ReqParams(1, 1, 1000), t, 3);
+      pq.enable_client_metrics();
+      pq.add_request_time(Request{}, reserved, ReqParams(1, 1, 500), t, 5);
+      pq.add_request_time(Request{}, weighted, req_params, t);
+
+      ASSERT_TRUE(pq.get_client_metrics(reserved, m));
+      EXPECT_EQ(2u, m.queued) << "includes requests from before enabling";
+      EXPECT_EQ(8u, m.queued_cost);
+      EXPECT_EQ(1500u, m.queued_bytes);
+      EXPECT_EQ(0u, m.wait_us.count());
+
+      // both of reserved's requests are due by their reservation at
+      // once; weighted's waits for them
+      Queue::PullReq pr = pq.pull_request(t + 0.001);
+      ASSERT_TRUE(pr.is_retn());
+      EXPECT_EQ(reserved, pr.get_retn().client);
+      pr = pq.pull_request(t + 0.1);
+      ASSERT_TRUE(pr.is_retn());
+      EXPECT_EQ(reserved, pr.get_retn().client);
+      pr = pq.pull_request(t + 0.5);
+      ASSERT_TRUE(pr.is_retn());
+      EXPECT_EQ(weighted, pr.get_retn().client);
+
+      ASSERT_TRUE(pq.get_client_metrics(reserved, m));
+      EXPECT_EQ(0u, m.queued);
+      EXPECT_EQ(0u, m.queued_cost);
+      EXPECT_EQ(0u, m.queued_bytes);
+      EXPECT_EQ(2u, m.reservation_count);
+      EXPECT_EQ(0u, m.priority_count);
+      EXPECT_EQ(2u, m.wait_us.count());
+      EXPECT_EQ(100000u, m.wait_us.max());
+      EXPECT_GE(1024u, m.wait_us.percentile(0.5));
+
+      ASSERT_TRUE(pq.get_client_metrics(weighted, m));
+      EXPECT_EQ(0u, m.reservation_count);
+      EXPECT_EQ(1u, m.priority_count);
+      EXPECT_EQ(500000u, m.wait_us.max());
+
+      // the second of limited's requests is over its limit and only
+      // goes as a limit break
+      pq.add_request_time(Request{}, limited, req_params, t + 1);
+      pq.add_request_time(Request{}, limited, req_params, t + 1);
+      EXPECT_TRUE(pq.pull_request(t + 1).is_retn());
+      EXPECT_TRUE(pq.pull_request(t + 1).is_retn());
+      ASSERT_TRUE(pq.get_client_metrics(limited, m));
+      EXPECT_EQ(2u, m.priority_count);
+      EXPECT_EQ(1u, m.limit_break_count);
+      EXPECT_EQ(0u, m.wait_us.max());
+
+      Queue::SchedCounts counts = pq.sched_counts();
+      EXPECT_EQ(2u, counts.reservation);
+      EXPECT_EQ(3u, counts.priority);
+      EXPECT_EQ(1u, counts.limit_break);
+
+      auto all = pq.get_all_client_metrics();
+      ASSERT_EQ(3u, all.size());
+      uint64_t dispatched = 0;
+      for (const auto& c : all) {
+	dispatched += c.second.reservation_count + c.second.priority_count;
+      }
+      EXPECT_EQ(5u, dispatched);
+
+      // removals come off the queued totals too
+      for (int i = 0; i < 3; ++i) {
+	pq.add_request_time(Request{}, weighted, ReqParams(1, 1, 100), t + 2, 2);
+      }
+      bool first = true;
+      pq.remove_by_req_filter([&first] (std::unique_ptr<Request>&&) {
+	  const bool remove = first;
+	  first = false;
+	  return remove;
+	});
+      ASSERT_TRUE(pq.get_client_metrics(weighted, m));
+      EXPECT_EQ(2u, m.queued);
+      EXPECT_EQ(4u, m.queued_cost);
+      EXPECT_EQ(200u, m.queued_bytes);
+      pq.remove_by_client(weighted);
+      ASSERT_TRUE(pq.get_client_metrics(weighted, m));
+      EXPECT_EQ(0u, m.queued);
+      EXPECT_EQ(0u, m.queued_cost);
+      EXPECT_EQ(0u, m.queued_bytes);
+    }
+
+
+    TEST(dmclock_server_pull, trace) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+
+      dmc::ClientInfo reserved_info(1.0, 1.0, 0.0);
+      dmc::ClientInfo limited_info(0.0, 1.0, 1.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return 1 == c ? &reserved_info : &limited_info;
+      };
+
+      Queue pq(client_info_f, true);
+      pq.add_request_time(Request{}, 1, ReqParams(1,1), 50.0);
+
+      std::vector<dmc::TraceEvent> events;
+      pq.get_trace(events);
+      EXPECT_TRUE(events.empty()) << "off by default";
+
+      pq.enable_trace(5);
+      const dmc::Time t = 100.0;
+      pq.add_request_time(Request{}, 1, ReqParams(1,1), t, 7);
+      pq.add_request_time(Request{}, 2, ReqParams(1,1), t);
+      pq.add_request_time(Request{}, 2, ReqParams(1,1), t);
+      EXPECT_TRUE(pq.pull_request(t + 0.25).is_retn());
+      EXPECT_TRUE(pq.pull_request(t + 0.25).is_retn());
+      EXPECT_TRUE(pq.pull_request(t + 0.5).is_retn());
+      EXPECT_TRUE(pq.pull_request(t + 0.5).is_retn());
+
+      pq.get_trace(events);
+      ASSERT_EQ(7u, events.size());
+
+      EXPECT_EQ(dmc::TraceType::add, events[0].type);
+      EXPECT_EQ(std::hash<ClientId>()(1), events[0].client);
+      EXPECT_EQ(2u, events[0].client_depth);
+      EXPECT_EQ(1u, events[0].client_count);
+      EXPECT_EQ(7u, events[0].cost);
+      // tags are those of the first queued request
+      EXPECT_EQ(50.0, events[0].arrival);
+      EXPECT_EQ(t, events[0].now);
+
+      EXPECT_EQ(dmc::TraceType::add, events[2].type);
+      EXPECT_EQ(2u, events[2].client_depth);
+      EXPECT_EQ(2u, events[2].client_count);
+
+      // client 1's first request is due by reservation, as is its
+      // second, whose reservation tag is its arrival time
+      EXPECT_EQ(dmc::TraceType::reservation, events[3].type);
+      EXPECT_EQ(std::hash<ClientId>()(1), events[3].client);
+      EXPECT_EQ(1u, events[3].client_depth);
+      EXPECT_EQ(t + 0.25, events[3].now);
+      EXPECT_EQ(50.0, events[3].arrival);
+
+      EXPECT_EQ(dmc::TraceType::reservation, events[4].type);
+      EXPECT_EQ(t, events[4].reservation);
+
+      // client 2's first is within its limit and the second not
+      EXPECT_EQ(dmc::TraceType::priority, events[5].type);
+      EXPECT_TRUE(events[5].flags & dmc::TraceEvent::flag_ready);
+
+      EXPECT_EQ(dmc::TraceType::limit_break, events[6].type);
+      EXPECT_EQ(std::hash<ClientId>()(2), events[6].client);
+      EXPECT_FALSE(events[6].flags & dmc::TraceEvent::flag_ready);
+      EXPECT_EQ(0u, events[6].client_depth);
+
+      // the ring holds the most recent 8
+      for (int i = 0; i < 3; ++i) {
+	pq.add_request_time(Request{}, 3, ReqParams(1,1), t + 1);
+      }
+      events.clear();
+      pq.get_trace(events);
+      ASSERT_EQ(8u, events.size());
+      EXPECT_EQ(t, events[0].now);
+      EXPECT_EQ(3u, events.back().client_depth);
+
+      const std::string path = "dmclock_server_pull_trace.tmp";
+      ASSERT_TRUE(pq.dump_trace(path));
+      std::vector<dmc::TraceEvent> read;
+      ASSERT_TRUE(dmc::read_trace(path, read));
+      std::remove(path.c_str());
+      ASSERT_EQ(events.size(), read.size());
+      for (size_t i = 0; i < read.size(); ++i) {
+	EXPECT_EQ(0, memcmp(&events[i], &read[i], sizeof(read[i])));
+      }
+      EXPECT_FALSE(dmc::read_trace(path, read));
+    }
+
+
+    // an id type with operator< but no std::hash, as OrderedClientMap
+    // allows
+    struct OrderedId {
+      int id;
+      bool operator<(const OrderedId& other) const {
+	return id < other.id;
+      }
+      bool operator==(const OrderedId& other) const {
+	return id == other.id;
+      }
+    };
+
+
+    TEST(dmclock_server_pull, trace_unhashable_id) {
+      using Queue = dmc::PullPriorityQueue<OrderedId,Request,true,false,2,
+					   dmc::OrderedClientMap>;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (OrderedId c) -> const dmc::ClientInfo* {
+	return &info;
+      };
+
+      Queue pq(client_info_f, false);
+      pq.add_request_time(Request{}, OrderedId{1}, ReqParams(1,1), 10.0);
+      pq.enable_trace(4);
+      pq.add_request_time(Request{}, OrderedId{2}, ReqParams(1,1), 10.0);
+
+      Queue::PullReq pr = pq.pull_request(10.0);
+      ASSERT_TRUE(pr.is_retn());
+      EXPECT_EQ(1, pr.get_retn().client.id);
+
+      std::vector<dmc::TraceEvent> events;
+      pq.get_trace(events);
+      ASSERT_EQ(2u, events.size());
+      EXPECT_EQ(0u, events[0].client) << "recorded as 0 without a hash";
+      EXPECT_EQ(dmc::TraceType::priority, events[1].type);
+    }
+
+
+    // a clock tests can set
+    struct ManualClock {
+      static dmc::Time value;
+      static dmc::Time now() { return value; }
+    };
+    dmc::Time ManualClock::value = 0.0;
+
+
+    TEST(dmclock_server_pull, client_state_restore) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request,true,false,2,
+					   dmc::HashClientMap,dmc::DoubleTags,
+					   ManualClock>;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &info;
+      };
+      ReqParams req_params(1,1);
+
+      // client 1 has had five requests served, client 2 and client
+      // 3 one each
+      ManualClock::value = 1000.0;
+      Queue before(client_info_f, false);
+      for (int i = 0; i < 5; ++i) {
+	before.add_request_time(Request{}, 1, req_params, 1000.0);
+      }
+      before.add_request_time(Request{}, 2, req_params, 1000.0);
+      before.add_request_time(Request{}, 3, req_params, 1000.0);
+      for (int i = 0; i < 7; ++i) {
+	EXPECT_TRUE(before.pull_request(1000.0).is_retn());
+      }
+
+      const std::string path = "dmclock_server_pull_client_state.tmp";
+      ASSERT_TRUE(before.save_client_states(path));
+      std::vector<Queue::ClientState> saved;
+      EXPECT_EQ(1000.0, before.get_client_states(saved));
+      ASSERT_EQ(3u, saved.size());
+
+      // restarting with the clock much earlier
+      ManualClock::value = 50.0;
+      Queue after(client_info_f, false);
+      ASSERT_TRUE(after.load_client_states(path));
+      std::remove(path.c_str());
+      EXPECT_EQ(3u, after.client_count());
+      EXPECT_EQ(0u, after.request_count());
+
+      std::vector<Queue::ClientState> restored;
+      EXPECT_EQ(50.0, after.get_client_states(restored));
+      ASSERT_EQ(3u, restored.size());
+      auto find = [] (const std::vector<Queue::ClientState>& v,
+		      ClientId c) -> const Queue::ClientState& {
+	return *std::find_if(v.begin(), v.end(),
+			     [c] (const Queue::ClientState& s) {
+			       return c == s.client;
+			     });
+      };
+      for (ClientId c = 1; c <= 3; ++c) {
+	const auto& s = find(saved, c);
+	const auto& r = find(restored, c);
+	EXPECT_DOUBLE_EQ(s.proportion - 950.0, r.proportion);
+	EXPECT_DOUBLE_EQ(s.arrival - 950.0, r.arrival);
+	EXPECT_EQ(s.prop_delta, r.prop_delta);
+	EXPECT_EQ(s.idle, r.idle);
+      }
+      EXPECT_FALSE(find(restored, 2).idle);
+
+      // client 2 is owed service, so it goes first rather than the
+      // two alternating as new clients would
+      for (int i = 0; i < 3; ++i) {
+	after.add_request_time(Request{}, 1, req_params, 50.0);
+	after.add_request_time(Request{}, 2, req_params, 50.0);
+      }
+      for (int i = 0; i < 3; ++i) {
+	Queue::PullReq pr = after.pull_request(50.0);
+	ASSERT_TRUE(pr.is_retn());
+	EXPECT_EQ(2, pr.get_retn().client);
+      }
+
+      // a client the queue already knows keeps its own state
+      Queue known(client_info_f, false);
+      known.add_request_time(Request{}, 1, req_params, 50.0);
+      known.restore_client_states(saved, 1000.0);
+      EXPECT_EQ(3u, known.client_count());
+      EXPECT_EQ(1u, known.request_count());
+      std::vector<Queue::ClientState> kept;
+      known.get_client_states(kept);
+      EXPECT_EQ(50.0, find(kept, 1).proportion);
+
+      // idle clients stay idle until they have requests again
+      for (auto& s : saved) {
+	s.idle = (3 == s.client);
+      }
+      Queue idled(client_info_f, false);
+      idled.restore_client_states(saved, 1000.0);
+      std::vector<Queue::ClientState> idle_states;
+      idled.get_client_states(idle_states);
+      EXPECT_TRUE(find(idle_states, 3).idle);
+      EXPECT_FALSE(find(idle_states, 1).idle);
+      idled.add_request_time(Request{}, 3, req_params, 50.0);
+      Queue::PullReq pr = idled.pull_request(50.0);
+      ASSERT_TRUE(pr.is_retn());
+      EXPECT_EQ(3, pr.get_retn().client);
+
+      EXPECT_FALSE(after.load_client_states(path));
+    }
+
+
+    // restored idle clients do not hold up the erasure of clients
+    // that go idle after them
+    TEST(dmclock_server_pull, client_state_restore_cleaning) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &info;
+      };
+      ReqParams req_params(1,1);
+
+      std::vector<Queue::ClientState> saved;
+      Time taken_at;
+      {
+	Queue before(client_info_f, false);
+	before.add_request(Request{}, 9, req_params);
+	EXPECT_TRUE(before.pull_request().is_retn());
+	taken_at = before.get_client_states(saved);
+	ASSERT_EQ(1u, saved.size());
+	saved.front().idle = true;
+
+	const std::string path = "dmclock_server_pull_client_state.tmp";
+	ASSERT_TRUE(before.save_client_states(path));
+	FILE* f = fopen(path.c_str(), "rb");
+	ASSERT_NE(nullptr, f);
+	std::vector<char> bytes(sizeof(dmc::ClientStateHeader) +
+				sizeof(Queue::ClientState));
+	EXPECT_EQ(bytes.size(), fread(bytes.data(), 1, bytes.size(), f));
+	fclose(f);
+	std::remove(path.c_str());
+	const char* state = bytes.data() + sizeof(dmc::ClientStateHeader);
+	for (size_t i = offsetof(Queue::ClientState, idle) + 1;
+	     i < sizeof(Queue::ClientState);
+	     ++i) {
+	  EXPECT_EQ(0, state[i]) << "padding is written as zeros";
+	}
+      }
+
+      Queue pq(client_info_f, false);
+      pq.add_request(Request{}, 1, req_params);
+      EXPECT_TRUE(pq.pull_request().is_retn());
+      pq.add_request(Request{}, 2, req_params);
+      pq.restore_client_states(saved, taken_at);
+      EXPECT_EQ(3u, pq.client_count());
+
+      test_locked(pq.data_mtx, [&] () {
+	  const auto one_tick = pq.client_map.at(1)->last_tick;
+	  // client 1 goes idle, then is due to be erased, along with
+	  // the restored client 9
+	  EXPECT_FALSE(pq.clean_batch(0, one_tick));
+	  EXPECT_TRUE(pq.client_map.at(1)->idle);
+	  EXPECT_FALSE(pq.clean_batch(one_tick, 0));
+	  EXPECT_EQ(0u, pq.client_map.count(9));
+	  EXPECT_EQ(0u, pq.client_map.count(1)) <<
+	    "the restored client does not block the erasure";
+	  EXPECT_EQ(1u, pq.client_map.count(2));
+	});
+    }
+
+
+    // clients idled by cleaning go into the idle list in last_tick
+    // order, behind any older idle clients but ahead of idle clients
+    // whose tags were updated more recently
+    TEST(dmclock_server_pull, idle_list_order) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,Request>;
+
+      dmc::ClientInfo reserved_info(1000.0, 1.0, 0.0);
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return 1 == c ? &reserved_info : &info;
+      };
+      ReqParams req_params(1,1);
+
+      Queue pq(client_info_f, false);
+      pq.add_request(Request{}, 1, req_params);
+      pq.add_request(Request{}, 1, req_params);
+
+      test_locked(pq.data_mtx, [&] () {
+	  EXPECT_FALSE(pq.clean_batch(0, pq.client_map.at(1)->last_tick));
+	  EXPECT_TRUE(pq.client_map.at(1)->idle);
+	});
+
+      pq.add_request(Request{}, 2, req_params);
+      pq.add_request(Request{}, 3, req_params);
+
+      // client 1's reservation is due, and dispatching its first
+      // request updates its tag while it is idle
+      Queue::PullReq pr = pq.pull_request();
+      ASSERT_TRUE(pr.is_retn());
+      EXPECT_EQ(1, pr.get_retn().client);
+
+      test_locked(pq.data_mtx, [&] () {
+	  const auto two_tick = pq.client_map.at(2)->last_tick;
+	  ASSERT_LT(two_tick, pq.client_map.at(1)->last_tick);
+	  EXPECT_FALSE(pq.clean_batch(0, two_tick));
+	  EXPECT_TRUE(pq.client_map.at(2)->idle);
+	  EXPECT_FALSE(pq.client_map.at(3)->idle);
+
+	  EXPECT_FALSE(pq.clean_batch(two_tick, 0));
+	  EXPECT_EQ(0u, pq.client_map.count(2)) <<
+	    "client 1's newer tick does not hold back client 2's erasure";
+	  EXPECT_EQ(1u, pq.client_map.count(1));
+	  EXPECT_EQ(1u, pq.client_map.count(3));
+	});
+    }
+
+
+    TEST(dmclock_server_pull, in_place_requests) {
+      using ClientId = int;
+      using Queue = dmc::PullPriorityQueue<ClientId,InPlaceOp>;
+
+      static_assert(std::is_same<Queue::RequestRef,
+				 dmc::InPlaceRequest<InPlaceOp>>::value,
+		    "requests specialized for RequestInPlace are held by value");
+
+      ClientId client1 = 17;
+      ClientId client2 = 98;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &info;
+      };
+
+      Queue pq(client_info_f, false);
+
+      ReqParams req_params(1,1);
+      Time t = 100.0;
+
+      pq.add_request_time(InPlaceOp{0}, client1, req_params, t);
+      pq.add_request(Queue::make_request_ref(InPlaceOp{1}),
+		     client2, req_params, t + 0.5);
+      std::vector<Queue::AddReq> batch;
+      batch.emplace_back(client1, Queue::make_request_ref(InPlaceOp{2}),
+			 req_params);
+      pq.add_requests(batch.begin(), batch.end(), t + 0.1);
+
+      std::vector<int> ids;
+      for (int i = 0; i < 3; ++i) {
+	Queue::PullReq pr = pq.pull_request(t + 10);
+	ASSERT_TRUE(pr.is_retn());
+	auto& retn = pr.get_retn();
+	ASSERT_TRUE(bool(retn.request));
+	ids.push_back(retn.request->id);
+	EXPECT_EQ(retn.request.get(), &*retn.request);
+      }
+      EXPECT_EQ(std::vector<int>({0, 1, 2}), ids);
+      EXPECT_TRUE(pq.pull_request(t + 10).is_none());
+    }
+
+
+    TEST(dmclock_server_push, submission_ring) {
+      using ClientId = int;
+      using Queue = dmc::PushPriorityQueue<ClientId,int>;
+
+      constexpr int producers = 4;
+      constexpr int per_producer = 1000;
+
+      dmc::ClientInfo info(0.0, 1.0, 0.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return &info;
+      };
+
+      // handle_f is called with the queue's lock held, so these need
+      // no further protection
+      std::vector<int> next(producers, 0);
+      std::atomic<int> handled(0);
+      auto server_ready_f = [] () -> bool { return true; };
+      auto submit_req_f = [&] (const ClientId& c,
+			       std::unique_ptr<int> req,
+			       dmc::PhaseType phase,
+			       uint64_t req_cost) {
+	EXPECT_EQ(next[c], *req);
+	next[c] = *req + 1;
+	++handled;
+      };
+
+      Queue pq(client_info_f, server_ready_f, submit_req_f, false);
+      pq.enable_submission_ring(16);
+
+      std::vector<std::thread> threads;
+      for (int t = 0; t < producers; ++t) {
+	threads.emplace_back([&pq, t] () {
+	    ReqParams req_params(1,1);
+	    for (int i = 0; i < per_producer; ++i) {
+	      pq.add_request(int(i), t, req_params);
+	    }
+	  });
+      }
+      for (auto& t : threads) {
+	t.join();
+      }
+
+      // requests staged while another thread held the lock are
+      // scheduled by the sched-ahead thread
+      for (int i = 0; i < 500 && handled < producers * per_producer; ++i) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      EXPECT_EQ(producers * per_producer, handled);
+    }
+
+
+    TEST(dmclock_server_sharded, pull_weight_and_reservation) {
+      using ClientId = int;
+      using Queue = dmc::ShardedPullPriorityQueue<ClientId,Request>;
+
+      ClientId client1 = 17;
+      ClientId client2 = 98;
+      ClientId client3 = 52;
+
+      dmc::ClientInfo info1(0.0, 1.0, 0.0);
+      dmc::ClientInfo info2(0.0, 2.0, 0.0);
+      dmc::ClientInfo info3(1.0, 0.0, 1.0);
+
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	if (client1 == c) return &info1;
+	else if (client2 == c) return &info2;
+	else if (client3 == c) return &info3;
+	else {
+	  ADD_FAILURE() << "client info looked up for non-existant client";
+	  return nullptr;
+	}
+      };
+
+      Queue pq(client_info_f, 4, false);
+      EXPECT_EQ(4u, pq.get_shard_count());
+      EXPECT_TRUE(pq.empty());
+
+      ReqParams req_params(1,1);
+
+      auto now = dmc::get_time();
+
+      // client3 has only a reservation and its first request is due
+      pq.add_request_time(Request{}, client3, req_params, now - 10);
+      pq.add_request_time(Request{}, client3, req_params, now + 5);
+      for (int i = 0; i < 5; ++i) {
+	pq.add_request_time(Request{}, client1, req_params, now);
+	pq.add_request_time(Request{}, client2, req_params, now);
+      }
+
+      EXPECT_EQ(3u, pq.client_count());
+      EXPECT_EQ(12u, pq.request_count());
+
+      Queue::PullReq pr = pq.pull_request(now);
+      ASSERT_TRUE(pr.is_retn());
+      EXPECT_EQ(client3, pr.get_retn().client) <<
+	"reservation that is due comes before any weight-based request";
+      EXPECT_EQ(PhaseType::reservation, pr.get_retn().phase);
+
+      int c1_count = 0;
+      int c2_count = 0;
+      for (int i = 0; i < 6; ++i) {
+	pr = pq.pull_request(now);
+	ASSERT_TRUE(pr.is_retn());
+	auto& retn = pr.get_retn();
+
+	if (client1 == retn.client) ++c1_count;
+	else if (client2 == retn.client) ++c2_count;
+	else ADD_FAILURE() << "got request from unexpected client";
+
+	EXPECT_EQ(PhaseType::priority, retn.phase);
+      }
+
+      EXPECT_EQ(2, c1_count) <<
+	"one-third of request should have come from first client";
+      EXPECT_EQ(4, c2_count) <<
+	"two-thirds of request should have come from second client";
+
+      pq.remove_by_client(client1);
+      pq.remove_by_client(client2);
+
+      // client3's remaining request is not due yet
+      pr = pq.pull_request(now);
+      ASSERT_TRUE(pr.is_future());
+      EXPECT_DOUBLE_EQ(now + 5, pr.getTime());
+    } // dmclock_server_sharded.pull_weight_and_reservation
+
+
+    // a limit break by weight in one shard goes ahead of a limit break
+    // by reservation in another, as it would in a single queue, even
+    // though the reservation tag is the lower value
+    TEST(dmclock_server_sharded, limit_break_prefers_ready) {
+      using ClientId = int;
+      using Queue = dmc::ShardedPullPriorityQueue<ClientId,Request>;
+
+      // std::hash<int> is the identity, so these land in different
+      // shards of two
+      const ClientId resv_client = 1;
+      const ClientId limited_client = 2;
+
+      dmc::ClientInfo resv_info(1.0, 0.0, 0.0);
+      dmc::ClientInfo limited_info(0.0, 1.0, 1.0);
+      auto client_info_f = [&] (ClientId c) -> const dmc::ClientInfo* {
+	return resv_client == c ? &resv_info : &limited_info;
+      };
+
+      Queue pq(client_info_f, 2, true);
+
+      const Time t = 100.0;
+      pq.add_request_time(Request{}, resv_client, ReqParams(1,1), t + 5);
+      pq.add_request_time(Request{}, limited_client, ReqParams(1,1), t + 50);
+
+      // neither is due, so both shards offer a limit break
+      Queue::PullReq pr = pq.pull_request(t);
+      ASSERT_TRUE(pr.is_retn());
+      EXPECT_EQ(limited_client, pr.get_retn().client);
+      EXPECT_EQ(PhaseType::priority, pr.get_retn().phase);
+
+      pr = pq.pull_request(t);
+      ASSERT_TRUE(pr.is_retn());
+      EXPECT_EQ(resv_client, pr.get_retn().client);
+      EXPECT_EQ(PhaseType::reservation, pr.get_retn().phase);
+    }
   } // namespace dmclock
 } // namespace crimson